@@ -4,18 +4,36 @@
 // Performs the calculations for the wave simulation.  After the simulation has been
 // updated, the client must copy the current solution into vertex buffers for rendering.
 // This class only does the calculations, it does not do any drawing.
+//
+// Only the heights change over time, so they are stored separately from the fixed x/z
+// grid coordinates in one of three precisions chosen at construction:
+//
+//   Half:   fp16 storage, fp32 arithmetic.  Halves the bandwidth of the update for very
+//           large grids at the cost of a rounding error of ~1e-3 relative per step.
+//   Single: fp32 storage and arithmetic (the original behavior).
+//   Double: fp64 storage and arithmetic.  Use for long running simulations where the
+//           fp32 recurrence slowly drifts.
 //***************************************************************************************
 
 #ifndef WAVES_H
 #define WAVES_H
 
 #include <vector>
+#include <cstdint>
 #include <DirectXMath.h>
 
 class Waves
 {
 public:
-    Waves(int m, int n, float dx, float dt, float speed, float damping);
+    enum class Precision
+    {
+        Half,
+        Single,
+        Double
+    };
+
+    Waves(int m, int n, float dx, float dt, float speed, float damping,
+          Precision precision = Precision::Single);
     Waves(const Waves& rhs) = delete;
     Waves& operator=(const Waves& rhs) = delete;
     ~Waves();
@@ -26,9 +44,13 @@ public:
 	int TriangleCount()const;
 	float Width()const;
 	float Depth()const;
+	Precision HeightPrecision()const;
 
 	// Returns the solution at the ith grid point.
-    const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+    DirectX::XMFLOAT3 Position(int i)const;
+
+	// Returns the height of the solution at the ith grid point.
+	float Height(int i)const;
 
 	// Returns the solution normal at the ith grid point.
     const DirectX::XMFLOAT3& Normal(int i)const { return mNormals[i]; }
@@ -39,6 +61,61 @@ public:
 	void Update(float dt);
 	void Disturb(int i, int j, float magnitude);
 
+	// Advances the simulation exactly one time step, independent of wall clock time.
+	void Step();
+
+	// Returns the largest absolute height difference to another simulation over
+	// the same grid.  Useful to measure the drift of a lower precision mode against
+	// a Double reference run with the same disturbances.
+	double MaxHeightError(const Waves& reference)const;
+
+	// Returns the largest absolute height on the grid; a growing value on an
+	// undisturbed, damped simulation indicates the recurrence has gone unstable.
+	double MaxAbsHeight()const;
+
+	// Bytes of height storage touched by one simulation step.
+	std::size_t HeightBytes()const;
+
+	// How one precision fared against a Double run of the same simulation.
+	struct PrecisionReport
+	{
+		Precision HeightPrecision = Precision::Single;
+
+		// Largest height difference to the Double run seen over the run.
+		double MaxError = 0.0;
+
+		// Largest absolute height at the end of the run; stays bounded as
+		// long as the recurrence is stable.
+		double MaxAbsHeight = 0.0;
+
+		// Average time of one step of the heights, without the normals.
+		double StepMs = 0.0;
+
+		std::size_t HeightBytes = 0;
+	};
+
+	// Runs an m by n simulation in each precision for numSteps steps, applying
+	// the same pseudorandom disturbances to all of them every disturbInterval
+	// steps, and reports each against the Double run, which comes first.
+	// Takes seconds for 100000 steps of a 64 by 64 grid.
+	static std::vector<PrecisionReport> ComparePrecisions(int m, int n, int numSteps,
+		int disturbInterval = 8);
+
+private:
+	// Step without the normals.
+	void StepHeights();
+
+	template<typename HeightT>
+	void StepSolution(std::vector<HeightT>& prev, const std::vector<HeightT>& curr);
+
+	template<typename HeightT>
+	void ComputeNormals(const std::vector<HeightT>& curr);
+
+	template<typename HeightT>
+	void DisturbSolution(std::vector<HeightT>& curr, int i, int j, float magnitude);
+
+	double ExactHeight(int i)const;
+
 private:
     int mNumRows = 0;
     int mNumCols = 0;
@@ -46,16 +123,26 @@ private:
     int mVertexCount = 0;
     int mTriangleCount = 0;
 
-    // Simulation constants we can precompute.
-    float mK1 = 0.0f;
-    float mK2 = 0.0f;
-    float mK3 = 0.0f;
+    Precision mPrecision = Precision::Single;
+
+    // Simulation constants we can precompute.  Kept in double so the constants
+    // themselves do not limit the accuracy of the Double mode.
+    double mK1 = 0.0;
+    double mK2 = 0.0;
+    double mK3 = 0.0;
 
     float mTimeStep = 0.0f;
     float mSpatialStep = 0.0f;
+    float mAccumTime = 0.0f;
+
+    // Only the vectors of the selected precision are allocated.
+    std::vector<std::uint16_t> mPrevHalf;
+    std::vector<std::uint16_t> mCurrHalf;
+    std::vector<float> mPrevSingle;
+    std::vector<float> mCurrSingle;
+    std::vector<double> mPrevDouble;
+    std::vector<double> mCurrDouble;
 
-    std::vector<DirectX::XMFLOAT3> mPrevSolution;
-    std::vector<DirectX::XMFLOAT3> mCurrSolution;
     std::vector<DirectX::XMFLOAT3> mNormals;
     std::vector<DirectX::XMFLOAT3> mTangentX;
 };
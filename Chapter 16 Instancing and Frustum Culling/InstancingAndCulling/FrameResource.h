@@ -83,10 +83,9 @@ public:
     std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
     std::unique_ptr<UploadBuffer<MaterialData>> MaterialBuffer = nullptr;
 
-	// NOTE: In this demo, we instance only one render-item, so we only have one structured buffer to 
-	// store instancing data.  To make this more general (i.e., to support instancing multiple render-items), 
-	// you would need to have a structured buffer for each render-item, and allocate each buffer with enough
-	// room for the maximum number of instances you would ever draw.  
+	// NOTE: In this demo, the instanced render-items share one structured buffer to store instancing 
+	// data, each render-item using its own range of it (RenderItem::FirstInstance).  The buffer is 
+	// allocated with enough room for the maximum number of instances we would ever draw.  
 	// This sounds like a lot, but it is actually no more than the amount of per-object constant data we 
 	// would need if we were not using instancing.  For example, if we were drawing 1000 objects without instancing,
 	// we would create a constant buffer with enough room for a 1000 objects.  With instancing, we would just
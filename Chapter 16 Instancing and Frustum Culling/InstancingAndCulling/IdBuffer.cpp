@@ -0,0 +1,490 @@
+//***************************************************************************************
+// IdBuffer.cpp
+//***************************************************************************************
+
+#include "IdBuffer.h"
+#include "../../Common/GameTimer.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Box corners closer to the eye plane than this are not projected.
+	const float MinClipW = 1e-3f;
+
+	// Vertices and triangles per parallel task when setting up an object.
+	const UINT SetupChunkSize = 4096;
+}
+
+IdBuffer::IdBuffer(UINT width, UINT height)
+{
+	mTilesX = (width + TileSize - 1) / TileSize;
+	mTilesY = (height + TileSize - 1) / TileSize;
+	mWidth = mTilesX*TileSize;
+	mHeight = mTilesY*TileSize;
+
+	mInvDepth.assign(mWidth*mHeight, 0.0f);
+	mIds.assign(mWidth*mHeight, Id());
+	mDirtyTiles.assign(mTilesX*mTilesY, 0);
+
+	mViewProj = MathHelper::Identity4x4();
+}
+
+UINT IdBuffer::AddMesh(const MeshGeometry& geo, UINT indexCount, UINT startIndexLocation,
+	INT baseVertexLocation, const BoundingBox& localBounds)
+{
+	auto vertexData = (const BYTE*)geo.VertexBufferCPU->GetBufferPointer();
+	auto indexData = geo.IndexBufferCPU->GetBufferPointer();
+
+	Mesh mesh;
+	mesh.Bounds = localBounds;
+	mesh.Indices.resize(indexCount);
+
+	// Keep only the vertices the submesh uses, renumbered from zero.
+	std::unordered_map<UINT, UINT> remap;
+	for(UINT i = 0; i < indexCount; ++i)
+	{
+		UINT index = geo.IndexFormat == DXGI_FORMAT_R16_UINT ?
+			((const std::uint16_t*)indexData)[startIndexLocation + i] :
+			((const std::uint32_t*)indexData)[startIndexLocation + i];
+		index += baseVertexLocation;
+
+		auto it = remap.find(index);
+		if(it == remap.end())
+		{
+			it = remap.emplace(index, (UINT)mesh.Positions.size()).first;
+			mesh.Positions.push_back(*(const XMFLOAT3*)(vertexData + index*geo.VertexByteStride));
+		}
+
+		mesh.Indices[i] = it->second;
+	}
+
+	mClipVertices.resize(MathHelper::Max(mClipVertices.size(), mesh.Positions.size()));
+	mScreenTriangles.resize(MathHelper::Max(mScreenTriangles.size(), (size_t)(2*(indexCount / 3))));
+	mPieceCounts.resize(MathHelper::Max(mPieceCounts.size(), (size_t)(indexCount / 3)));
+
+	mMeshes.push_back(std::move(mesh));
+
+	return (UINT)mMeshes.size() - 1;
+}
+
+UINT IdBuffer::AddObject(UINT mesh, const XMFLOAT4X4& world)
+{
+	Object object;
+	object.Mesh = mesh;
+	object.World = world;
+	mObjects.push_back(object);
+
+	// The object is drawn with everything else at the next update.
+	mValid = false;
+
+	return (UINT)mObjects.size() - 1;
+}
+
+void IdBuffer::SetObjectWorld(UINT object, const XMFLOAT4X4& world)
+{
+	mObjects[object].World = world;
+	mObjects[object].Moved = true;
+	mAnyMoved = true;
+}
+
+bool IdBuffer::IsCurrent(FXMMATRIX view, CXMMATRIX proj)const
+{
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, XMMatrixMultiply(view, proj));
+
+	return mValid && !mAnyMoved && memcmp(&viewProj, &mViewProj, sizeof(viewProj)) == 0;
+}
+
+bool IdBuffer::Update(FXMMATRIX view, CXMMATRIX proj)
+{
+	if(IsCurrent(view, proj))
+		return false;
+
+	__int64 start = GameTimer::ReadCounter();
+
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, XMMatrixMultiply(view, proj));
+
+	std::fill(mDirtyTiles.begin(), mDirtyTiles.end(), (BYTE)0);
+
+	if(!mValid || memcmp(&viewProj, &mViewProj, sizeof(viewProj)) != 0)
+	{
+		// A new camera: everything moves on screen.
+		mViewProj = viewProj;
+		mValid = true;
+
+		std::fill(mDirtyTiles.begin(), mDirtyTiles.end(), (BYTE)1);
+		for(Object& object : mObjects)
+			ComputeTileRect(object);
+	}
+	else
+	{
+		// Draw again where the moved objects were and where they are now.
+		for(Object& object : mObjects)
+		{
+			if(!object.Moved)
+				continue;
+
+			MarkTiles(object);
+			ComputeTileRect(object);
+			MarkTiles(object);
+		}
+	}
+
+	for(Object& object : mObjects)
+		object.Moved = false;
+	mAnyMoved = false;
+
+	for(UINT ty = 0; ty < mTilesY; ++ty)
+	{
+		for(UINT tx = 0; tx < mTilesX; ++tx)
+		{
+			if(!mDirtyTiles[ty*mTilesX + tx])
+				continue;
+
+			for(UINT y = ty*TileSize; y < (ty + 1)*TileSize; ++y)
+			{
+				UINT first = y*mWidth + tx*TileSize;
+				std::fill(mInvDepth.begin() + first, mInvDepth.begin() + first + TileSize, 0.0f);
+				std::fill(mIds.begin() + first, mIds.begin() + first + TileSize, Id());
+			}
+		}
+	}
+
+	mLastUpdateTriangles = 0;
+	for(UINT o = 0; o < (UINT)mObjects.size(); ++o)
+	{
+		if(OverlapsDirtyTile(mObjects[o]))
+			DrawObject(o);
+	}
+
+	mLastUpdateMs = GameTimer::MillisecondsSince(start);
+
+	return true;
+}
+
+IdBuffer::Id IdBuffer::Lookup(int sx, int sy, UINT viewportWidth, UINT viewportHeight)const
+{
+	int x = (int)((INT64)sx*mWidth / viewportWidth);
+	int y = (int)((INT64)sy*mHeight / viewportHeight);
+
+	if(x < 0 || y < 0 || x >= (int)mWidth || y >= (int)mHeight)
+		return Id();
+
+	return mIds[y*mWidth + x];
+}
+
+void IdBuffer::LookupRect(int x0, int y0, int x1, int y1, UINT viewportWidth, UINT viewportHeight,
+	std::vector<UINT>& objects)const
+{
+	int left = (int)((INT64)MathHelper::Min(x0, x1)*mWidth / viewportWidth);
+	int right = (int)((INT64)MathHelper::Max(x0, x1)*mWidth / viewportWidth);
+	int top = (int)((INT64)MathHelper::Min(y0, y1)*mHeight / viewportHeight);
+	int bottom = (int)((INT64)MathHelper::Max(y0, y1)*mHeight / viewportHeight);
+
+	left = MathHelper::Max(left, 0);
+	top = MathHelper::Max(top, 0);
+	right = MathHelper::Min(right, (int)mWidth - 1);
+	bottom = MathHelper::Min(bottom, (int)mHeight - 1);
+
+	std::vector<bool> seen(mObjects.size(), false);
+	for(int y = top; y <= bottom; ++y)
+	{
+		for(int x = left; x <= right; ++x)
+		{
+			UINT object = mIds[y*mWidth + x].Object;
+			if(object != NoObject)
+				seen[object] = true;
+		}
+	}
+
+	for(UINT o = 0; o < (UINT)seen.size(); ++o)
+	{
+		if(seen[o])
+			objects.push_back(o);
+	}
+}
+
+double IdBuffer::LastUpdateMs()const
+{
+	return mLastUpdateMs;
+}
+
+UINT IdBuffer::LastUpdateTriangles()const
+{
+	return mLastUpdateTriangles;
+}
+
+void IdBuffer::ComputeTileRect(Object& object)const
+{
+	object.TileX0 = object.TileY0 = 0;
+	object.TileX1 = object.TileY1 = -1;
+
+	BoundingBox worldBounds;
+	mMeshes[object.Mesh].Bounds.Transform(worldBounds, XMLoadFloat4x4(&object.World));
+
+	XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+	worldBounds.GetCorners(corners);
+
+	XMMATRIX viewProj = XMLoadFloat4x4(&mViewProj);
+
+	// Bit p of outside is set while every corner is outside side p of the
+	// frustum: left, right, bottom, top and behind the eye.
+	UINT outside = 0x1f;
+	bool behindEye = false;
+	XMVECTOR ndcMin = g_XMInfinity;
+	XMVECTOR ndcMax = -g_XMInfinity;
+	for(UINT i = 0; i < BoundingBox::CORNER_COUNT; ++i)
+	{
+		XMFLOAT4 c;
+		XMStoreFloat4(&c, XMVector4Transform(XMVectorSetW(XMLoadFloat3(&corners[i]), 1.0f), viewProj));
+
+		UINT cornerOutside =
+			(c.x < -c.w ? 0x1u : 0u) | (c.x > c.w ? 0x2u : 0u) |
+			(c.y < -c.w ? 0x4u : 0u) | (c.y > c.w ? 0x8u : 0u) |
+			(c.w < MinClipW ? 0x10u : 0u);
+		outside &= cornerOutside;
+
+		if(c.w < MinClipW)
+		{
+			behindEye = true;
+			continue;
+		}
+
+		XMVECTOR ndc = XMVectorSet(c.x / c.w, c.y / c.w, 0.0f, 0.0f);
+		ndcMin = XMVectorMin(ndcMin, ndc);
+		ndcMax = XMVectorMax(ndcMax, ndc);
+	}
+
+	if(outside != 0)
+		return;
+
+	// Part of the box is behind the eye, so its projection is unbounded.
+	if(behindEye)
+	{
+		object.TileX1 = (int)mTilesX - 1;
+		object.TileY1 = (int)mTilesY - 1;
+		return;
+	}
+
+	XMFLOAT2 lo;
+	XMFLOAT2 hi;
+	XMStoreFloat2(&lo, ndcMin);
+	XMStoreFloat2(&hi, ndcMax);
+
+	int x0 = (int)floorf((0.5f*lo.x + 0.5f)*mWidth) / (int)TileSize;
+	int x1 = (int)floorf((0.5f*hi.x + 0.5f)*mWidth) / (int)TileSize;
+	int y0 = (int)floorf((0.5f - 0.5f*hi.y)*mHeight) / (int)TileSize;
+	int y1 = (int)floorf((0.5f - 0.5f*lo.y)*mHeight) / (int)TileSize;
+
+	object.TileX0 = MathHelper::Max(x0, 0);
+	object.TileY0 = MathHelper::Max(y0, 0);
+	object.TileX1 = MathHelper::Min(x1, (int)mTilesX - 1);
+	object.TileY1 = MathHelper::Min(y1, (int)mTilesY - 1);
+}
+
+void IdBuffer::MarkTiles(const Object& object)
+{
+	for(int ty = object.TileY0; ty <= object.TileY1; ++ty)
+	{
+		for(int tx = object.TileX0; tx <= object.TileX1; ++tx)
+			mDirtyTiles[ty*mTilesX + tx] = 1;
+	}
+}
+
+bool IdBuffer::OverlapsDirtyTile(const Object& object)const
+{
+	for(int ty = object.TileY0; ty <= object.TileY1; ++ty)
+	{
+		for(int tx = object.TileX0; tx <= object.TileX1; ++tx)
+		{
+			if(mDirtyTiles[ty*mTilesX + tx])
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void IdBuffer::DrawObject(UINT objectId)
+{
+	const Object& object = mObjects[objectId];
+	const Mesh& mesh = mMeshes[object.Mesh];
+
+	const UINT numVertices = (UINT)mesh.Positions.size();
+	const UINT numTriangles = (UINT)mesh.Indices.size() / 3;
+
+	XMMATRIX worldViewProj = XMMatrixMultiply(XMLoadFloat4x4(&object.World), XMLoadFloat4x4(&mViewProj));
+
+	concurrency::parallel_for(0u, numVertices, SetupChunkSize, [&](UINT first)
+	{
+		UINT last = MathHelper::Min(first + SetupChunkSize, numVertices);
+
+		for(UINT i = first; i < last; ++i)
+		{
+			XMVECTOR p = XMVectorSetW(XMLoadFloat3(&mesh.Positions[i]), 1.0f);
+			XMStoreFloat4(&mClipVertices[i], XMVector4Transform(p, worldViewProj));
+		}
+	});
+
+	// Triangle t writes its pieces to slots 2t and 2t+1.
+	concurrency::parallel_for(0u, numTriangles, SetupChunkSize, [&](UINT first)
+	{
+		UINT last = MathHelper::Min(first + SetupChunkSize, numTriangles);
+
+		for(UINT t = first; t < last; ++t)
+		{
+			XMVECTOR v0 = XMLoadFloat4(&mClipVertices[mesh.Indices[3*t + 0]]);
+			XMVECTOR v1 = XMLoadFloat4(&mClipVertices[mesh.Indices[3*t + 1]]);
+			XMVECTOR v2 = XMLoadFloat4(&mClipVertices[mesh.Indices[3*t + 2]]);
+
+			mPieceCounts[t] = (BYTE)SetupTriangle(v0, v1, v2, t, &mScreenTriangles[2*t]);
+		}
+	});
+
+	for(UINT t = 0; t < numTriangles; ++t)
+		mLastUpdateTriangles += mPieceCounts[t];
+
+	// Each task draws one band of rows, so no two tasks write the same pixel.
+	const UINT firstBand = object.TileY0*TileSize / BandSize;
+	const UINT lastBand = (object.TileY1*TileSize + TileSize - 1) / BandSize;
+
+	concurrency::parallel_for(firstBand, lastBand + 1, [&](UINT band)
+	{
+		int y0 = band*BandSize;
+		int y1 = MathHelper::Min((band + 1)*BandSize, mHeight);
+
+		for(UINT t = 0; t < numTriangles; ++t)
+		{
+			for(UINT k = 0; k < mPieceCounts[t]; ++k)
+			{
+				const ScreenTriangle& tri = mScreenTriangles[2*t + k];
+				if(tri.MaxY >= y0 && tri.MinY < y1)
+					RasterizeRows(tri, objectId, y0, y1);
+			}
+		}
+	});
+}
+
+UINT IdBuffer::SetupTriangle(FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2,
+	UINT triangle, ScreenTriangle* out)const
+{
+	// Clip against the near plane, clip z = 0, as the GPU does, so that no
+	// geometry the GPU does not draw can win a pixel.  This leaves at most four
+	// vertices, all with w at least the near plane distance.
+	XMVECTOR in[3] = { v0, v1, v2 };
+	XMVECTOR poly[4];
+	UINT n = 0;
+	for(UINT i = 0; i < 3; ++i)
+	{
+		XMVECTOR a = in[i];
+		XMVECTOR b = in[(i + 1) % 3];
+		float za = XMVectorGetZ(a);
+		float zb = XMVectorGetZ(b);
+
+		if(za >= 0.0f)
+			poly[n++] = a;
+
+		if((za >= 0.0f) != (zb >= 0.0f))
+			poly[n++] = XMVectorLerp(a, b, za / (za - zb));
+	}
+
+	if(n < 3)
+		return 0;
+
+	float sx[4];
+	float sy[4];
+	float invW[4];
+	for(UINT i = 0; i < n; ++i)
+	{
+		XMFLOAT4 c;
+		XMStoreFloat4(&c, poly[i]);
+
+		invW[i] = 1.0f / c.w;
+		sx[i] = (0.5f*c.x*invW[i] + 0.5f)*mWidth;
+		sy[i] = (0.5f - 0.5f*c.y*invW[i])*mHeight;
+	}
+
+	// Fan out the clipped polygon.
+	UINT count = 0;
+	for(UINT k = 1; k + 1 < n; ++k)
+	{
+		const UINT v[3] = { 0, k, k + 1 };
+
+		// Front faces are clockwise on screen, which with y down is a
+		// positive area.
+		float area = (sx[v[1]] - sx[v[0]])*(sy[v[2]] - sy[v[0]]) - (sy[v[1]] - sy[v[0]])*(sx[v[2]] - sx[v[0]]);
+		if(area <= 0.0f)
+			continue;
+
+		ScreenTriangle tri;
+		for(UINT i = 0; i < 3; ++i)
+		{
+			tri.X[i] = sx[v[i]];
+			tri.Y[i] = sy[v[i]];
+			tri.InvW[i] = invW[v[i]];
+		}
+
+		// The pixels whose centers may be inside.
+		float minX = MathHelper::Min(tri.X[0], MathHelper::Min(tri.X[1], tri.X[2]));
+		float maxX = MathHelper::Max(tri.X[0], MathHelper::Max(tri.X[1], tri.X[2]));
+		float minY = MathHelper::Min(tri.Y[0], MathHelper::Min(tri.Y[1], tri.Y[2]));
+		float maxY = MathHelper::Max(tri.Y[0], MathHelper::Max(tri.Y[1], tri.Y[2]));
+
+		tri.MinX = MathHelper::Max((int)ceilf(minX - 0.5f), 0);
+		tri.MinY = MathHelper::Max((int)ceilf(minY - 0.5f), 0);
+		tri.MaxX = MathHelper::Min((int)floorf(maxX - 0.5f), (int)mWidth - 1);
+		tri.MaxY = MathHelper::Min((int)floorf(maxY - 0.5f), (int)mHeight - 1);
+		tri.Triangle = triangle;
+
+		if(tri.MinX > tri.MaxX || tri.MinY > tri.MaxY)
+			continue;
+
+		out[count++] = tri;
+	}
+
+	return count;
+}
+
+void IdBuffer::RasterizeRows(const ScreenTriangle& tri, UINT objectId, int y0, int y1)
+{
+	const float area =
+		(tri.X[1] - tri.X[0])*(tri.Y[2] - tri.Y[0]) - (tri.Y[1] - tri.Y[0])*(tri.X[2] - tri.X[0]);
+	const float invArea = 1.0f / area;
+
+	const int firstRow = MathHelper::Max(tri.MinY, y0);
+	const int lastRow = MathHelper::Min(tri.MaxY, y1 - 1);
+
+	for(int y = firstRow; y <= lastRow; ++y)
+	{
+		const float cy = y + 0.5f;
+
+		for(int x = tri.MinX; x <= tri.MaxX; ++x)
+		{
+			if(!mDirtyTiles[(y / TileSize)*mTilesX + x / TileSize])
+				continue;
+
+			const float cx = x + 0.5f;
+
+			// The weight of each vertex is the edge function of the opposite
+			// edge, which is positive inside for a positive area.
+			float e0 = (tri.X[2] - tri.X[1])*(cy - tri.Y[1]) - (tri.Y[2] - tri.Y[1])*(cx - tri.X[1]);
+			float e1 = (tri.X[0] - tri.X[2])*(cy - tri.Y[2]) - (tri.Y[0] - tri.Y[2])*(cx - tri.X[2]);
+			float e2 = (tri.X[1] - tri.X[0])*(cy - tri.Y[0]) - (tri.Y[1] - tri.Y[0])*(cx - tri.X[0]);
+			if(e0 < 0.0f || e1 < 0.0f || e2 < 0.0f)
+				continue;
+
+			// 1/w is linear in screen space, and larger is nearer.
+			float invW = (e0*tri.InvW[0] + e1*tri.InvW[1] + e2*tri.InvW[2])*invArea;
+
+			const UINT i = y*mWidth + x;
+			if(invW > mInvDepth[i])
+			{
+				mInvDepth[i] = invW;
+				mIds[i].Object = objectId;
+				mIds[i].Triangle = tri.Triangle;
+			}
+		}
+	}
+}
@@ -0,0 +1,154 @@
+//***************************************************************************************
+// IdBuffer.h
+//
+// Rasterizes the scene on the CPU into a small buffer holding, for every pixel, the
+// object and triangle nearest the eye, like the ID buffer a renderer would draw on
+// the GPU for picking.  A pick is then one lookup and a marquee selection a scan of
+// a rectangle.  The buffer is only drawn again when the camera changes, and when
+// objects move only the tiles they covered or now cover are drawn again.
+//***************************************************************************************
+
+#pragma once
+
+#include "../../Common/d3dUtil.h"
+#include <ppl.h>
+
+class IdBuffer
+{
+public:
+	static const UINT NoObject = 0xffffffff;
+
+	struct Id
+	{
+		// NoObject where nothing was drawn.
+		UINT Object = NoObject;
+
+		// The triangle's index within the object's mesh.
+		UINT Triangle = 0;
+	};
+
+	// width and height are the buffer size, rounded up to whole tiles.  The
+	// buffer covers the whole viewport, whatever its size.
+	IdBuffer(UINT width = 320, UINT height = 180);
+	IdBuffer(const IdBuffer& rhs) = delete;
+	IdBuffer& operator=(const IdBuffer& rhs) = delete;
+	~IdBuffer() = default;
+
+	// Copies the triangles of a submesh of geo and returns the mesh index.  As
+	// in every vertex format of the demos, the position must be the XMFLOAT3
+	// at the start of each vertex.
+	UINT AddMesh(const MeshGeometry& geo, UINT indexCount, UINT startIndexLocation,
+		INT baseVertexLocation, const DirectX::BoundingBox& localBounds);
+
+	// Adds an object drawn with mesh at world and returns its ID.  IDs count
+	// up from zero in the order the objects are added.
+	UINT AddObject(UINT mesh, const DirectX::XMFLOAT4X4& world);
+	void SetObjectWorld(UINT object, const DirectX::XMFLOAT4X4& world);
+
+	// Brings the buffer up to date for the camera.  Everything is drawn again
+	// if view or proj has changed since the last update, or only the tiles
+	// touched by the objects moved since then otherwise.  Returns true if
+	// anything was drawn.
+	bool Update(DirectX::FXMMATRIX view, DirectX::CXMMATRIX proj);
+
+	// True if Update would draw nothing for this camera.
+	bool IsCurrent(DirectX::FXMMATRIX view, DirectX::CXMMATRIX proj)const;
+
+	// The ID under pixel (sx, sy) of a viewport of the given size.
+	Id Lookup(int sx, int sy, UINT viewportWidth, UINT viewportHeight)const;
+
+	// Appends to objects, in increasing order, the objects seen in the
+	// rectangle of viewport pixels with corners (x0, y0) and (x1, y1).
+	void LookupRect(int x0, int y0, int x1, int y1, UINT viewportWidth, UINT viewportHeight,
+		std::vector<UINT>& objects)const;
+
+	// Time spent and triangles drawn by the last Update that drew anything.
+	double LastUpdateMs()const;
+	UINT LastUpdateTriangles()const;
+
+private:
+	struct Mesh
+	{
+		std::vector<DirectX::XMFLOAT3> Positions;
+		std::vector<UINT> Indices;
+		DirectX::BoundingBox Bounds;
+	};
+
+	struct Object
+	{
+		UINT Mesh = 0;
+		DirectX::XMFLOAT4X4 World;
+
+		// The tiles the object covered when it was last drawn, as an
+		// inclusive range.  Empty if it was off screen.
+		int TileX0 = 0;
+		int TileY0 = 0;
+		int TileX1 = -1;
+		int TileY1 = -1;
+
+		bool Moved = false;
+	};
+
+	// A triangle ready to rasterize: screen space x and y and the reciprocal
+	// of the view depth at its vertices, and the pixels it may cover.
+	struct ScreenTriangle
+	{
+		float X[3];
+		float Y[3];
+		float InvW[3];
+		int MinX;
+		int MinY;
+		int MaxX;
+		int MaxY;
+		UINT Triangle;
+	};
+
+	// Finds the tiles the object covers for the current camera.
+	void ComputeTileRect(Object& object)const;
+	void MarkTiles(const Object& object);
+	bool OverlapsDirtyTile(const Object& object)const;
+
+	// Draws the triangles of the object into the dirty tiles.
+	void DrawObject(UINT objectId);
+
+	// Clips a clip space triangle to the near plane and appends the pieces to
+	// out.  Returns the number appended.
+	UINT SetupTriangle(DirectX::FXMVECTOR v0, DirectX::FXMVECTOR v1, DirectX::FXMVECTOR v2,
+		UINT triangle, ScreenTriangle* out)const;
+
+	void RasterizeRows(const ScreenTriangle& tri, UINT objectId, int y0, int y1);
+
+private:
+	static const UINT TileSize = 8;
+
+	// Rows of pixels per parallel task.
+	static const UINT BandSize = 2*TileSize;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mTilesX = 0;
+	UINT mTilesY = 0;
+
+	std::vector<Mesh> mMeshes;
+	std::vector<Object> mObjects;
+	bool mAnyMoved = false;
+
+	DirectX::XMFLOAT4X4 mViewProj;
+	bool mValid = false;
+
+	// Per pixel, the reciprocal of the view depth of the nearest surface (zero
+	// where there is none) and what that surface is.
+	std::vector<float> mInvDepth;
+	std::vector<Id> mIds;
+
+	// Tiles to clear and draw again in the current Update.
+	std::vector<BYTE> mDirtyTiles;
+
+	// Working memory for DrawObject, sized for the largest mesh.
+	std::vector<DirectX::XMFLOAT4> mClipVertices;
+	std::vector<ScreenTriangle> mScreenTriangles;
+	std::vector<BYTE> mPieceCounts;
+
+	double mLastUpdateMs = 0.0;
+	UINT mLastUpdateTriangles = 0;
+};
@@ -0,0 +1,485 @@
+//***************************************************************************************
+// InstanceCulling.cpp
+//***************************************************************************************
+
+#include "InstanceCulling.h"
+#include "OcclusionCulling.h"
+#include <numeric>
+
+using namespace DirectX;
+
+namespace
+{
+	// The camera motion totals are reset, along with every saved answer, once
+	// either grows this large, before float precision starts to blur the
+	// small differences between them.
+	const float MaxCameraMotion = 1.0e4f;
+
+	// Grid cells are this many times the largest extent of the mesh bounds.
+	const float GridCellScale = 4.0f;
+
+	XMVECTOR LoadFour(const std::vector<float>& v, UINT i)
+	{
+		return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&v[i]));
+	}
+}
+
+void InstanceBounds::Resize(UINT count)
+{
+	const UINT paddedCount = (count + 3) & ~3u;
+
+	Count = count;
+
+	CenterX.assign(paddedCount, 0.0f);
+	CenterY.assign(paddedCount, 0.0f);
+	CenterZ.assign(paddedCount, 0.0f);
+
+	ExtentX.assign(paddedCount, 0.0f);
+	ExtentY.assign(paddedCount, 0.0f);
+	ExtentZ.assign(paddedCount, 0.0f);
+}
+
+void InstanceBounds::Set(UINT i, const BoundingBox& box)
+{
+	CenterX[i] = box.Center.x;
+	CenterY[i] = box.Center.y;
+	CenterZ[i] = box.Center.z;
+
+	ExtentX[i] = box.Extents.x;
+	ExtentY[i] = box.Extents.y;
+	ExtentZ[i] = box.Extents.z;
+}
+
+BoundingBox InstanceBounds::Get(UINT i)const
+{
+	return BoundingBox(
+		XMFLOAT3(CenterX[i], CenterY[i], CenterZ[i]),
+		XMFLOAT3(ExtentX[i], ExtentY[i], ExtentZ[i]));
+}
+
+void InstanceCuller::Build(const BoundingBox& localBounds, const std::vector<InstanceData>& instances)
+{
+	const UINT numInstances = (UINT)instances.size();
+
+	mLocalBounds = localBounds;
+	mWorldBounds.Resize(numInstances);
+
+	std::vector<BoundingBox> worldBoxes(numInstances);
+
+	concurrency::parallel_for(0u, numInstances, ChunkSize, [&](UINT first)
+	{
+		UINT last = MathHelper::Min(first + ChunkSize, numInstances);
+
+		for(UINT i = first; i < last; ++i)
+		{
+			XMMATRIX world = XMLoadFloat4x4(&instances[i].World);
+
+			mLocalBounds.Transform(worldBoxes[i], world);
+			mWorldBounds.Set(i, worldBoxes[i]);
+		}
+	});
+
+	mHierarchy.Build(worldBoxes);
+	mHierarchyDirty = false;
+
+	const XMFLOAT3& e = mLocalBounds.Extents;
+	mGrid.Reset(GridCellScale*std::max(std::max(e.x, e.y), std::max(e.z, 1.0e-3f)));
+	for(UINT i = 0; i < numInstances; ++i)
+		mGrid.Insert(i, worldBoxes[i]);
+
+	mCoherence.assign(numInstances, CoherenceState());
+
+	mVisible.clear();
+}
+
+void InstanceCuller::UpdateInstance(UINT i, const XMFLOAT4X4& world)
+{
+	BoundingBox box;
+	mLocalBounds.Transform(box, XMLoadFloat4x4(&world));
+	mWorldBounds.Set(i, box);
+
+	mHierarchy.SetItemBounds(i, box);
+	mHierarchyDirty = true;
+
+	mGrid.Move(i, box);
+
+	mCoherence[i].Slack = -1.0f;
+}
+
+UINT InstanceCuller::InstanceCount()const
+{
+	return mWorldBounds.Count;
+}
+
+BoundingBox InstanceCuller::WorldBounds(UINT i)const
+{
+	return mWorldBounds.Get(i);
+}
+
+void InstanceCuller::Cull(const BoundingFrustum& worldFrustum)
+{
+	XMVECTOR planes[6];
+	worldFrustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	const UINT numInstances = mWorldBounds.Count;
+	const UINT numChunks = (numInstances + ChunkSize - 1) / ChunkSize;
+
+	mVisibleMask.resize((numInstances + 31) / 32);
+	mChunkVisible.resize(numInstances);
+	mChunkCounts.resize(numChunks);
+
+	concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+	{
+		UINT first = chunk*ChunkSize;
+		UINT last = MathHelper::Min(first + ChunkSize, numInstances);
+
+		TestBoxes(planes, first, last);
+
+		// Expand the chunk's mask words into instance indices.
+		UINT count = 0;
+		for(UINT w = first / 32; w < (last + 31) / 32; ++w)
+		{
+			UINT bits = mVisibleMask[w];
+			for(UINT b = 0; bits != 0; ++b, bits >>= 1)
+			{
+				if(bits & 1)
+					mChunkVisible[first + count++] = 32*w + b;
+			}
+		}
+
+		mChunkCounts[chunk] = count;
+	});
+
+	CompactChunks(numChunks);
+}
+
+void InstanceCuller::CullHierarchical(const BoundingFrustum& worldFrustum)
+{
+	if(mHierarchyDirty)
+	{
+		mHierarchy.Refit();
+		mHierarchyDirty = false;
+	}
+
+	mVisible.clear();
+	mHierarchy.FrustumQuery(worldFrustum, mVisible);
+
+	SortVisible();
+}
+
+void InstanceCuller::CullCoherent(const BoundingFrustum& worldFrustum)
+{
+	TrackCamera(worldFrustum);
+
+	// Slack is measured in world units, so the planes must be normalized.
+	XMVECTOR planes[6];
+	worldFrustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+	for(int p = 0; p < 6; ++p)
+		planes[p] = XMPlaneNormalize(planes[p]);
+
+	const XMVECTOR eye = XMLoadFloat3(&worldFrustum.Origin);
+
+	const UINT numInstances = mWorldBounds.Count;
+	const UINT numChunks = (numInstances + ChunkSize - 1) / ChunkSize;
+
+	mVisibleMask.assign((numInstances + 31) / 32, 0);
+	mChunkVisible.resize(numInstances);
+	mChunkCounts.resize(numChunks);
+	mChunkSkipped.resize(numChunks);
+
+	concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+	{
+		UINT first = chunk*ChunkSize;
+		UINT last = MathHelper::Min(first + ChunkSize, numInstances);
+		UINT count = 0;
+		UINT skipped = 0;
+
+		for(UINT i = first; i < last; ++i)
+		{
+			const CoherenceState& state = mCoherence[i];
+
+			// Per frame, a point at distance r from the eye moves relative to a
+			// plane by at most r times the change in the plane normal, plus the
+			// distance the eye moved.  Summed over the frames since the test,
+			// with r growing by at most the distance travelled, this bounds how
+			// far the box can have moved across any plane.
+			float travel = mCameraTravel - state.Travel;
+			float turn = mCameraTurn - state.Turn;
+
+			if(state.Slack > 0.0f && turn*(state.Reach + travel) + travel < state.Slack)
+				skipped++;
+			else
+				Classify(planes, eye, i);
+
+			if(state.Visible)
+			{
+				mChunkVisible[first + count++] = i;
+				mVisibleMask[i / 32] |= 1u << (i % 32);
+			}
+		}
+
+		mChunkCounts[chunk] = count;
+		mChunkSkipped[chunk] = skipped;
+	});
+
+	CompactChunks(numChunks);
+
+	mSkippedTests = 0;
+	for(UINT c = 0; c < numChunks; ++c)
+		mSkippedTests += mChunkSkipped[c];
+}
+
+UINT InstanceCuller::SkippedTests()const
+{
+	return mSkippedTests;
+}
+
+void InstanceCuller::RemoveOccluded(OcclusionCuller& occlusion)
+{
+	occlusion.RemoveOccluded(mWorldBounds, mVisible);
+
+	SortVisible();
+}
+
+const BoundingVolumeHierarchy& InstanceCuller::Hierarchy()const
+{
+	return mHierarchy;
+}
+
+void InstanceCuller::CullGrid(const BoundingFrustum& worldFrustum)
+{
+	mVisible.clear();
+	mGrid.FrustumQuery(worldFrustum, mVisible);
+
+	SortVisible();
+}
+
+const SpatialGrid& InstanceCuller::Grid()const
+{
+	return mGrid;
+}
+
+void InstanceCuller::SelectAll()
+{
+	const UINT numInstances = mWorldBounds.Count;
+
+	mVisibleMask.assign((numInstances + 31) / 32, 0xffffffff);
+	if(numInstances % 32 != 0)
+		mVisibleMask.back() = (1u << (numInstances % 32)) - 1;
+
+	mVisible.resize(numInstances);
+	std::iota(mVisible.begin(), mVisible.end(), 0u);
+}
+
+const std::vector<UINT>& InstanceCuller::VisibleInstances()const
+{
+	return mVisible;
+}
+
+const std::vector<UINT>& InstanceCuller::VisibleMask()const
+{
+	return mVisibleMask;
+}
+
+UINT InstanceCuller::CountCullErrors(const BoundingFrustum& worldFrustum)const
+{
+	const UINT numInstances = mWorldBounds.Count;
+	if(mVisibleMask.size() != (numInstances + 31) / 32)
+		return numInstances;
+
+	UINT errors = 0;
+	for(UINT i = 0; i < numInstances; ++i)
+	{
+		bool visible = (mVisibleMask[i / 32] & (1u << (i % 32))) != 0;
+		bool expected = worldFrustum.Contains(mWorldBounds.Get(i)) != DISJOINT;
+
+		if(visible != expected)
+			++errors;
+	}
+
+	return errors;
+}
+
+void InstanceCuller::TestBoxes(const XMVECTOR planes[6], UINT first, UINT last)
+{
+	// Splat each plane component across the four lanes, one box per lane.  The
+	// absolute normal projects a box's extents onto the plane normal.
+	XMVECTOR nx[6], ny[6], nz[6], d[6];
+	XMVECTOR ax[6], ay[6], az[6];
+	for(int p = 0; p < 6; ++p)
+	{
+		nx[p] = XMVectorSplatX(planes[p]);
+		ny[p] = XMVectorSplatY(planes[p]);
+		nz[p] = XMVectorSplatZ(planes[p]);
+		d[p] = XMVectorSplatW(planes[p]);
+
+		XMVECTOR absNormal = XMVectorAbs(planes[p]);
+		ax[p] = XMVectorSplatX(absNormal);
+		ay[p] = XMVectorSplatY(absNormal);
+		az[p] = XMVectorSplatZ(absNormal);
+	}
+
+	// The mask bit of each lane.
+	const XMVECTORU32 laneBits = { { { 1, 2, 4, 8 } } };
+
+	const InstanceBounds& b = mWorldBounds;
+
+	for(UINT wordStart = first; wordStart < last; wordStart += 32)
+	{
+		const UINT wordEnd = MathHelper::Min(wordStart + 32, last);
+
+		UINT bits = 0;
+		for(UINT i = wordStart; i < wordEnd; i += 4)
+		{
+			XMVECTOR cx = LoadFour(b.CenterX, i);
+			XMVECTOR cy = LoadFour(b.CenterY, i);
+			XMVECTOR cz = LoadFour(b.CenterZ, i);
+
+			XMVECTOR ex = LoadFour(b.ExtentX, i);
+			XMVECTOR ey = LoadFour(b.ExtentY, i);
+			XMVECTOR ez = LoadFour(b.ExtentZ, i);
+
+			// A box is outside the frustum if its center is further in front of
+			// some outward facing plane than its extents reach.
+			XMVECTOR outside = XMVectorFalseInt();
+			for(int p = 0; p < 6; ++p)
+			{
+				XMVECTOR dist = XMVectorMultiplyAdd(cz, nz[p],
+					XMVectorMultiplyAdd(cy, ny[p], XMVectorMultiplyAdd(cx, nx[p], d[p])));
+				XMVECTOR radius = XMVectorMultiplyAdd(ez, az[p],
+					XMVectorMultiplyAdd(ey, ay[p], ex*ax[p]));
+
+				outside = XMVectorOrInt(outside, XMVectorGreater(dist, radius));
+			}
+
+			XMUINT4 lanes;
+			XMStoreUInt4(&lanes, XMVectorAndCInt(laneBits, outside));
+
+			bits |= (lanes.x | lanes.y | lanes.z | lanes.w) << (i - wordStart);
+		}
+
+		// Clear the bits of the padding past the last instance.
+		if(wordEnd - wordStart < 32)
+			bits &= (1u << (wordEnd - wordStart)) - 1;
+
+		mVisibleMask[wordStart / 32] = bits;
+	}
+}
+
+void InstanceCuller::CompactChunks(UINT numChunks)
+{
+	// An exclusive prefix sum of the counts gives each chunk its place in the
+	// compacted list.
+	mChunkOffsets.resize(numChunks);
+
+	UINT total = 0;
+	for(UINT c = 0; c < numChunks; ++c)
+	{
+		mChunkOffsets[c] = total;
+		total += mChunkCounts[c];
+	}
+
+	mVisible.resize(total);
+
+	concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+	{
+		const UINT* src = mChunkVisible.data() + chunk*ChunkSize;
+		std::copy(src, src + mChunkCounts[chunk], mVisible.begin() + mChunkOffsets[chunk]);
+	});
+}
+
+void InstanceCuller::SortVisible()
+{
+	// The tree returns instances in tree order.  Setting their mask bits and
+	// reading the mask back sorts them in time linear in the instance count.
+	mVisibleMask.assign((mWorldBounds.Count + 31) / 32, 0);
+	for(UINT i : mVisible)
+		mVisibleMask[i / 32] |= 1u << (i % 32);
+
+	UINT count = 0;
+	for(UINT w = 0; w < (UINT)mVisibleMask.size(); ++w)
+	{
+		UINT bits = mVisibleMask[w];
+		for(UINT b = 0; bits != 0; ++b, bits >>= 1)
+		{
+			if(bits & 1)
+				mVisible[count++] = 32*w + b;
+		}
+	}
+}
+
+void InstanceCuller::TrackCamera(const BoundingFrustum& worldFrustum)
+{
+	const BoundingFrustum& last = mLastFrustum;
+
+	bool sameLens = mHasLastFrustum &&
+		last.RightSlope == worldFrustum.RightSlope &&
+		last.LeftSlope == worldFrustum.LeftSlope &&
+		last.TopSlope == worldFrustum.TopSlope &&
+		last.BottomSlope == worldFrustum.BottomSlope &&
+		last.Near == worldFrustum.Near &&
+		last.Far == worldFrustum.Far;
+
+	if(!sameLens || mCameraTravel > MaxCameraMotion || mCameraTurn > MaxCameraMotion)
+	{
+		for(auto& state : mCoherence)
+			state.Slack = -1.0f;
+
+		mCameraTravel = 0.0f;
+		mCameraTurn = 0.0f;
+	}
+	else
+	{
+		XMVECTOR origin = XMLoadFloat3(&worldFrustum.Origin);
+		XMVECTOR lastOrigin = XMLoadFloat3(&last.Origin);
+		mCameraTravel += XMVectorGetX(XMVector3Length(origin - lastOrigin));
+
+		// A rotation by angle a moves a unit normal by at most 2*sin(a/2), and
+		// the quaternions of two orientations a apart have |dot| = cos(a/2).
+		XMVECTOR q = XMLoadFloat4(&worldFrustum.Orientation);
+		XMVECTOR lastQ = XMLoadFloat4(&last.Orientation);
+		float cosHalfAngle = fabsf(XMVectorGetX(XMQuaternionDot(q, lastQ)));
+		mCameraTurn += 2.0f*sqrtf(MathHelper::Max(1.0f - cosHalfAngle*cosHalfAngle, 0.0f));
+	}
+
+	mLastFrustum = worldFrustum;
+	mHasLastFrustum = true;
+}
+
+void InstanceCuller::Classify(const XMVECTOR planes[6], FXMVECTOR eye, UINT i)
+{
+	const InstanceBounds& b = mWorldBounds;
+	CoherenceState& state = mCoherence[i];
+
+	XMVECTOR center = XMVectorSet(b.CenterX[i], b.CenterY[i], b.CenterZ[i], 1.0f);
+	XMVECTOR extents = XMVectorSet(b.ExtentX[i], b.ExtentY[i], b.ExtentZ[i], 0.0f);
+
+	state.Reach = XMVectorGetX(XMVector3Length(center - eye)) + XMVectorGetX(XMVector3Length(extents));
+	state.Travel = mCameraTravel;
+	state.Turn = mCameraTurn;
+
+	// An instance usually leaves the frustum through the same side it was
+	// outside of before, so try that plane first.
+	float insideSlack = MathHelper::Infinity;
+	for(int k = 0; k < 6; ++k)
+	{
+		int p = (state.SeparatingPlane + k) % 6;
+
+		float dist = XMVectorGetX(XMVector4Dot(center, planes[p]));
+		float radius = XMVectorGetX(XMVector3Dot(extents, XMVectorAbs(planes[p])));
+
+		if(dist > radius)
+		{
+			state.SeparatingPlane = (BYTE)p;
+			state.Visible = false;
+			state.Slack = dist - radius;
+			return;
+		}
+
+		insideSlack = MathHelper::Min(insideSlack, -dist - radius);
+	}
+
+	// Negative if the box straddles a plane; it is then tested every call.
+	state.Visible = true;
+	state.Slack = insideSlack;
+}
@@ -0,0 +1,185 @@
+//***************************************************************************************
+// InstanceCulling.h
+//
+// Frustum culls the instances of one render item on the worker threads.  The
+// bounds of each instance are transformed to world space once, when the instance
+// is placed, so a frame only tests boxes against the planes of the world space
+// camera frustum.  The instances that pass are gathered into a compacted list.
+//
+// The boxes are stored as separate arrays of center and extent components, so
+// the frustum test runs on four boxes at a time.  Alternatively the instances can
+// be culled through a bounding volume hierarchy, which accepts or rejects whole
+// groups of nearby instances with one test, or through a spatial grid, which
+// stays exact however far the instances move.
+//***************************************************************************************
+
+#pragma once
+
+#include "FrameResource.h"
+#include "SpatialGrid.h"
+#include "../../Common/BoundingVolumeHierarchy.h"
+#include <ppl.h>
+
+class OcclusionCuller;
+
+// World space boxes with each component in its own array.  The arrays are
+// padded with zeros to a multiple of four; the padding is never reported visible.
+struct InstanceBounds
+{
+	void Resize(UINT count);
+
+	void Set(UINT i, const DirectX::BoundingBox& box);
+	DirectX::BoundingBox Get(UINT i)const;
+
+	UINT Count = 0;
+
+	std::vector<float> CenterX;
+	std::vector<float> CenterY;
+	std::vector<float> CenterZ;
+
+	std::vector<float> ExtentX;
+	std::vector<float> ExtentY;
+	std::vector<float> ExtentZ;
+};
+
+class InstanceCuller
+{
+public:
+	InstanceCuller() = default;
+	InstanceCuller(const InstanceCuller& rhs) = delete;
+	InstanceCuller& operator=(const InstanceCuller& rhs) = delete;
+	~InstanceCuller() = default;
+
+	// Instances per parallel task.  A multiple of 32, so that every task writes
+	// whole words of the visibility mask.
+	static const UINT ChunkSize = 4096;
+
+	// Computes the world space bounds of every instance from localBounds, the
+	// local space box of the mesh they share.
+	void Build(const DirectX::BoundingBox& localBounds, const std::vector<InstanceData>& instances);
+
+	// Recomputes the world space bounds of instance i after it has moved.  The
+	// hierarchy is refit before the next CullHierarchical; the grid is updated
+	// at once.
+	void UpdateInstance(UINT i, const DirectX::XMFLOAT4X4& world);
+
+	UINT InstanceCount()const;
+	DirectX::BoundingBox WorldBounds(UINT i)const;
+
+	// Makes the visible list the instances whose bounds are not entirely
+	// outside worldFrustum.
+	void Cull(const DirectX::BoundingFrustum& worldFrustum);
+
+	// Same result as Cull, found by walking the bounding volume hierarchy.
+	// Cheaper when most instances are far outside or deep inside the frustum.
+	void CullHierarchical(const DirectX::BoundingFrustum& worldFrustum);
+
+	const BoundingVolumeHierarchy& Hierarchy()const;
+
+	// Same result as Cull, found by testing only the grid cells that overlap
+	// worldFrustum.
+	void CullGrid(const DirectX::BoundingFrustum& worldFrustum);
+
+	// The grid of the instance bounds, for proximity queries.
+	const SpatialGrid& Grid()const;
+
+	// Same result as Cull, reusing the previous call's answer for instances
+	// that were outside a plane, or inside all of them, by more than the camera
+	// can have moved the planes since.  Instances that must be tested again try
+	// the plane that rejected them last time first.
+	void CullCoherent(const DirectX::BoundingFrustum& worldFrustum);
+
+	// The number of instances whose test the last CullCoherent skipped.
+	UINT SkippedTests()const;
+
+	// Removes the instances hidden behind the occluders of occlusion's last
+	// Render from the visible list.
+	void RemoveOccluded(OcclusionCuller& occlusion);
+
+	// Makes every instance visible, for when culling is disabled.
+	void SelectAll();
+
+	// Indices of the instances that passed the last Cull, in increasing order.
+	const std::vector<UINT>& VisibleInstances()const;
+
+	// The result of the last Cull as one bit per instance: bit i%32 of word
+	// i/32 is set if instance i is visible.
+	const std::vector<UINT>& VisibleMask()const;
+
+	// Checks the last Cull, CullHierarchical, CullGrid or CullCoherent against
+	// BoundingFrustum::Contains, one instance at a time.  Returns the number of
+	// instances whose visibility differs.
+	UINT CountCullErrors(const DirectX::BoundingFrustum& worldFrustum)const;
+
+private:
+	// Tests the boxes in [first, last), with first a multiple of 32, against
+	// the frustum planes and writes the mask words that cover them.
+	void TestBoxes(const DirectX::XMVECTOR planes[6], UINT first, UINT last);
+
+	void CompactChunks(UINT numChunks);
+
+	// Rebuilds the visibility mask from mVisible, and mVisible in increasing
+	// order from the mask.
+	void SortVisible();
+
+	// Accumulates how far the camera has moved and turned since the previous
+	// CullCoherent, and forgets every saved answer if the lens has changed.
+	void TrackCamera(const DirectX::BoundingFrustum& worldFrustum);
+
+	// Tests instance i against the normalized frustum planes and saves the
+	// answer with its slack.
+	void Classify(const DirectX::XMVECTOR planes[6], DirectX::FXMVECTOR eye, UINT i);
+
+	// What CullCoherent last decided about an instance, and how far that
+	// decision was from changing.
+	struct CoherenceState
+	{
+		// How far the box was outside its separating plane, or inside the
+		// nearest plane.  Not positive if the instance must be tested again.
+		float Slack = -1.0f;
+
+		// Distance from the eye to the box center plus the length of its
+		// extents.  Turning the camera moves a plane across the box by at most
+		// this times the change in the plane normal.
+		float Reach = 0.0f;
+
+		// mCameraTravel and mCameraTurn when the instance was tested.
+		float Travel = 0.0f;
+		float Turn = 0.0f;
+
+		BYTE SeparatingPlane = 0;
+		bool Visible = false;
+	};
+
+private:
+	DirectX::BoundingBox mLocalBounds;
+	InstanceBounds mWorldBounds;
+
+	BoundingVolumeHierarchy mHierarchy;
+	bool mHierarchyDirty = false;
+
+	SpatialGrid mGrid;
+
+	// Chunk c writes the instances it keeps to the front of its own range of
+	// mChunkVisible, and their number to mChunkCounts[c], so tasks never share
+	// an output.  The ranges are then packed together into mVisible.
+	std::vector<UINT> mChunkVisible;
+	std::vector<UINT> mChunkCounts;
+	std::vector<UINT> mChunkOffsets;
+
+	std::vector<UINT> mVisibleMask;
+	std::vector<UINT> mVisible;
+
+	std::vector<CoherenceState> mCoherence;
+	DirectX::BoundingFrustum mLastFrustum;
+	bool mHasLastFrustum = false;
+
+	// Total distance the camera has moved, and total length its plane normals
+	// have swept, over the CullCoherent calls since the saved answers were
+	// last reset.
+	float mCameraTravel = 0.0f;
+	float mCameraTurn = 0.0f;
+
+	std::vector<UINT> mChunkSkipped;
+	UINT mSkippedTests = 0;
+};
@@ -1,5 +1,14 @@
 //***************************************************************************************
 // InstancingAndCullingApp.cpp by Frank Luna (C) 2015 All Rights Reserved.
+//
+// Press 'B' to measure frustum testing one million boxes.
+// Press 'H' to measure the bounding volume hierarchy at 10k, 100k and 1M instances.
+// Press 'M' to start or stop the skulls circling around their grid positions.
+// Press 'G' to compare culling 100k moving instances with the grid, the hierarchy
+// and a linear loop.
+//
+// Measurements are written to the debugger output, with a summary in the window
+// caption.
 //***************************************************************************************
 
 #include "../../Common/d3dApp.h"
@@ -8,6 +17,10 @@
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
 #include "FrameResource.h"
+#include "InstanceCulling.h"
+#include "OcclusionCulling.h"
+#include "IdBuffer.h"
+#include "../../Common/ScenePicker.h"
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -18,6 +31,29 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
+namespace
+{
+	// Instances with random positions and orientations in a cube of the given
+	// size around the origin, for the measurements.
+	std::vector<InstanceData> RandomInstances(UINT count, float size)
+	{
+		std::vector<InstanceData> instances(count);
+		for(InstanceData& instance : instances)
+		{
+			XMMATRIX world = XMMatrixRotationRollPitchYaw(
+				MathHelper::RandF(0.0f, XM_2PI), MathHelper::RandF(0.0f, XM_2PI), MathHelper::RandF(0.0f, XM_2PI))*
+				XMMatrixTranslation(
+					MathHelper::RandF(-0.5f, 0.5f)*size,
+					MathHelper::RandF(-0.5f, 0.5f)*size,
+					MathHelper::RandF(-0.5f, 0.5f)*size);
+
+			XMStoreFloat4x4(&instance.World, world);
+		}
+
+		return instances;
+	}
+}
+
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
 struct RenderItem
@@ -50,6 +86,17 @@ struct RenderItem
 	BoundingBox Bounds;
 	std::vector<InstanceData> Instances;
 
+	// World space bounds of the instances, and which of them survived culling.
+	InstanceCuller Culler;
+
+	// Index of the first instance in the frame's instance buffer.  The render
+	// items share the buffer, each using its own range.
+	UINT FirstInstance = 0;
+
+	// Occluders are drawn into the occlusion depth buffer, and are not tested
+	// against it themselves.
+	bool Occluder = false;
+
     // DrawIndexedInstanced parameters.
     UINT IndexCount = 0;
 	UINT InstanceCount = 0;
@@ -78,6 +125,7 @@ private:
 
     void OnKeyboardInput(const GameTimer& gt);
 	void AnimateMaterials(const GameTimer& gt);
+	void MoveInstances(const GameTimer& gt);
 	void UpdateInstanceData(const GameTimer& gt);
 	void UpdateMaterialBuffer(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
@@ -86,6 +134,7 @@ private:
     void BuildRootSignature();
 	void BuildDescriptorHeaps();
     void BuildShadersAndInputLayout();
+    void BuildShapeGeometry();
     void BuildSkullGeometry();
     void BuildPSOs();
     void BuildFrameResources();
@@ -93,6 +142,16 @@ private:
     void BuildRenderItems();
     void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
 
+	void Pick(int sx, int sy);
+	void SelectRect(int x0, int y0, int x1, int y1);
+
+	// Returns true on the frame key goes down.
+	bool KeyPressed(int key);
+
+	void MeasureBoxTests();
+	void MeasureHierarchyScaling();
+	void MeasureMovingInstances();
+
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
 private:
@@ -124,14 +183,42 @@ private:
 	UINT mInstanceCount = 0;
 
 	bool mFrustumCullingEnabled = true;
+	bool mHierarchicalCullingEnabled = true;
+	bool mOcclusionCullingEnabled = true;
+	bool mCoherentCullingEnabled = false;
+	bool mGridCullingEnabled = false;
 
-	BoundingFrustum mCamFrustum;
+	// The skulls circle around their places in the grid while this is set.
+	bool mMovingInstances = false;
+	std::vector<XMFLOAT4X4> mRestWorlds;
+
+	OcclusionCuller mOcclusionCuller;
+
+	// Object i of the ID buffer and item i of the picker are instance i of the
+	// instance buffer.
+	IdBuffer mIdBuffer;
+	ScenePicker mPicker;
+
+	// The ID buffer is drawn again once the camera stops moving.
+	XMFLOAT4X4 mLastView = MathHelper::Identity4x4();
+
+	// The result of the last pick or selection, shown in the caption.
+	std::wstring mPickReport;
+
+	// The summary of the last measurement, shown in the caption.
+	std::wstring mMeasureReport;
 
     PassConstants mMainPassCB;
 
 	Camera mCamera;
 
     POINT mLastMousePos;
+
+	POINT mSelectStart;
+	bool mSelecting = false;
+
+	// Whether each virtual key was down last frame, for KeyPressed.
+	bool mKeyDown[256] = {};
 };
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
@@ -186,6 +273,7 @@ bool InstancingAndCullingApp::Initialize()
     BuildRootSignature();
 	BuildDescriptorHeaps();
     BuildShadersAndInputLayout();
+	BuildShapeGeometry();
 	BuildSkullGeometry();
 	BuildMaterials();
     BuildRenderItems();
@@ -208,8 +296,6 @@ void InstancingAndCullingApp::OnResize()
     D3DApp::OnResize();
 
 	mCamera.SetLens(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
-
-	BoundingFrustum::CreateFromMatrix(mCamFrustum, mCamera.GetProj());
 }
 
 void InstancingAndCullingApp::Update(const GameTimer& gt)
@@ -231,6 +317,7 @@ void InstancingAndCullingApp::Update(const GameTimer& gt)
     }
 
 	AnimateMaterials(gt);
+	MoveInstances(gt);
 	UpdateInstanceData(gt);
 	UpdateMaterialBuffer(gt);
 	UpdateMainPassCB(gt);
@@ -306,6 +393,13 @@ void InstancingAndCullingApp::Draw(const GameTimer& gt)
 
 void InstancingAndCullingApp::OnMouseDown(WPARAM btnState, int x, int y)
 {
+	if((btnState & MK_RBUTTON) != 0 && (btnState & MK_LBUTTON) == 0)
+	{
+		mSelectStart.x = x;
+		mSelectStart.y = y;
+		mSelecting = true;
+	}
+
     mLastMousePos.x = x;
     mLastMousePos.y = y;
 
@@ -314,6 +408,17 @@ void InstancingAndCullingApp::OnMouseDown(WPARAM btnState, int x, int y)
 
 void InstancingAndCullingApp::OnMouseUp(WPARAM btnState, int x, int y)
 {
+	if(mSelecting && (btnState & MK_RBUTTON) == 0)
+	{
+		mSelecting = false;
+
+		// Small slips of the mouse still count as a click.
+		if(std::abs(x - mSelectStart.x) <= 2 && std::abs(y - mSelectStart.y) <= 2)
+			Pick(mSelectStart.x, mSelectStart.y);
+		else
+			SelectRect(mSelectStart.x, mSelectStart.y, x, y);
+	}
+
     ReleaseCapture();
 }
 
@@ -355,7 +460,319 @@ void InstancingAndCullingApp::OnKeyboardInput(const GameTimer& gt)
 	if(GetAsyncKeyState('2') & 0x8000)
 		mFrustumCullingEnabled = false;
 
+	if(GetAsyncKeyState('3') & 0x8000)
+		mHierarchicalCullingEnabled = true;
+
+	if(GetAsyncKeyState('4') & 0x8000)
+		mHierarchicalCullingEnabled = false;
+
+	if(GetAsyncKeyState('5') & 0x8000)
+		mOcclusionCullingEnabled = true;
+
+	if(GetAsyncKeyState('6') & 0x8000)
+		mOcclusionCullingEnabled = false;
+
+	if(GetAsyncKeyState('7') & 0x8000)
+		mCoherentCullingEnabled = true;
+
+	if(GetAsyncKeyState('8') & 0x8000)
+		mCoherentCullingEnabled = false;
+
+	if(GetAsyncKeyState('9') & 0x8000)
+		mGridCullingEnabled = true;
+
+	if(GetAsyncKeyState('0') & 0x8000)
+		mGridCullingEnabled = false;
+
+	if(KeyPressed('B'))
+		MeasureBoxTests();
+
+	if(KeyPressed('H'))
+		MeasureHierarchyScaling();
+
+	if(KeyPressed('M'))
+		mMovingInstances = !mMovingInstances;
+
+	if(KeyPressed('G'))
+		MeasureMovingInstances();
+
+	mCamera.UpdateViewMatrix();
+}
+
+bool InstancingAndCullingApp::KeyPressed(int key)
+{
+	bool down = (GetAsyncKeyState(key) & 0x8000) != 0;
+	bool pressed = down && !mKeyDown[key];
+	mKeyDown[key] = down;
+
+	return pressed;
+}
+
+void InstancingAndCullingApp::MeasureBoxTests()
+{
+	// One million skull boxes around the scene, tested against the camera
+	// frustum by Cull on every thread and on one, and by BoundingFrustum::Contains
+	// one box at a time.
+	const UINT numInstances = 1000000;
+	const UINT numRuns = 10;
+
 	mCamera.UpdateViewMatrix();
+	const BoundingFrustum& worldFrustum = mCamera.GetWorldFrustum();
+
+	InstanceCuller culler;
+	culler.Build(mAllRitems[0]->Bounds, RandomInstances(numInstances, 2000.0f));
+
+	auto measureCull = [&]()
+	{
+		culler.Cull(worldFrustum);
+
+		__int64 startCount = GameTimer::ReadCounter();
+		for(UINT run = 0; run < numRuns; ++run)
+			culler.Cull(worldFrustum);
+
+		return GameTimer::MillisecondsSince(startCount) / numRuns;
+	};
+
+	double parallelMs = measureCull();
+
+	concurrency::CurrentScheduler::Create(concurrency::SchedulerPolicy(2,
+		concurrency::MinConcurrency, 1, concurrency::MaxConcurrency, 1));
+	double singleMs = measureCull();
+	concurrency::CurrentScheduler::Detach();
+
+	UINT errors = culler.CountCullErrors(worldFrustum);
+
+	std::vector<BoundingBox> boxes(numInstances);
+	for(UINT i = 0; i < numInstances; ++i)
+		boxes[i] = culler.WorldBounds(i);
+
+	UINT containsVisible = 0;
+	__int64 startCount = GameTimer::ReadCounter();
+	for(UINT run = 0; run < numRuns; ++run)
+	{
+		for(const BoundingBox& box : boxes)
+		{
+			if(worldFrustum.Contains(box) != DISJOINT)
+				++containsVisible;
+		}
+	}
+	double containsMs = GameTimer::MillisecondsSince(startCount) / numRuns;
+
+	auto boxesPerNs = [&](double ms) { return numInstances / (ms*1.0e6); };
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"    " << numInstances << L" box tests: Cull " <<
+		boxesPerNs(parallelMs) << L" boxes/ns on " << concurrency::GetProcessorCount() << L" threads, " <<
+		boxesPerNs(singleMs) << L" boxes/ns on one, Contains " << boxesPerNs(containsMs) << L" boxes/ns, " <<
+		containsVisible / numRuns << L" visible, " << errors << L" differ";
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMeasureReport = outs.str();
+}
+
+void InstancingAndCullingApp::MeasureHierarchyScaling()
+{
+	// Skulls spread through a volume that grows with their number, so the
+	// density stays that of the demo grid.  For each count, time building and
+	// refitting the hierarchy, culling the camera frustum with and without it,
+	// and finding the nearest box along rays from the camera with and without it.
+	const UINT counts[] = { 10000, 100000, 1000000 };
+	const UINT numRays = 100;
+
+	mCamera.UpdateViewMatrix();
+	const BoundingFrustum& worldFrustum = mCamera.GetWorldFrustum();
+	const XMVECTOR origin = mCamera.GetPosition();
+
+	std::vector<XMFLOAT3> rayDirs(numRays);
+	for(XMFLOAT3& dir : rayDirs)
+		XMStoreFloat3(&dir, MathHelper::RandUnitVec3());
+
+	std::wostringstream outs;
+	outs.precision(3);
+
+	for(UINT numInstances : counts)
+	{
+		const float size = 200.0f*powf(numInstances / 125.0f, 1.0f / 3.0f);
+
+		InstanceCuller culler;
+		culler.Build(mAllRitems[0]->Bounds, RandomInstances(numInstances, size));
+
+		std::vector<BoundingBox> boxes(numInstances);
+		for(UINT i = 0; i < numInstances; ++i)
+			boxes[i] = culler.WorldBounds(i);
+
+		BoundingVolumeHierarchy bvh;
+
+		__int64 startCount = GameTimer::ReadCounter();
+		bvh.Build(boxes);
+		double buildMs = GameTimer::MillisecondsSince(startCount);
+
+		for(UINT i = 0; i < numInstances; ++i)
+			bvh.SetItemBounds(i, boxes[i]);
+
+		startCount = GameTimer::ReadCounter();
+		bvh.Refit();
+		double refitMs = GameTimer::MillisecondsSince(startCount);
+
+		culler.Cull(worldFrustum);
+		startCount = GameTimer::ReadCounter();
+		culler.Cull(worldFrustum);
+		double linearCullMs = GameTimer::MillisecondsSince(startCount);
+
+		culler.CullHierarchical(worldFrustum);
+		startCount = GameTimer::ReadCounter();
+		culler.CullHierarchical(worldFrustum);
+		double bvhCullMs = GameTimer::MillisecondsSince(startCount);
+
+		UINT linearHits = 0;
+		startCount = GameTimer::ReadCounter();
+		for(const XMFLOAT3& d : rayDirs)
+		{
+			XMVECTOR dir = XMLoadFloat3(&d);
+
+			float nearest = MathHelper::Infinity;
+			for(const BoundingBox& box : boxes)
+			{
+				float dist = 0.0f;
+				if(box.Intersects(origin, dir, dist) && dist < nearest)
+					nearest = dist;
+			}
+
+			if(nearest < MathHelper::Infinity)
+				++linearHits;
+		}
+		double linearRayUs = 1000.0*GameTimer::MillisecondsSince(startCount) / numRays;
+
+		UINT bvhHits = 0;
+		startCount = GameTimer::ReadCounter();
+		for(const XMFLOAT3& d : rayDirs)
+		{
+			float nearest = MathHelper::Infinity;
+			bvh.RayQuery(origin, XMLoadFloat3(&d), nearest, [&](UINT item, float dist)
+			{
+				nearest = MathHelper::Min(nearest, dist);
+				return nearest;
+			});
+
+			if(nearest < MathHelper::Infinity)
+				++bvhHits;
+		}
+		double bvhRayUs = 1000.0*GameTimer::MillisecondsSince(startCount) / numRays;
+
+		outs.str(L"");
+		outs << L"    " << numInstances << L" instances: build " << buildMs << L" ms, refit " << refitMs <<
+			L" ms, cull " << linearCullMs << L" ms linear / " << bvhCullMs << L" ms hierarchy, ray " <<
+			linearRayUs << L" us linear / " << bvhRayUs << L" us hierarchy (" << linearHits << L"/" <<
+			bvhHits << L" hits)";
+
+		OutputDebugString((outs.str() + L"\n").c_str());
+	}
+
+	mMeasureReport = outs.str();
+}
+
+void InstancingAndCullingApp::MeasureMovingInstances()
+{
+	// 100k skulls at the demo density, each moving at its own velocity, for
+	// ten 60 Hz frames.  Every frame moves each instance and recomputes its
+	// world bounds, then finds the ones in the camera frustum three ways:
+	// testing every box, as UpdateInstanceData originally did; moving the
+	// box in the spatial grid and querying the grid; and refitting the
+	// hierarchy and querying that.
+	const UINT numInstances = 100000;
+	const UINT numFrames = 10;
+	const float dt = 1.0f / 60.0f;
+	const float size = 200.0f*powf(numInstances / 125.0f, 1.0f / 3.0f);
+
+	mCamera.UpdateViewMatrix();
+	const BoundingFrustum& worldFrustum = mCamera.GetWorldFrustum();
+	const BoundingBox& localBounds = mAllRitems[0]->Bounds;
+
+	const std::vector<InstanceData> start = RandomInstances(numInstances, size);
+
+	std::vector<XMFLOAT3> velocities(numInstances);
+	for(XMFLOAT3& v : velocities)
+		XMStoreFloat3(&v, 20.0f*MathHelper::RandUnitVec3());
+
+	std::vector<BoundingBox> boxes(numInstances);
+	auto placeInstances = [&](UINT frame)
+	{
+		for(UINT i = 0; i < numInstances; ++i)
+		{
+			XMFLOAT4X4 world = start[i].World;
+			world._41 += velocities[i].x*frame*dt;
+			world._42 += velocities[i].y*frame*dt;
+			world._43 += velocities[i].z*frame*dt;
+
+			localBounds.Transform(boxes[i], XMLoadFloat4x4(&world));
+		}
+	};
+
+	placeInstances(0);
+
+	const XMFLOAT3& e = localBounds.Extents;
+	SpatialGrid grid(4.0f*MathHelper::Max(e.x, MathHelper::Max(e.y, e.z)));
+	for(UINT i = 0; i < numInstances; ++i)
+		grid.Insert(i, boxes[i]);
+
+	BoundingVolumeHierarchy bvh;
+	bvh.Build(boxes);
+
+	std::vector<UINT> visible;
+	visible.reserve(numInstances);
+
+	double moveMs = 0.0;
+	double linearMs = 0.0;
+	double gridMs = 0.0;
+	double bvhMs = 0.0;
+	UINT linearVisible = 0;
+	UINT gridVisible = 0;
+	UINT bvhVisible = 0;
+
+	for(UINT frame = 1; frame <= numFrames; ++frame)
+	{
+		__int64 startCount = GameTimer::ReadCounter();
+		placeInstances(frame);
+		moveMs += GameTimer::MillisecondsSince(startCount);
+
+		startCount = GameTimer::ReadCounter();
+		visible.clear();
+		for(UINT i = 0; i < numInstances; ++i)
+		{
+			if(worldFrustum.Contains(boxes[i]) != DISJOINT)
+				visible.push_back(i);
+		}
+		linearMs += GameTimer::MillisecondsSince(startCount);
+		linearVisible = (UINT)visible.size();
+
+		startCount = GameTimer::ReadCounter();
+		for(UINT i = 0; i < numInstances; ++i)
+			grid.Move(i, boxes[i]);
+		visible.clear();
+		grid.FrustumQuery(worldFrustum, visible);
+		gridMs += GameTimer::MillisecondsSince(startCount);
+		gridVisible = (UINT)visible.size();
+
+		startCount = GameTimer::ReadCounter();
+		for(UINT i = 0; i < numInstances; ++i)
+			bvh.SetItemBounds(i, boxes[i]);
+		bvh.Refit();
+		visible.clear();
+		bvh.FrustumQuery(worldFrustum, visible);
+		bvhMs += GameTimer::MillisecondsSince(startCount);
+		bvhVisible = (UINT)visible.size();
+	}
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"    " << numInstances << L" moving instances, per frame: move " << moveMs / numFrames <<
+		L" ms, then linear " << linearMs / numFrames << L" ms, grid " << gridMs / numFrames <<
+		L" ms, hierarchy refit " << bvhMs / numFrames << L" ms (" << linearVisible << L"/" <<
+		gridVisible << L"/" << bvhVisible << L" visible)";
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMeasureReport = outs.str();
 }
  
 void InstancingAndCullingApp::AnimateMaterials(const GameTimer& gt)
@@ -363,54 +780,134 @@ void InstancingAndCullingApp::AnimateMaterials(const GameTimer& gt)
 	
 }
 
+void InstancingAndCullingApp::MoveInstances(const GameTimer& gt)
+{
+	if(!mMovingInstances)
+		return;
+
+	// Each skull circles its grid position in the xz-plane, far enough to
+	// cross grid cells, but not into the walls between the layers.
+	const float radius = 15.0f;
+	const float t = gt.TotalTime();
+
+	RenderItem* skulls = mAllRitems[0].get();
+	for(UINT i = 0; i < (UINT)skulls->Instances.size(); ++i)
+	{
+		float angle = 0.5f*t + 0.7f*i;
+
+		XMFLOAT4X4& world = skulls->Instances[i].World;
+		world = mRestWorlds[i];
+		world._41 += radius*cosf(angle);
+		world._43 += radius*sinf(angle);
+
+		skulls->Culler.UpdateInstance(i, world);
+		mIdBuffer.SetObjectWorld(skulls->FirstInstance + i, world);
+		mPicker.SetItemWorld(skulls->FirstInstance + i, world);
+	}
+}
+
 void InstancingAndCullingApp::UpdateInstanceData(const GameTimer& gt)
 {
 	XMMATRIX view = mCamera.GetView();
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+
+	// The camera keeps its frustum in world space.  The instance bounds are
+	// already in world space, so no per-instance inverse or frustum transform
+	// is needed.
+	const BoundingFrustum& worldFrustum = mCamera.GetWorldFrustum();
+
+	const bool occlusionCulling = mFrustumCullingEnabled && mOcclusionCullingEnabled;
+	if(occlusionCulling)
+		mOcclusionCuller.Render(mCamera.GetViewProj());
+
+	// Draw the ID buffer again once the camera has come to rest, so that a pick
+	// usually finds it current.  While the camera moves a pick draws it first.
+	XMFLOAT4X4 currView;
+	XMStoreFloat4x4(&currView, view);
+	if(memcmp(&currView, &mLastView, sizeof(currView)) == 0)
+		mIdBuffer.Update(view, mCamera.GetProj());
+	mLastView = currView;
+
+	UINT visibleObjectCount = 0;
+	UINT objectCount = 0;
+	UINT skippedTests = 0;
 
 	auto currInstanceBuffer = mCurrFrameResource->InstanceBuffer.get();
 	for(auto& e : mAllRitems)
 	{
 		const auto& instanceData = e->Instances;
 
-		int visibleInstanceCount = 0;
-
-		for(UINT i = 0; i < (UINT)instanceData.size(); ++i)
+		if(mFrustumCullingEnabled && mCoherentCullingEnabled)
 		{
-			XMMATRIX world = XMLoadFloat4x4(&instanceData[i].World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&instanceData[i].TexTransform);
+			e->Culler.CullCoherent(worldFrustum);
+			skippedTests += e->Culler.SkippedTests();
+		}
+		else if(mFrustumCullingEnabled && mGridCullingEnabled)
+			e->Culler.CullGrid(worldFrustum);
+		else if(mFrustumCullingEnabled && mHierarchicalCullingEnabled)
+			e->Culler.CullHierarchical(worldFrustum);
+		else if(mFrustumCullingEnabled)
+			e->Culler.Cull(worldFrustum);
+		else
+			e->Culler.SelectAll();
+
+		// Every culling path must agree with DirectXMath's own frustum test.
+		assert(!mFrustumCullingEnabled || e->Culler.CountCullErrors(worldFrustum) == 0);
+
+		if(occlusionCulling && !e->Occluder)
+			e->Culler.RemoveOccluded(mOcclusionCuller);
+
+		const auto& visible = e->Culler.VisibleInstances();
+		const UINT visibleInstanceCount = (UINT)visible.size();
+
+		// Write the instance data to structured buffer for the visible objects.
+		// Each task writes its own range of elements.
+		concurrency::parallel_for(0u, visibleInstanceCount, InstanceCuller::ChunkSize, [&](UINT first)
+		{
+			UINT last = MathHelper::Min(first + InstanceCuller::ChunkSize, visibleInstanceCount);
 
-			XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(world), world);
+			for(UINT k = first; k < last; ++k)
+			{
+				const InstanceData& instance = instanceData[visible[k]];
 
-			// View space to the object's local space.
-			XMMATRIX viewToLocal = XMMatrixMultiply(invView, invWorld);
- 
-			// Transform the camera frustum from view space to the object's local space.
-			BoundingFrustum localSpaceFrustum;
-			mCamFrustum.Transform(localSpaceFrustum, viewToLocal);
+				XMMATRIX world = XMLoadFloat4x4(&instance.World);
+				XMMATRIX texTransform = XMLoadFloat4x4(&instance.TexTransform);
 
-			// Perform the box/frustum intersection test in local space.
-			if((localSpaceFrustum.Contains(e->Bounds) != DirectX::DISJOINT) || (mFrustumCullingEnabled==false))
-			{
 				InstanceData data;
 				XMStoreFloat4x4(&data.World, XMMatrixTranspose(world));
 				XMStoreFloat4x4(&data.TexTransform, XMMatrixTranspose(texTransform));
-				data.MaterialIndex = instanceData[i].MaterialIndex;
+				data.MaterialIndex = instance.MaterialIndex;
 
-				// Write the instance data to structured buffer for the visible objects.
-				currInstanceBuffer->CopyData(visibleInstanceCount++, data);
+				currInstanceBuffer->CopyData(e->FirstInstance + k, data);
 			}
-		}
+		});
 
 		e->InstanceCount = visibleInstanceCount;
 
-		std::wostringstream outs;
-		outs.precision(6);
-		outs << L"Instancing and Culling Demo" <<
-			L"    " << e->InstanceCount <<
-			L" objects visible out of " << e->Instances.size();
-		mMainWndCaption = outs.str();
+		if(!e->Occluder)
+		{
+			visibleObjectCount += e->InstanceCount;
+			objectCount += (UINT)e->Instances.size();
+		}
+	}
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"Instancing and Culling Demo" <<
+		L"    " << visibleObjectCount <<
+		L" objects visible out of " << objectCount;
+
+	if(mFrustumCullingEnabled && mCoherentCullingEnabled)
+		outs << L"    " << skippedTests << L" tests skipped";
+
+	if(occlusionCulling)
+	{
+		const auto& stats = mOcclusionCuller.FrameStats();
+		outs << L"    " << 100.0f*stats.OccludedFraction() << L"% occluded" <<
+			L"    occlusion " << stats.RasterMs + stats.TestMs << L" ms";
 	}
+
+	outs << mPickReport << mMeasureReport;
+	mMainWndCaption = outs.str();
 }
 
 void InstancingAndCullingApp::UpdateMaterialBuffer(const GameTimer& gt)
@@ -445,10 +942,10 @@ void InstancingAndCullingApp::UpdateMainPassCB(const GameTimer& gt)
 	XMMATRIX view = mCamera.GetView();
 	XMMATRIX proj = mCamera.GetProj();
 
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMMATRIX viewProj = mCamera.GetViewProj();
+	XMMATRIX invView = mCamera.GetInvView();
+	XMMATRIX invProj = mCamera.GetInvProj();
+	XMMATRIX invViewProj = mCamera.GetInvViewProj();
 
 	XMStoreFloat4x4(&mMainPassCB.View, XMMatrixTranspose(view));
 	XMStoreFloat4x4(&mMainPassCB.InvView, XMMatrixTranspose(invView));
@@ -670,6 +1167,55 @@ void InstancingAndCullingApp::BuildShadersAndInputLayout()
     };
 }
 
+void InstancingAndCullingApp::BuildShapeGeometry()
+{
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 0);
+
+	SubmeshGeometry boxSubmesh;
+	boxSubmesh.IndexCount = (UINT)box.Indices32.size();
+	boxSubmesh.StartIndexLocation = 0;
+	boxSubmesh.BaseVertexLocation = 0;
+	boxSubmesh.Bounds = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.5f, 0.5f, 0.5f));
+
+	std::vector<Vertex> vertices(box.Vertices.size());
+	for(size_t i = 0; i < box.Vertices.size(); ++i)
+	{
+		vertices[i].Pos = box.Vertices[i].Position;
+		vertices[i].Normal = box.Vertices[i].Normal;
+		vertices[i].TexC = box.Vertices[i].TexC;
+	}
+
+	std::vector<std::uint16_t> indices = box.GetIndices16();
+
+	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
+	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "shapeGeo";
+
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+
+	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+
+	geo->DrawArgs["box"] = boxSubmesh;
+
+	mGeometries[geo->Name] = std::move(geo);
+}
+
 void InstancingAndCullingApp::BuildSkullGeometry()
 {
 	std::ifstream fin("Models/skull.txt");
@@ -939,11 +1485,144 @@ void InstancingAndCullingApp::BuildRenderItems()
 	}
 
 
+	skullRitem->Culler.Build(skullRitem->Bounds, skullRitem->Instances);
+
+	for(const InstanceData& instance : skullRitem->Instances)
+		mRestWorlds.push_back(instance.World);
+
+	// Walls between the layers of skulls, each over a different part of the
+	// grid.  They are drawn like the skulls and double as the occluders.
+	const XMFLOAT3 wallCenters[] =
+	{
+		XMFLOAT3(-50.0f, -50.0f, -75.0f),
+		XMFLOAT3(+50.0f, +50.0f, -25.0f),
+		XMFLOAT3(-50.0f, +50.0f, +25.0f),
+		XMFLOAT3(+50.0f, -50.0f, +75.0f)
+	};
+
+	auto wallRitem = std::make_unique<RenderItem>();
+	wallRitem->World = MathHelper::Identity4x4();
+	wallRitem->TexTransform = MathHelper::Identity4x4();
+	wallRitem->ObjCBIndex = 1;
+	wallRitem->Mat = mMaterials["bricks0"].get();
+	wallRitem->Geo = mGeometries["shapeGeo"].get();
+	wallRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallRitem->InstanceCount = 0;
+	wallRitem->IndexCount = wallRitem->Geo->DrawArgs["box"].IndexCount;
+	wallRitem->StartIndexLocation = wallRitem->Geo->DrawArgs["box"].StartIndexLocation;
+	wallRitem->BaseVertexLocation = wallRitem->Geo->DrawArgs["box"].BaseVertexLocation;
+	wallRitem->Bounds = wallRitem->Geo->DrawArgs["box"].Bounds;
+	wallRitem->FirstInstance = mInstanceCount;
+	wallRitem->Occluder = true;
+	wallRitem->Instances.resize(_countof(wallCenters));
+
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData occluderBox = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 0);
+
+	for(UINT i = 0; i < _countof(wallCenters); ++i)
+	{
+		XMMATRIX world = XMMatrixScaling(90.0f, 90.0f, 2.0f)*
+			XMMatrixTranslation(wallCenters[i].x, wallCenters[i].y, wallCenters[i].z);
+
+		XMStoreFloat4x4(&wallRitem->Instances[i].World, world);
+		XMStoreFloat4x4(&wallRitem->Instances[i].TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
+		wallRitem->Instances[i].MaterialIndex = (UINT)wallRitem->Mat->MatCBIndex;
+
+		mOcclusionCuller.AddOccluder(occluderBox, world);
+	}
+
+	wallRitem->Culler.Build(wallRitem->Bounds, wallRitem->Instances);
+	mInstanceCount += (UINT)wallRitem->Instances.size();
+
 	mAllRitems.push_back(std::move(skullRitem));
+	mAllRitems.push_back(std::move(wallRitem));
 	
 	// All the render items are opaque.
 	for(auto& e : mAllRitems)
 		mOpaqueRitems.push_back(e.get());
+
+	// Register every instance with the ID buffer and the ray picker, in
+	// instance buffer order.
+	for(auto& e : mAllRitems)
+	{
+		UINT mesh = mIdBuffer.AddMesh(*e->Geo, e->IndexCount, e->StartIndexLocation,
+			e->BaseVertexLocation, e->Bounds);
+
+		for(const InstanceData& instance : e->Instances)
+		{
+			mIdBuffer.AddObject(mesh, instance.World);
+			mPicker.AddItem(*e->Geo, e->IndexCount, e->StartIndexLocation,
+				e->BaseVertexLocation, e->Bounds, instance.World);
+		}
+	}
+}
+
+void InstancingAndCullingApp::Pick(int sx, int sy)
+{
+	XMMATRIX view = mCamera.GetView();
+	XMMATRIX proj = mCamera.GetProj();
+
+	// The ID buffer path: draw the buffer if the camera has moved since it was
+	// last drawn, then read one pixel.
+	__int64 startCount = GameTimer::ReadCounter();
+
+	bool redrawn = mIdBuffer.Update(view, proj);
+	IdBuffer::Id id = mIdBuffer.Lookup(sx, sy, mClientWidth, mClientHeight);
+
+	double idMs = GameTimer::MillisecondsSince(startCount);
+
+	// The ray path, for comparison.
+	startCount = GameTimer::ReadCounter();
+	ScenePicker::Hit hit = mPicker.PickPixel(sx, sy, mClientWidth, mClientHeight, mCamera);
+	double rayMs = GameTimer::MillisecondsSince(startCount);
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"    id buffer: ";
+	if(id.Object != IdBuffer::NoObject)
+		outs << L"instance " << id.Object << L" triangle " << id.Triangle;
+	else
+		outs << L"nothing";
+	outs << L" in " << idMs << L" ms";
+	if(redrawn)
+		outs << L" (redrawn)";
+
+	outs << L"    ray: ";
+	if(hit.Item != ScenePicker::NoItem)
+		outs << L"instance " << hit.Item << L" triangle " << hit.Triangle;
+	else
+		outs << L"nothing";
+	outs << L" in " << rayMs << L" ms";
+
+	mPickReport = outs.str();
+}
+
+void InstancingAndCullingApp::SelectRect(int x0, int y0, int x1, int y1)
+{
+	XMMATRIX view = mCamera.GetView();
+	XMMATRIX proj = mCamera.GetProj();
+
+	__int64 startCount = GameTimer::ReadCounter();
+
+	// The ID buffer only holds what is in front, so it selects the instances
+	// seen in the rectangle; the picker also selects hidden ones.
+	std::vector<UINT> seen;
+	mIdBuffer.Update(view, proj);
+	mIdBuffer.LookupRect(x0, y0, x1, y1, mClientWidth, mClientHeight, seen);
+
+	double idMs = GameTimer::MillisecondsSince(startCount);
+
+	startCount = GameTimer::ReadCounter();
+	std::vector<UINT> inside;
+	mPicker.PickRect(x0, y0, x1, y1, mClientWidth, mClientHeight, mCamera, inside);
+	double frustumMs = GameTimer::MillisecondsSince(startCount);
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"    id buffer: " << seen.size() << L" seen in " << idMs << L" ms" <<
+		L"    frustum: " << inside.size() << L" inside in " << frustumMs << L" ms";
+
+	mPickReport = outs.str();
 }
 
 void InstancingAndCullingApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
@@ -960,7 +1639,9 @@ void InstancingAndCullingApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList
 		// Set the instance buffer to use for this render-item.  For structured buffers, we can bypass 
 		// the heap and set as a root descriptor.
 		auto instanceBuffer = mCurrFrameResource->InstanceBuffer->Resource();
-		mCommandList->SetGraphicsRootShaderResourceView(0, instanceBuffer->GetGPUVirtualAddress());
+		D3D12_GPU_VIRTUAL_ADDRESS instanceAddress = instanceBuffer->GetGPUVirtualAddress() +
+			ri->FirstInstance*sizeof(InstanceData);
+		mCommandList->SetGraphicsRootShaderResourceView(0, instanceAddress);
 
         cmdList->DrawIndexedInstanced(ri->IndexCount, ri->InstanceCount, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
     }
@@ -0,0 +1,326 @@
+//***************************************************************************************
+// OcclusionCulling.cpp
+//***************************************************************************************
+
+#include "OcclusionCulling.h"
+#include "../../Common/GameTimer.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Vertices closer to the eye plane than this are not projected.
+	const float MinClipW = 1e-3f;
+}
+
+float OcclusionCuller::Stats::OccludedFraction()const
+{
+	return Tested > 0 ? (float)Occluded / (float)Tested : 0.0f;
+}
+
+OcclusionCuller::OcclusionCuller(UINT width, UINT height)
+{
+	mTilesX = (width + TileSize - 1) / TileSize;
+	mTilesY = (height + TileSize - 1) / TileSize;
+	mWidth = mTilesX*TileSize;
+	mHeight = mTilesY*TileSize;
+
+	mDepth.assign(mWidth*mHeight, 1.0f);
+	mTileMaxDepth.assign(mTilesX*mTilesY, 1.0f);
+
+	mViewProj = MathHelper::Identity4x4();
+}
+
+void OcclusionCuller::AddOccluder(const GeometryGenerator::MeshData& mesh, FXMMATRIX world)
+{
+	for(size_t i = 0; i < mesh.Indices32.size(); ++i)
+	{
+		XMVECTOR p = XMLoadFloat3(&mesh.Vertices[mesh.Indices32[i]].Position);
+
+		XMFLOAT3 worldPos;
+		XMStoreFloat3(&worldPos, XMVector3TransformCoord(p, world));
+		mOccluderVertices.push_back(worldPos);
+	}
+}
+
+void OcclusionCuller::ClearOccluders()
+{
+	mOccluderVertices.clear();
+}
+
+void OcclusionCuller::Render(FXMMATRIX viewProj)
+{
+	__int64 start = GameTimer::ReadCounter();
+
+	mStats = Stats();
+	XMStoreFloat4x4(&mViewProj, viewProj);
+
+	std::fill(mDepth.begin(), mDepth.end(), 1.0f);
+
+	for(size_t i = 0; i + 2 < mOccluderVertices.size(); i += 3)
+	{
+		XMVECTOR v0 = XMVector4Transform(XMVectorSetW(XMLoadFloat3(&mOccluderVertices[i + 0]), 1.0f), viewProj);
+		XMVECTOR v1 = XMVector4Transform(XMVectorSetW(XMLoadFloat3(&mOccluderVertices[i + 1]), 1.0f), viewProj);
+		XMVECTOR v2 = XMVector4Transform(XMVectorSetW(XMLoadFloat3(&mOccluderVertices[i + 2]), 1.0f), viewProj);
+
+		// Triangles reaching in front of the near plane (clip z < 0) would have
+		// to be clipped there, as the GPU does; rasterized as they are, they
+		// would write depths nearer than anything drawn.  Leaving them out only
+		// makes the occluders smaller, which is always safe.
+		XMVECTOR minClip = XMVectorMin(XMVectorMin(v0, v1), v2);
+		if(XMVectorGetZ(minClip) < 0.0f || XMVectorGetW(minClip) < MinClipW)
+			continue;
+
+		RasterizeTriangle(v0, v1, v2);
+		mStats.OccluderTriangles++;
+	}
+
+	BuildTileDepths();
+
+	mStats.RasterMs = GameTimer::MillisecondsSince(start);
+}
+
+bool OcclusionCuller::IsOccluded(const BoundingBox& box)const
+{
+	XMMATRIX viewProj = XMLoadFloat4x4(&mViewProj);
+
+	XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+	box.GetCorners(corners);
+
+	// Bound the projected box by the rectangle of its projected corners, at
+	// the depth of its nearest corner.
+	XMVECTOR ndcMin = g_XMInfinity;
+	XMVECTOR ndcMax = -g_XMInfinity;
+	for(UINT i = 0; i < BoundingBox::CORNER_COUNT; ++i)
+	{
+		XMVECTOR c = XMVector4Transform(XMVectorSetW(XMLoadFloat3(&corners[i]), 1.0f), viewProj);
+		if(XMVectorGetW(c) < MinClipW)
+			return false;
+
+		XMVECTOR ndc = c / XMVectorSplatW(c);
+		ndcMin = XMVectorMin(ndcMin, ndc);
+		ndcMax = XMVectorMax(ndcMax, ndc);
+	}
+
+	XMFLOAT3 lo;
+	XMFLOAT3 hi;
+	XMStoreFloat3(&lo, ndcMin);
+	XMStoreFloat3(&hi, ndcMax);
+
+	const float nearestDepth = lo.z;
+
+	// Occluders only cover the pixels whose centers they contain, so an
+	// occluder edge may cover up to half a pixel more than the occluder does.
+	// Growing the rectangle by a pixel on every side keeps a box that pokes
+	// past the edge by less than that from being culled.
+	int x0 = (int)floorf((0.5f*lo.x + 0.5f)*mWidth) - 1;
+	int x1 = (int)floorf((0.5f*hi.x + 0.5f)*mWidth) + 1;
+	int y0 = (int)floorf((0.5f - 0.5f*hi.y)*mHeight) - 1;
+	int y1 = (int)floorf((0.5f - 0.5f*lo.y)*mHeight) + 1;
+
+	x0 = MathHelper::Max(x0, 0);
+	y0 = MathHelper::Max(y0, 0);
+	x1 = MathHelper::Min(x1, (int)mWidth - 1);
+	y1 = MathHelper::Min(y1, (int)mHeight - 1);
+
+	// Off screen; frustum culling decides these.
+	if(x0 > x1 || y0 > y1)
+		return false;
+
+	for(int ty = y0 / (int)TileSize; ty <= y1 / (int)TileSize; ++ty)
+	{
+		for(int tx = x0 / (int)TileSize; tx <= x1 / (int)TileSize; ++tx)
+		{
+			// Every pixel of the tile is nearer than the box.
+			if(mTileMaxDepth[ty*mTilesX + tx] < nearestDepth)
+				continue;
+
+			int rowBegin = MathHelper::Max(y0, ty*(int)TileSize);
+			int rowEnd = MathHelper::Min(y1, ty*(int)TileSize + (int)TileSize - 1);
+			int colBegin = MathHelper::Max(x0, tx*(int)TileSize);
+			int colEnd = MathHelper::Min(x1, tx*(int)TileSize + (int)TileSize - 1);
+
+			for(int y = rowBegin; y <= rowEnd; ++y)
+			{
+				for(int x = colBegin; x <= colEnd; ++x)
+				{
+					if(mDepth[y*mWidth + x] >= nearestDepth)
+						return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+void OcclusionCuller::RemoveOccluded(const InstanceBounds& bounds, std::vector<UINT>& instances)
+{
+	__int64 start = GameTimer::ReadCounter();
+
+	const UINT numInstances = (UINT)instances.size();
+	mOccluded.resize(numInstances);
+
+	concurrency::parallel_for(0u, numInstances, InstanceCuller::ChunkSize, [&](UINT first)
+	{
+		UINT last = MathHelper::Min(first + InstanceCuller::ChunkSize, numInstances);
+
+		for(UINT k = first; k < last; ++k)
+			mOccluded[k] = IsOccluded(bounds.Get(instances[k])) ? 1 : 0;
+	});
+
+	UINT kept = 0;
+	for(UINT k = 0; k < numInstances; ++k)
+	{
+		if(mOccluded[k] == 0)
+			instances[kept++] = instances[k];
+	}
+	instances.resize(kept);
+
+	mStats.Tested += numInstances;
+	mStats.Occluded += numInstances - kept;
+	mStats.TestMs += GameTimer::MillisecondsSince(start);
+}
+
+const OcclusionCuller::Stats& OcclusionCuller::FrameStats()const
+{
+	return mStats;
+}
+
+void OcclusionCuller::RasterizeTriangle(FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2)
+{
+	XMFLOAT4 clip[3];
+	XMStoreFloat4(&clip[0], v0);
+	XMStoreFloat4(&clip[1], v1);
+	XMStoreFloat4(&clip[2], v2);
+
+	// Screen space position and depth of each vertex.
+	float sx[3], sy[3], sz[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		float invW = 1.0f / clip[i].w;
+		sx[i] = (0.5f*clip[i].x*invW + 0.5f)*mWidth;
+		sy[i] = (0.5f - 0.5f*clip[i].y*invW)*mHeight;
+		sz[i] = clip[i].z*invW;
+	}
+
+	// Edge function i is zero on the edge opposite vertex i, and equal to
+	// twice the triangle's area at vertex i: e_i(x, y) = A[i]*x + B[i]*y + C[i].
+	float A[3], B[3], C[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		int a = (i + 1) % 3;
+		int b = (i + 2) % 3;
+
+		A[i] = sy[a] - sy[b];
+		B[i] = sx[b] - sx[a];
+		C[i] = sx[a]*sy[b] - sx[b]*sy[a];
+	}
+
+	float area = A[0]*sx[0] + B[0]*sy[0] + C[0];
+	if(fabsf(area) < 1e-6f)
+		return;
+
+	// Occluders are drawn from both sides, so flip clockwise triangles.
+	if(area < 0.0f)
+	{
+		for(int i = 0; i < 3; ++i)
+		{
+			A[i] = -A[i];
+			B[i] = -B[i];
+			C[i] = -C[i];
+		}
+		area = -area;
+	}
+
+	// Depth is linear in screen space: z(x, y) = zA*x + zB*y + zC.
+	float invArea = 1.0f / area;
+	float zA = (A[0]*sz[0] + A[1]*sz[1] + A[2]*sz[2])*invArea;
+	float zB = (B[0]*sz[0] + B[1]*sz[1] + B[2]*sz[2])*invArea;
+	float zC = (C[0]*sz[0] + C[1]*sz[1] + C[2]*sz[2])*invArea;
+
+	int minX = MathHelper::Max((int)floorf(MathHelper::Min(sx[0], MathHelper::Min(sx[1], sx[2]))), 0);
+	int maxX = MathHelper::Min((int)ceilf(MathHelper::Max(sx[0], MathHelper::Max(sx[1], sx[2]))), (int)mWidth - 1);
+	int minY = MathHelper::Max((int)floorf(MathHelper::Min(sy[0], MathHelper::Min(sy[1], sy[2]))), 0);
+	int maxY = MathHelper::Min((int)ceilf(MathHelper::Max(sy[0], MathHelper::Max(sy[1], sy[2]))), (int)mHeight - 1);
+
+	if(minX > maxX || minY > maxY)
+		return;
+
+	// Pixels are shaded four at a time along a row, starting at a multiple of
+	// four so that the depth loads and stores stay inside the row.
+	minX &= ~3;
+
+	const XMVECTORF32 pixelCenters = { { { 0.5f, 1.5f, 2.5f, 3.5f } } };
+
+	XMVECTOR edgeA[3], edgeB[3], edgeC[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		edgeA[i] = XMVectorReplicate(A[i]);
+		edgeB[i] = XMVectorReplicate(B[i]);
+		edgeC[i] = XMVectorReplicate(C[i]);
+	}
+
+	XMVECTOR depthA = XMVectorReplicate(zA);
+
+	for(int y = minY; y <= maxY; ++y)
+	{
+		XMVECTOR py = XMVectorReplicate(y + 0.5f);
+
+		// The y terms are the same for the whole row.
+		XMVECTOR rowEdge[3];
+		for(int i = 0; i < 3; ++i)
+			rowEdge[i] = XMVectorMultiplyAdd(edgeB[i], py, edgeC[i]);
+
+		XMVECTOR rowDepth = XMVectorReplicate(zB*(y + 0.5f) + zC);
+
+		float* depthRow = &mDepth[y*mWidth];
+
+		for(int x = minX; x <= maxX; x += 4)
+		{
+			XMVECTOR px = XMVectorAdd(XMVectorReplicate((float)x), pixelCenters);
+
+			XMVECTOR e0 = XMVectorMultiplyAdd(edgeA[0], px, rowEdge[0]);
+			XMVECTOR e1 = XMVectorMultiplyAdd(edgeA[1], px, rowEdge[1]);
+			XMVECTOR e2 = XMVectorMultiplyAdd(edgeA[2], px, rowEdge[2]);
+
+			XMVECTOR inside = XMVectorAndInt(
+				XMVectorAndInt(XMVectorGreaterOrEqual(e0, XMVectorZero()), XMVectorGreaterOrEqual(e1, XMVectorZero())),
+				XMVectorGreaterOrEqual(e2, XMVectorZero()));
+
+			if(XMVector4EqualInt(inside, XMVectorFalseInt()))
+				continue;
+
+			XMVECTOR z = XMVectorMultiplyAdd(depthA, px, rowDepth);
+
+			XMFLOAT4* dest = reinterpret_cast<XMFLOAT4*>(depthRow + x);
+			XMVECTOR oldDepth = XMLoadFloat4(dest);
+			XMStoreFloat4(dest, XMVectorSelect(oldDepth, XMVectorMin(oldDepth, z), inside));
+		}
+	}
+}
+
+void OcclusionCuller::BuildTileDepths()
+{
+	for(UINT ty = 0; ty < mTilesY; ++ty)
+	{
+		for(UINT tx = 0; tx < mTilesX; ++tx)
+		{
+			XMVECTOR farthest = XMVectorZero();
+
+			for(UINT y = ty*TileSize; y < (ty + 1)*TileSize; ++y)
+			{
+				const XMFLOAT4* row = reinterpret_cast<const XMFLOAT4*>(&mDepth[y*mWidth + tx*TileSize]);
+
+				farthest = XMVectorMax(farthest, XMLoadFloat4(&row[0]));
+				farthest = XMVectorMax(farthest, XMLoadFloat4(&row[1]));
+			}
+
+			// Reduce the four lanes.
+			farthest = XMVectorMax(farthest, XMVectorSwizzle<2, 3, 0, 1>(farthest));
+			farthest = XMVectorMax(farthest, XMVectorSwizzle<1, 0, 3, 2>(farthest));
+
+			mTileMaxDepth[ty*mTilesX + tx] = XMVectorGetX(farthest);
+		}
+	}
+}
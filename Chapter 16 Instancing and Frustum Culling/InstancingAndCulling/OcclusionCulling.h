@@ -0,0 +1,81 @@
+//***************************************************************************************
+// OcclusionCulling.h
+//
+// Rasterizes a few large occluders into a small depth buffer on the CPU each
+// frame, and rejects instances whose bounds are hidden behind them before their
+// data is written to the instance buffer.  The depth buffer keeps the farthest
+// depth of every 8x8 tile, so most boxes are decided from a handful of tiles.
+//***************************************************************************************
+
+#pragma once
+
+#include "InstanceCulling.h"
+#include "../../Common/GeometryGenerator.h"
+
+class OcclusionCuller
+{
+public:
+	struct Stats
+	{
+		UINT OccluderTriangles = 0;
+		UINT Tested = 0;
+		UINT Occluded = 0;
+		double RasterMs = 0.0;
+		double TestMs = 0.0;
+
+		float OccludedFraction()const;
+	};
+
+	// width and height are the depth buffer size, rounded up to whole tiles.
+	OcclusionCuller(UINT width = 256, UINT height = 128);
+	OcclusionCuller(const OcclusionCuller& rhs) = delete;
+	OcclusionCuller& operator=(const OcclusionCuller& rhs) = delete;
+	~OcclusionCuller() = default;
+
+	// Occluders are closed meshes placed in world space by world.  They should
+	// be simple, and must lie inside the objects they stand for, since
+	// anything behind them is culled.
+	void AddOccluder(const GeometryGenerator::MeshData& mesh, DirectX::FXMMATRIX world);
+	void ClearOccluders();
+
+	// Clears the depth buffer, draws the occluders seen through viewProj and
+	// builds the tile depths.  Resets the statistics for the frame.
+	void Render(DirectX::FXMMATRIX viewProj);
+
+	// True if the world space box is hidden behind the occluders of the last
+	// Render.  Boxes crossing the near plane are never occluded.  Safe to call
+	// from several threads at once.
+	bool IsOccluded(const DirectX::BoundingBox& box)const;
+
+	// Removes the instances whose bounds are occluded from instances, keeping
+	// the order of the rest, and adds them to this frame's statistics.
+	void RemoveOccluded(const InstanceBounds& bounds, std::vector<UINT>& instances);
+
+	const Stats& FrameStats()const;
+
+private:
+	void RasterizeTriangle(DirectX::FXMVECTOR v0, DirectX::FXMVECTOR v1, DirectX::FXMVECTOR v2);
+	void BuildTileDepths();
+
+private:
+	static const UINT TileSize = 8;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mTilesX = 0;
+	UINT mTilesY = 0;
+
+	DirectX::XMFLOAT4X4 mViewProj;
+
+	// Occluder triangles in world space, three vertices each.
+	std::vector<DirectX::XMFLOAT3> mOccluderVertices;
+
+	// Depth in [0, 1] per pixel, and the farthest depth per tile.
+	std::vector<float> mDepth;
+	std::vector<float> mTileMaxDepth;
+
+	// Working memory for RemoveOccluded, one flag per instance tested.
+	std::vector<BYTE> mOccluded;
+
+	Stats mStats;
+};
@@ -0,0 +1,245 @@
+//***************************************************************************************
+// SpatialGrid.cpp
+//***************************************************************************************
+
+#include "SpatialGrid.h"
+
+using namespace DirectX;
+
+SpatialGrid::SpatialGrid(float cellSize)
+{
+	Reset(cellSize);
+}
+
+void SpatialGrid::Reset(float cellSize)
+{
+	mCellSize = cellSize;
+	mMaxExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	mCells.clear();
+	mCellLookup.clear();
+	mLocations.clear();
+}
+
+void SpatialGrid::Insert(UINT id, const BoundingBox& bounds)
+{
+	if(id >= mLocations.size())
+		mLocations.resize(id + 1);
+
+	assert(mLocations[id].Cell == InvalidCell);
+
+	mMaxExtents.x = std::max(mMaxExtents.x, bounds.Extents.x);
+	mMaxExtents.y = std::max(mMaxExtents.y, bounds.Extents.y);
+	mMaxExtents.z = std::max(mMaxExtents.z, bounds.Extents.z);
+
+	const UINT c = FindOrAddCell(CellCoord(bounds.Center));
+	Cell& cell = mCells[c];
+
+	mLocations[id].Cell = c;
+	mLocations[id].Slot = (UINT)cell.Entries.size();
+
+	cell.Entries.push_back({ id, bounds.Center, bounds.Extents });
+}
+
+void SpatialGrid::Move(UINT id, const BoundingBox& bounds)
+{
+	const Location& loc = mLocations[id];
+	Cell& cell = mCells[loc.Cell];
+
+	const XMINT3 coord = CellCoord(bounds.Center);
+	if(coord.x != cell.Coord.x || coord.y != cell.Coord.y || coord.z != cell.Coord.z)
+	{
+		Remove(id);
+		Insert(id, bounds);
+		return;
+	}
+
+	// Still in the same cell: update the entry where it is.
+	mMaxExtents.x = std::max(mMaxExtents.x, bounds.Extents.x);
+	mMaxExtents.y = std::max(mMaxExtents.y, bounds.Extents.y);
+	mMaxExtents.z = std::max(mMaxExtents.z, bounds.Extents.z);
+
+	Entry& entry = cell.Entries[loc.Slot];
+	entry.Center = bounds.Center;
+	entry.Extents = bounds.Extents;
+}
+
+void SpatialGrid::Remove(UINT id)
+{
+	Location& loc = mLocations[id];
+	Cell& cell = mCells[loc.Cell];
+
+	// Fill the hole with the cell's last entry, so the entries stay packed.
+	const Entry last = cell.Entries.back();
+	cell.Entries[loc.Slot] = last;
+	mLocations[last.Id].Slot = loc.Slot;
+	cell.Entries.pop_back();
+
+	loc.Cell = InvalidCell;
+}
+
+bool SpatialGrid::Contains(UINT id)const
+{
+	return id < mLocations.size() && mLocations[id].Cell != InvalidCell;
+}
+
+UINT SpatialGrid::CellCount()const
+{
+	return (UINT)mCells.size();
+}
+
+void SpatialGrid::FrustumQuery(const BoundingFrustum& frustum, std::vector<UINT>& ids)const
+{
+	XMVECTOR planes[6];
+	frustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	XMFLOAT3 corners[BoundingFrustum::CORNER_COUNT];
+	frustum.GetCorners(corners);
+
+	XMVECTOR lo = g_XMInfinity;
+	XMVECTOR hi = -g_XMInfinity;
+	for(UINT i = 0; i < BoundingFrustum::CORNER_COUNT; ++i)
+	{
+		XMVECTOR p = XMLoadFloat3(&corners[i]);
+		lo = XMVectorMin(lo, p);
+		hi = XMVectorMax(hi, p);
+	}
+
+	ForEachCellOverlapping(lo, hi, [&](const Cell& cell)
+	{
+		ContainmentType c = LooseCellBounds(cell).ContainedBy(
+			planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]);
+
+		if(c == DirectX::DISJOINT)
+			return;
+
+		for(const Entry& e : cell.Entries)
+		{
+			if(c == DirectX::CONTAINS ||
+				BoundingBox(e.Center, e.Extents).ContainedBy(
+					planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]) != DirectX::DISJOINT)
+			{
+				ids.push_back(e.Id);
+			}
+		}
+	});
+}
+
+void SpatialGrid::SphereQuery(const BoundingSphere& sphere, std::vector<UINT>& ids)const
+{
+	XMVECTOR center = XMLoadFloat3(&sphere.Center);
+	XMVECTOR radius = XMVectorReplicate(sphere.Radius);
+
+	ForEachCellOverlapping(center - radius, center + radius, [&](const Cell& cell)
+	{
+		for(const Entry& e : cell.Entries)
+		{
+			if(sphere.Intersects(BoundingBox(e.Center, e.Extents)))
+				ids.push_back(e.Id);
+		}
+	});
+}
+
+XMINT3 SpatialGrid::CellCoord(const XMFLOAT3& p)const
+{
+	return XMINT3(
+		(int32_t)floorf(p.x / mCellSize),
+		(int32_t)floorf(p.y / mCellSize),
+		(int32_t)floorf(p.z / mCellSize));
+}
+
+std::size_t SpatialGrid::CellCoordHash::operator()(const XMINT3& coord)const
+{
+	// Large odd multipliers spread neighboring cells over the whole range.
+	return (std::size_t)((UINT64)(UINT)coord.x*73856093ull ^
+		(UINT64)(UINT)coord.y*19349663ull ^
+		(UINT64)(UINT)coord.z*83492791ull);
+}
+
+bool SpatialGrid::CellCoordEqual::operator()(const XMINT3& a, const XMINT3& b)const
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+UINT SpatialGrid::FindOrAddCell(const XMINT3& coord)
+{
+	auto it = mCellLookup.find(coord);
+	if(it != mCellLookup.end())
+		return it->second;
+
+	const UINT c = (UINT)mCells.size();
+	mCells.emplace_back();
+	mCells[c].Coord = coord;
+	mCellLookup[coord] = c;
+
+	return c;
+}
+
+BoundingBox SpatialGrid::LooseCellBounds(const Cell& cell)const
+{
+	const float h = 0.5f*mCellSize;
+
+	return BoundingBox(
+		XMFLOAT3(
+			(cell.Coord.x + 0.5f)*mCellSize,
+			(cell.Coord.y + 0.5f)*mCellSize,
+			(cell.Coord.z + 0.5f)*mCellSize),
+		XMFLOAT3(h + mMaxExtents.x, h + mMaxExtents.y, h + mMaxExtents.z));
+}
+
+template<typename Visit>
+void SpatialGrid::ForEachCellOverlapping(FXMVECTOR lo, FXMVECTOR hi, Visit visit)const
+{
+	if(mCells.empty())
+		return;
+
+	// A box overlapping [lo, hi] has its center within mMaxExtents of it.
+	XMVECTOR maxExtents = XMLoadFloat3(&mMaxExtents);
+
+	XMFLOAT3 centerLo;
+	XMFLOAT3 centerHi;
+	XMStoreFloat3(&centerLo, lo - maxExtents);
+	XMStoreFloat3(&centerHi, hi + maxExtents);
+
+	const XMINT3 first = CellCoord(centerLo);
+	const XMINT3 last = CellCoord(centerHi);
+
+	// In floating point, since a far plane can span more cells than fit in
+	// an integer.
+	const double rangeCells =
+		((double)last.x - first.x + 1.0)*
+		((double)last.y - first.y + 1.0)*
+		((double)last.z - first.z + 1.0);
+
+	if(rangeCells < (double)mCells.size())
+	{
+		XMINT3 coord;
+		for(coord.z = first.z; coord.z <= last.z; ++coord.z)
+		{
+			for(coord.y = first.y; coord.y <= last.y; ++coord.y)
+			{
+				for(coord.x = first.x; coord.x <= last.x; ++coord.x)
+				{
+					auto it = mCellLookup.find(coord);
+					if(it != mCellLookup.end() && !mCells[it->second].Entries.empty())
+						visit(mCells[it->second]);
+				}
+			}
+		}
+	}
+	else
+	{
+		for(const Cell& cell : mCells)
+		{
+			if(cell.Entries.empty() ||
+				cell.Coord.x < first.x || cell.Coord.x > last.x ||
+				cell.Coord.y < first.y || cell.Coord.y > last.y ||
+				cell.Coord.z < first.z || cell.Coord.z > last.z)
+			{
+				continue;
+			}
+
+			visit(cell);
+		}
+	}
+}
@@ -0,0 +1,106 @@
+//***************************************************************************************
+// SpatialGrid.h
+//
+// A loose, hashed uniform grid of boxes for scenes where many objects move every
+// frame.  Each box is filed in the one cell that holds its center, so inserting,
+// moving and removing a box takes constant time, with nothing to rebuild or refit.
+// Queries widen every cell by the largest box extents seen, which is what makes the
+// grid "loose": it is enough to look in the cells overlapping the query.
+//***************************************************************************************
+
+#pragma once
+
+#include "../../Common/d3dUtil.h"
+
+class SpatialGrid
+{
+public:
+	SpatialGrid(float cellSize = 16.0f);
+	SpatialGrid(const SpatialGrid& rhs) = delete;
+	SpatialGrid& operator=(const SpatialGrid& rhs) = delete;
+	~SpatialGrid() = default;
+
+	// Removes every box and sets the cell size.  Cells should be a few times
+	// larger than the typical box.
+	void Reset(float cellSize);
+
+	// id must not be in the grid already.  Ids index a table, so they should
+	// be small and dense, like instance indices.
+	void Insert(UINT id, const DirectX::BoundingBox& bounds);
+	void Move(UINT id, const DirectX::BoundingBox& bounds);
+	void Remove(UINT id);
+
+	bool Contains(UINT id)const;
+	UINT CellCount()const;
+
+	// Appends to ids the boxes that are not entirely outside frustum.
+	void FrustumQuery(const DirectX::BoundingFrustum& frustum, std::vector<UINT>& ids)const;
+
+	// Appends to ids the boxes that intersect sphere, for neighbor queries.
+	void SphereQuery(const DirectX::BoundingSphere& sphere, std::vector<UINT>& ids)const;
+
+private:
+	struct Entry
+	{
+		UINT Id;
+		DirectX::XMFLOAT3 Center;
+		DirectX::XMFLOAT3 Extents;
+	};
+
+	// The entries of a cell are stored together, in no particular order.
+	struct Cell
+	{
+		DirectX::XMINT3 Coord;
+		std::vector<Entry> Entries;
+	};
+
+	struct Location
+	{
+		UINT Cell = InvalidCell;
+		UINT Slot = 0;
+	};
+
+	DirectX::XMINT3 CellCoord(const DirectX::XMFLOAT3& p)const;
+
+	// The cell lookup is keyed on the full coordinates, so distant cells never
+	// share an entry.
+	struct CellCoordHash
+	{
+		std::size_t operator()(const DirectX::XMINT3& coord)const;
+	};
+
+	struct CellCoordEqual
+	{
+		bool operator()(const DirectX::XMINT3& a, const DirectX::XMINT3& b)const;
+	};
+
+	// Returns the cell at coord, creating it if there is none.
+	UINT FindOrAddCell(const DirectX::XMINT3& coord);
+
+	// The cell's box widened by the largest extents, which bounds every box
+	// filed in the cell.
+	DirectX::BoundingBox LooseCellBounds(const Cell& cell)const;
+
+	// Calls visit(cell) for the cells that may hold boxes overlapping the box
+	// [lo, hi], looking them up one by one if there are fewer of those than
+	// existing cells, or scanning the existing cells otherwise.
+	template<typename Visit>
+	void ForEachCellOverlapping(DirectX::FXMVECTOR lo, DirectX::FXMVECTOR hi, Visit visit)const;
+
+private:
+	static const UINT InvalidCell = 0xffffffff;
+
+	float mCellSize = 16.0f;
+
+	// The largest extents of any box inserted since the last Reset.  Boxes
+	// that shrink or leave do not lower it.
+	DirectX::XMFLOAT3 mMaxExtents = { 0.0f, 0.0f, 0.0f };
+
+	// Cells are never removed once created; an empty cell costs one skipped
+	// entry in a scan.
+	std::vector<Cell> mCells;
+	std::unordered_map<DirectX::XMINT3, UINT, CellCoordHash, CellCoordEqual> mCellLookup;
+
+	// Where each id is filed, indexed by id.
+	std::vector<Location> mLocations;
+};
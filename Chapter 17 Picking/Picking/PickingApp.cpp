@@ -7,7 +7,9 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/ScenePicker.h"
 #include "FrameResource.h"
+#include <ppl.h>
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -100,6 +102,10 @@ private:
     void BuildRenderItems();
     void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
 	void Pick(int sx, int sy);
+	void SelectRect(int x0, int y0, int x1, int y1);
+	void MeasureRayThroughput();
+	void MeasurePickLatency();
+	void MeasureDepthPrecision();
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
@@ -131,11 +137,23 @@ private:
 
 	RenderItem* mPickedRitem = nullptr;
 
+	// Picks among the opaque render items; item i is mRitemLayer[Opaque][i].
+	ScenePicker mPicker;
+
     PassConstants mMainPassCB;
 
 	Camera mCamera;
 
     POINT mLastMousePos;
+
+	bool mMeasureKeyDown = false;
+	bool mLatencyKeyDown = false;
+	bool mDepthKeyDown = false;
+
+	// Where the right button went down.  Releasing it there picks a triangle;
+	// releasing it elsewhere selects the render items inside the rectangle.
+	POINT mSelectStart;
+	bool mSelecting = false;
 };
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
@@ -164,6 +182,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 PickingApp::PickingApp(HINSTANCE hInstance)
     : D3DApp(hInstance)
 {
+	// Reverse-Z into a float depth buffer, with no far clipping plane.  The
+	// far distance given to SetLens then only bounds picking.
+	mCamera.SetDepthMode(true, true);
+	mDepthStencilFormat = DXGI_FORMAT_D32_FLOAT_S8X24_UINT;
+	mDepthClearValue = mCamera.IsReverseZ() ? 0.0f : 1.0f;
 }
 
 PickingApp::~PickingApp()
@@ -262,7 +285,7 @@ void PickingApp::Draw(const GameTimer& gt)
 
     // Clear the back buffer and depth buffer.
     mCommandList->ClearRenderTargetView(CurrentBackBufferView(), Colors::LightSteelBlue, 0, nullptr);
-    mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+    mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, mDepthClearValue, 0, 0, nullptr);
 
     // Specify the buffers we are going to render to.
     mCommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
@@ -325,12 +348,27 @@ void PickingApp::OnMouseDown(WPARAM btnState, int x, int y)
 	}
 	else if((btnState & MK_RBUTTON) != 0)
 	{
-		Pick(x, y);
+		mSelectStart.x = x;
+		mSelectStart.y = y;
+		mSelecting = true;
+
+		SetCapture(mhMainWnd);
 	}
 }
 
 void PickingApp::OnMouseUp(WPARAM btnState, int x, int y)
 {
+	if(mSelecting && (btnState & MK_RBUTTON) == 0)
+	{
+		mSelecting = false;
+
+		// Small slips of the mouse still count as a click.
+		if(std::abs(x - mSelectStart.x) <= 2 && std::abs(y - mSelectStart.y) <= 2)
+			Pick(mSelectStart.x, mSelectStart.y);
+		else
+			SelectRect(mSelectStart.x, mSelectStart.y, x, y);
+	}
+
     ReleaseCapture();
 }
 
@@ -366,6 +404,39 @@ void PickingApp::OnKeyboardInput(const GameTimer& gt)
 	if(GetAsyncKeyState('D') & 0x8000)
 		mCamera.Strafe(10.0f*dt);
 
+	// Measure once per press of R.
+	if(GetAsyncKeyState('R') & 0x8000)
+	{
+		if(!mMeasureKeyDown)
+			MeasureRayThroughput();
+
+		mMeasureKeyDown = true;
+	}
+	else
+		mMeasureKeyDown = false;
+
+	// Measure once per press of L.
+	if(GetAsyncKeyState('L') & 0x8000)
+	{
+		if(!mLatencyKeyDown)
+			MeasurePickLatency();
+
+		mLatencyKeyDown = true;
+	}
+	else
+		mLatencyKeyDown = false;
+
+	// Measure once per press of Z.
+	if(GetAsyncKeyState('Z') & 0x8000)
+	{
+		if(!mDepthKeyDown)
+			MeasureDepthPrecision();
+
+		mDepthKeyDown = true;
+	}
+	else
+		mDepthKeyDown = false;
+
 	mCamera.UpdateViewMatrix();
 }
  
@@ -431,10 +502,10 @@ void PickingApp::UpdateMainPassCB(const GameTimer& gt)
 	XMMATRIX view = mCamera.GetView();
 	XMMATRIX proj = mCamera.GetProj();
 
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMMATRIX viewProj = mCamera.GetViewProj();
+	XMMATRIX invView = mCamera.GetInvView();
+	XMMATRIX invProj = mCamera.GetInvProj();
+	XMMATRIX invViewProj = mCamera.GetInvViewProj();
 
 	XMStoreFloat4x4(&mMainPassCB.View, XMMatrixTranspose(view));
 	XMStoreFloat4x4(&mMainPassCB.InvView, XMMatrixTranspose(invView));
@@ -445,8 +516,8 @@ void PickingApp::UpdateMainPassCB(const GameTimer& gt)
 	mMainPassCB.EyePosW = mCamera.GetPosition3f();
 	mMainPassCB.RenderTargetSize = XMFLOAT2((float)mClientWidth, (float)mClientHeight);
 	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
-	mMainPassCB.NearZ = 1.0f;
-	mMainPassCB.FarZ = 1000.0f;
+	mMainPassCB.NearZ = mCamera.GetNearZ();
+	mMainPassCB.FarZ = mCamera.GetFarZ();
 	mMainPassCB.TotalTime = gt.TotalTime();
 	mMainPassCB.DeltaTime = gt.DeltaTime();
 	mMainPassCB.AmbientLight = { 0.25f, 0.25f, 0.35f, 1.0f };
@@ -677,6 +748,8 @@ void PickingApp::BuildPSOs()
 	opaquePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
 	opaquePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
 	opaquePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	opaquePsoDesc.DepthStencilState.DepthFunc = mCamera.IsReverseZ() ?
+		D3D12_COMPARISON_FUNC_GREATER : D3D12_COMPARISON_FUNC_LESS;
 	opaquePsoDesc.SampleMask = UINT_MAX;
 	opaquePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 	opaquePsoDesc.NumRenderTargets = 1;
@@ -695,8 +768,9 @@ void PickingApp::BuildPSOs()
 	// Change the depth test from < to <= so that if we draw the same triangle twice, it will
 	// still pass the depth test.  This is needed because we redraw the picked triangle with a
 	// different material to highlight it.  If we do not use <=, the triangle will fail the 
-	// depth test the 2nd time we try and draw it.
-	highlightPsoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS_EQUAL;
+	// depth test the 2nd time we try and draw it.  With reverse-Z the test is > and becomes >=.
+	highlightPsoDesc.DepthStencilState.DepthFunc = mCamera.IsReverseZ() ?
+		D3D12_COMPARISON_FUNC_GREATER_EQUAL : D3D12_COMPARISON_FUNC_LESS_EQUAL;
 
 	// Standard transparency blending.
 	D3D12_RENDER_TARGET_BLEND_DESC transparencyBlendDesc;
@@ -783,6 +857,15 @@ void PickingApp::BuildRenderItems()
 
 	mAllRitems.push_back(std::move(carRitem));
 	mAllRitems.push_back(std::move(pickedRitem));
+
+	// Picker item i is mRitemLayer[Opaque][i].  This builds the triangle hierarchies now
+	// rather than on the first pick.
+	for(auto ri : mRitemLayer[(int)RenderLayer::Opaque])
+	{
+		mPicker.AddItem(*ri->Geo, ri->IndexCount, ri->StartIndexLocation, ri->BaseVertexLocation,
+			ri->Bounds, ri->World);
+		mPicker.SetItemPickable(mPicker.ItemCount() - 1, ri->Visible);
+	}
 }
 
 void PickingApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
@@ -870,95 +953,415 @@ std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> PickingApp::GetStaticSamplers()
 
 void PickingApp::Pick(int sx, int sy)
 {
+	__int64 startTime;
+	QueryPerformanceCounter((LARGE_INTEGER*)&startTime);
+
+	// The picker keeps the ray in view space and carries it into the local space of each
+	// render item it tests, so the hit is the nearest over all the opaque render items.
+	ScenePicker::Hit hit = mPicker.PickPixel(sx, sy, mClientWidth, mClientHeight, mCamera);
+
+	__int64 endTime;
+	__int64 countsPerSec;
+	QueryPerformanceCounter((LARGE_INTEGER*)&endTime);
+	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+
+	// The picked render-item is invisible unless something was hit.
+	mPickedRitem->Visible = hit.Item != ScenePicker::NoItem;
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"Picking Demo";
+
+	if(mPickedRitem->Visible)
+	{
+		auto ri = mRitemLayer[(int)RenderLayer::Opaque][hit.Item];
+
+		mPickedRitem->IndexCount = 3;
+		mPickedRitem->BaseVertexLocation = ri->BaseVertexLocation;
+
+		// Picked render item needs same world matrix as object picked.
+		mPickedRitem->World = ri->World;
+		mPickedRitem->NumFramesDirty = gNumFrameResources;
+
+		// Offset to the picked triangle in the mesh index buffer.
+		mPickedRitem->StartIndexLocation = ri->StartIndexLocation + 3 * hit.Triangle;
+
+		outs << L"    triangle " << hit.Triangle <<
+			L" at (" << hit.Barycentrics.x << L", " << hit.Barycentrics.y << L")";
+	}
+
+	// Show how long the pick took in the window caption.
+	outs << L"    pick " << 1000.0*(double)(endTime - startTime) / (double)countsPerSec << L" ms";
+	mMainWndCaption = outs.str();
+}
+
+void PickingApp::SelectRect(int x0, int y0, int x1, int y1)
+{
+	std::vector<UINT> selected;
+	mPicker.PickRect(x0, y0, x1, y1, mClientWidth, mClientHeight, mCamera, selected);
+
+	std::wostringstream outs;
+	outs << L"Picking Demo    " << selected.size() << L" of " <<
+		mPicker.ItemCount() << L" render items selected";
+	mMainWndCaption = outs.str();
+}
+
+void PickingApp::MeasureRayThroughput()
+{
+	typedef TriangleHierarchy::Ray Ray;
+	typedef TriangleHierarchy::RayOrder RayOrder;
+
+	auto ri = mRitemLayer[(int)RenderLayer::Opaque][0];
+	const TriangleHierarchy& triangles = TriangleHierarchy::ForSubmesh(*ri->Geo,
+		ri->IndexCount, ri->StartIndexLocation, ri->BaseVertexLocation);
+
+	XMMATRIX W = XMLoadFloat4x4(&ri->World);
+	XMMATRIX viewToLocal = mCamera.GetInvView()*XMMatrixInverse(&XMMatrixDeterminant(W), W);
+
 	XMFLOAT4X4 P = mCamera.GetProj4x4f();
 
-	// Compute picking ray in view space.
-	float vx = (+2.0f*sx / mClientWidth - 1.0f) / P(0, 0);
-	float vy = (-2.0f*sy / mClientHeight + 1.0f) / P(1, 1);
+	// Camera rays through a grid of pixels, ordered so that each four rays
+	// cover a 2x2 block of pixels.
+	const UINT gridSize = 256;
+	std::vector<Ray> coherentRays;
+	coherentRays.reserve(gridSize*gridSize);
+	for(UINT y = 0; y < gridSize; y += 2)
+	{
+		for(UINT x = 0; x < gridSize; x += 2)
+		{
+			for(UINT k = 0; k < 4; ++k)
+			{
+				float sx = (x + (k & 1) + 0.5f) / gridSize;
+				float sy = (y + (k >> 1) + 0.5f) / gridSize;
+				float vx = (+2.0f*sx - 1.0f) / P(0, 0);
+				float vy = (-2.0f*sy + 1.0f) / P(1, 1);
+
+				Ray ray;
+				XMStoreFloat3(&ray.Origin, XMVector3TransformCoord(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), viewToLocal));
+				XMStoreFloat3(&ray.Direction, XMVector3Normalize(
+					XMVector3TransformNormal(XMVectorSet(vx, vy, 1.0f, 0.0f), viewToLocal)));
+				coherentRays.push_back(ray);
+			}
+		}
+	}
 
-	// Ray definition in view space.
-	XMVECTOR rayOrigin = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-	XMVECTOR rayDir = XMVectorSet(vx, vy, 1.0f, 0.0f);
-	
-	XMMATRIX V = mCamera.GetView();
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(V), V);
+	// Line of sight tests between random points around the car.
+	const BoundingBox& bounds = ri->Bounds;
+	auto randomPoint = [&]()
+	{
+		return XMVectorSet(
+			bounds.Center.x + 2.0f*bounds.Extents.x*MathHelper::RandF(-1.0f, 1.0f),
+			bounds.Center.y + 2.0f*bounds.Extents.y*MathHelper::RandF(-1.0f, 1.0f),
+			bounds.Center.z + 2.0f*bounds.Extents.z*MathHelper::RandF(-1.0f, 1.0f), 1.0f);
+	};
 
-	// Assume nothing is picked to start, so the picked render-item is invisible.
-	mPickedRitem->Visible = false;
+	std::vector<Ray> incoherentRays(coherentRays.size());
+	for(Ray& ray : incoherentRays)
+	{
+		XMVECTOR from = randomPoint();
+		XMVECTOR to = randomPoint();
 
-	// Check if we picked an opaque render item.  A real app might keep a separate "picking list"
-	// of objects that can be selected.   
-	for(auto ri : mRitemLayer[(int)RenderLayer::Opaque])
+		XMStoreFloat3(&ray.Origin, from);
+		XMStoreFloat3(&ray.Direction, XMVector3Normalize(to - from));
+		ray.MaxDist = XMVectorGetX(XMVector3Length(to - from));
+	}
+
+	std::vector<TriangleHierarchy::RayHit> hits;
+	auto raysPerSecond = [&](const std::vector<Ray>& rays, RayOrder order)
 	{
-		auto geo = ri->Geo;
+		__int64 startTime;
+		__int64 endTime;
+		__int64 countsPerSec;
+		QueryPerformanceCounter((LARGE_INTEGER*)&startTime);
+		triangles.IntersectStream(rays, hits, order);
+		QueryPerformanceCounter((LARGE_INTEGER*)&endTime);
+		QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+
+		return (double)rays.size()*(double)countsPerSec / (double)MathHelper::Max(endTime - startTime, (__int64)1);
+	};
 
-		// Skip invisible render-items.
-		if(ri->Visible == false)
-			continue;
+	// Warm up the caches and the worker threads.
+	triangles.IntersectStream(coherentRays, hits, RayOrder::Coherent);
+
+	// Measure with 1, 2, 4, ... threads, up to one per processor.
+	const UINT maxThreads = concurrency::GetProcessorCount();
+	std::wostringstream outs;
+	outs.precision(3);
+
+	for(UINT threads = 1; ; threads = MathHelper::Min(2*threads, maxThreads))
+	{
+		concurrency::CurrentScheduler::Create(concurrency::SchedulerPolicy(2,
+			concurrency::MinConcurrency, 1, concurrency::MaxConcurrency, threads));
 
-		XMMATRIX W = XMLoadFloat4x4(&ri->World);
-		XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(W), W);
+		double coherent = raysPerSecond(coherentRays, RayOrder::Coherent);
+		double incoherent = raysPerSecond(incoherentRays, RayOrder::Incoherent);
 
-		// Tranform ray to vi space of Mesh.
-		XMMATRIX toLocal = XMMatrixMultiply(invView, invWorld);
+		concurrency::CurrentScheduler::Detach();
 
-		rayOrigin = XMVector3TransformCoord(rayOrigin, toLocal);
-		rayDir = XMVector3TransformNormal(rayDir, toLocal);
+		outs.str(L"");
+		outs << L"Picking Demo    " << threads << L" threads: " <<
+			coherent / 1e6 << L" M coherent rays/s, " <<
+			incoherent / 1e6 << L" M incoherent rays/s";
 
-		// Make the ray direction unit length for the intersection tests.
-		rayDir = XMVector3Normalize(rayDir);
+		OutputDebugString((outs.str() + L"\n").c_str());
+
+		if(threads == maxThreads)
+			break;
+	}
+
+	mMainWndCaption = outs.str();
+}
 
-		// If we hit the bounding box of the Mesh, then we might have picked a Mesh triangle,
-		// so do the ray/triangle tests.
-		//
-		// If we did not hit the bounding box, then it is impossible that we hit 
-		// the Mesh, so do not waste effort doing ray/triangle tests.
-		float tmin = 0.0f;
-		if(ri->Bounds.Intersects(rayOrigin, rayDir, tmin))
+void PickingApp::MeasurePickLatency()
+{
+	typedef TriangleHierarchy::RayHit RayHit;
+
+	__int64 countsPerSec;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+
+	auto now = []()
+	{
+		__int64 count;
+		QueryPerformanceCounter((LARGE_INTEGER*)&count);
+		return count;
+	};
+
+	auto microsecondsSince = [&](__int64 start)
+	{
+		return 1.0e6*(double)(now() - start) / (double)countsPerSec;
+	};
+
+	// Rays from random points on the sphere around bounds to random points
+	// inside it, in the local space of the mesh.
+	auto randomRays = [](const BoundingBox& bounds, UINT count, std::vector<XMFLOAT3>& origins, std::vector<XMFLOAT3>& dirs)
+	{
+		const float radius = 2.0f*XMVectorGetX(XMVector3Length(XMLoadFloat3(&bounds.Extents)));
+		const XMVECTOR center = XMLoadFloat3(&bounds.Center);
+
+		origins.resize(count);
+		dirs.resize(count);
+		for(UINT i = 0; i < count; ++i)
 		{
-			// NOTE: For the demo, we know what to cast the vertex/index data to.  If we were mixing
-			// formats, some metadata would be needed to figure out what to cast it to.
-			auto vertices = (Vertex*)geo->VertexBufferCPU->GetBufferPointer();
-			auto indices = (std::uint32_t*)geo->IndexBufferCPU->GetBufferPointer();
-			UINT triCount = ri->IndexCount / 3;
-
-			// Find the nearest ray/triangle intersection.
-			tmin = MathHelper::Infinity;
-			for(UINT i = 0; i < triCount; ++i)
+			XMVECTOR from = center + radius*MathHelper::RandUnitVec3();
+			XMVECTOR to = center + XMVectorSet(
+				bounds.Extents.x*MathHelper::RandF(-1.0f, 1.0f),
+				bounds.Extents.y*MathHelper::RandF(-1.0f, 1.0f),
+				bounds.Extents.z*MathHelper::RandF(-1.0f, 1.0f), 0.0f);
+
+			XMStoreFloat3(&origins[i], from);
+			XMStoreFloat3(&dirs[i], XMVector3Normalize(to - from));
+		}
+	};
+
+	// Microseconds per ray through the hierarchy, and testing every triangle
+	// as Pick originally did; bruteForceRays of the rays are also cast the
+	// slow way, and must find the same triangles.
+	struct Latency
+	{
+		double BuildMs = 0.0;
+		double HierarchyUs = 0.0;
+		double BruteForceUs = 0.0;
+		UINT Mismatches = 0;
+	};
+
+	auto measure = [&](const MeshGeometry& geo, UINT indexCount, UINT startIndexLocation, INT baseVertexLocation,
+		const BoundingBox& bounds, UINT numRays, UINT bruteForceRays)
+	{
+		Latency latency;
+
+		TriangleHierarchy triangles;
+		__int64 start = now();
+		triangles.Build(geo, indexCount, startIndexLocation, baseVertexLocation);
+		latency.BuildMs = microsecondsSince(start) / 1000.0;
+
+		std::vector<XMFLOAT3> origins;
+		std::vector<XMFLOAT3> dirs;
+		randomRays(bounds, numRays, origins, dirs);
+
+		std::vector<RayHit> hits(numRays);
+		start = now();
+		for(UINT i = 0; i < numRays; ++i)
+			triangles.Intersects(XMLoadFloat3(&origins[i]), XMLoadFloat3(&dirs[i]), MathHelper::Infinity, hits[i]);
+		latency.HierarchyUs = microsecondsSince(start) / numRays;
+
+		start = now();
+		for(UINT i = 0; i < bruteForceRays; ++i)
+		{
+			XMVECTOR origin = XMLoadFloat3(&origins[i]);
+			XMVECTOR dir = XMLoadFloat3(&dirs[i]);
+
+			UINT nearestTri = TriangleHierarchy::NoHit;
+			float nearestDist = MathHelper::Infinity;
+			for(UINT t = 0; t < triangles.TriangleCount(); ++t)
 			{
-				// Indices for this triangle.
-				UINT i0 = indices[i * 3 + 0];
-				UINT i1 = indices[i * 3 + 1];
-				UINT i2 = indices[i * 3 + 2];
-
-				// Vertices for this triangle.
-				XMVECTOR v0 = XMLoadFloat3(&vertices[i0].Pos);
-				XMVECTOR v1 = XMLoadFloat3(&vertices[i1].Pos);
-				XMVECTOR v2 = XMLoadFloat3(&vertices[i2].Pos);
-
-				// We have to iterate over all the triangles in order to find the nearest intersection.
-				float t = 0.0f;
-				if(TriangleTests::Intersects(rayOrigin, rayDir, v0, v1, v2, t))
+				XMVECTOR v0, v1, v2;
+				triangles.GetTriangle(t, v0, v1, v2);
+
+				float dist = 0.0f;
+				if(TriangleTests::Intersects(origin, dir, v0, v1, v2, dist) && dist < nearestDist)
 				{
-					if(t < tmin)
-					{
-						// This is the new nearest picked triangle.
-						tmin = t;
-						UINT pickedTriangle = i;
-
-						mPickedRitem->Visible = true;
-						mPickedRitem->IndexCount = 3;
-						mPickedRitem->BaseVertexLocation = 0;
-
-						// Picked render item needs same world matrix as object picked.
-						mPickedRitem->World = ri->World;
-						mPickedRitem->NumFramesDirty = gNumFrameResources;
-
-						// Offset to the picked triangle in the mesh index buffer.
-						mPickedRitem->StartIndexLocation = 3 * pickedTriangle;
-					}
+					nearestDist = dist;
+					nearestTri = t;
 				}
 			}
+
+			if(nearestTri != hits[i].Triangle)
+				++latency.Mismatches;
 		}
+		latency.BruteForceUs = microsecondsSince(start) / bruteForceRays;
+
+		return latency;
+	};
+
+	std::wostringstream outs;
+	outs.precision(3);
+
+	// The car, cast against directly, then through the scene picker at random
+	// pixels, which is what a click costs.
+	auto car = mRitemLayer[(int)RenderLayer::Opaque][0];
+	Latency carLatency = measure(*car->Geo, car->IndexCount, car->StartIndexLocation,
+		car->BaseVertexLocation, car->Bounds, 10000, 1000);
+
+	const UINT numPicks = 1000;
+	__int64 start = now();
+	for(UINT i = 0; i < numPicks; ++i)
+	{
+		mPicker.PickPixel(MathHelper::Rand(0, mClientWidth - 1), MathHelper::Rand(0, mClientHeight - 1),
+			mClientWidth, mClientHeight, mCamera);
+	}
+	double pickUs = microsecondsSince(start) / numPicks;
+
+	outs << L"Picking Demo    car, " << car->IndexCount / 3 << L" triangles: build " <<
+		carLatency.BuildMs << L" ms, " << carLatency.HierarchyUs << L" us per ray, " <<
+		carLatency.BruteForceUs << L" us brute force, " << carLatency.Mismatches << L" differ, " <<
+		pickUs << L" us per pick";
+	OutputDebugString((outs.str() + L"\n").c_str());
+
+	// A hilly terrain of about 2.9 million triangles, kept on the CPU only.
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData terrain = geoGen.CreateGrid(1000.0f, 1000.0f, 1201, 1201);
+
+	const UINT vbByteSize = (UINT)terrain.Vertices.size()*sizeof(XMFLOAT3);
+	const UINT ibByteSize = (UINT)terrain.Indices32.size()*sizeof(std::uint32_t);
+
+	MeshGeometry terrainGeo;
+	terrainGeo.Name = "terrainGeo";
+	terrainGeo.VertexByteStride = sizeof(XMFLOAT3);
+	terrainGeo.IndexFormat = DXGI_FORMAT_R32_UINT;
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &terrainGeo.VertexBufferCPU));
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &terrainGeo.IndexBufferCPU));
+
+	XMFLOAT3* positions = (XMFLOAT3*)terrainGeo.VertexBufferCPU->GetBufferPointer();
+	XMFLOAT3 vMin(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
+	XMFLOAT3 vMax(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
+	for(size_t i = 0; i < terrain.Vertices.size(); ++i)
+	{
+		XMFLOAT3 p = terrain.Vertices[i].Position;
+		p.y = 0.3f*(p.z*sinf(0.1f*p.x) + p.x*cosf(0.1f*p.z));
+		positions[i] = p;
+
+		XMStoreFloat3(&vMin, XMVectorMin(XMLoadFloat3(&vMin), XMLoadFloat3(&p)));
+		XMStoreFloat3(&vMax, XMVectorMax(XMLoadFloat3(&vMax), XMLoadFloat3(&p)));
 	}
-}
\ No newline at end of file
+	CopyMemory(terrainGeo.IndexBufferCPU->GetBufferPointer(), terrain.Indices32.data(), ibByteSize);
+
+	BoundingBox terrainBounds;
+	BoundingBox::CreateFromPoints(terrainBounds, XMLoadFloat3(&vMin), XMLoadFloat3(&vMax));
+
+	const UINT terrainIndexCount = (UINT)terrain.Indices32.size();
+	Latency terrainLatency = measure(terrainGeo, terrainIndexCount, 0, 0, terrainBounds, 10000, 10);
+
+	outs.str(L"");
+	outs << L"Picking Demo    terrain, " << terrainIndexCount / 3 << L" triangles: build " <<
+		terrainLatency.BuildMs << L" ms, " << terrainLatency.HierarchyUs << L" us per ray, " <<
+		terrainLatency.BruteForceUs << L" us brute force, " << terrainLatency.Mismatches << L" differ";
+	OutputDebugString((outs.str() + L"\n").c_str());
+
+	mMainWndCaption = outs.str();
+}
+
+void PickingApp::MeasureDepthPrecision()
+{
+	// For each depth mode, with the demo camera's lens and a 32-bit float depth
+	// buffer: the change in view distance that changes the stored depth, at
+	// distances from the near plane out to a thousand times the far plane, and
+	// the largest relative error of unprojecting the stored depth with
+	// GetInvProj, as picking and the shaders do.
+	struct Mode
+	{
+		const wchar_t* Name;
+		bool ReverseZ;
+		bool InfiniteFar;
+	};
+
+	const Mode modes[] =
+	{
+		{ L"standard", false, false },
+		{ L"reverse-Z", true, false },
+		{ L"infinite", false, true },
+		{ L"reverse-Z infinite", true, true }
+	};
+
+	const float nearZ = mCamera.GetNearZ();
+	const float farZ = mCamera.GetFarZ();
+
+	std::wostringstream summary;
+	summary.precision(3);
+	summary << L"Picking Demo    depth step at " << farZ << L":";
+
+	for(const Mode& mode : modes)
+	{
+		Camera camera;
+		camera.SetLens(mCamera.GetFovY(), mCamera.GetAspect(), nearZ, farZ);
+		camera.SetDepthMode(mode.ReverseZ, mode.InfiniteFar);
+		camera.UpdateViewMatrix();
+
+		// Depth is A + B/z.
+		XMFLOAT4X4 P = camera.GetProj4x4f();
+		const double A = P(2, 2);
+		const double B = P(3, 2);
+		auto viewDistance = [&](float depth) { return B / ((double)depth - A); };
+
+		// Half the distance between the view distances of the floats on either
+		// side of the depth stored for z.
+		auto depthStep = [&](double z)
+		{
+			float depth = (float)(A + B / z);
+			float below = nextafterf(depth, -MathHelper::Infinity);
+			float above = nextafterf(depth, +MathHelper::Infinity);
+
+			return 0.5*fabs(viewDistance(above) - viewDistance(below));
+		};
+
+		XMMATRIX invProj = camera.GetInvProj();
+
+		std::wostringstream outs;
+		outs.precision(3);
+		outs << L"Depth precision, " << mode.Name << L":";
+
+		double maxUnprojectError = 0.0;
+
+		for(double z = nearZ; z <= 1000.0*farZ; z *= 10.0)
+		{
+			if(!mode.InfiniteFar && z > farZ)
+			{
+				outs << L"  " << z << L" clipped";
+				continue;
+			}
+
+			outs << L"  " << z << L": " << depthStep(z);
+
+			float depth = (float)(A + B / z);
+			XMVECTOR v = XMVector3TransformCoord(XMVectorSet(0.0f, 0.0f, depth, 1.0f), invProj);
+			maxUnprojectError = MathHelper::Max(maxUnprojectError, fabs(XMVectorGetZ(v) - z) / z);
+		}
+
+		outs << L"  max unproject error " << 100.0*maxUnprojectError << L"%";
+
+		OutputDebugString((outs.str() + L"\n").c_str());
+
+		summary << L"  " << mode.Name << L" " << depthStep(farZ);
+	}
+
+	mMainWndCaption = summary.str();
+}
@@ -495,10 +495,10 @@ void DynamicCubeMapApp::UpdateMainPassCB(const GameTimer& gt)
 	XMMATRIX view = mCamera.GetView();
 	XMMATRIX proj = mCamera.GetProj();
 
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMMATRIX viewProj = mCamera.GetViewProj();
+	XMMATRIX invView = mCamera.GetInvView();
+	XMMATRIX invProj = mCamera.GetInvProj();
+	XMMATRIX invViewProj = mCamera.GetInvViewProj();
 
 	XMStoreFloat4x4(&mMainPassCB.View, XMMatrixTranspose(view));
 	XMStoreFloat4x4(&mMainPassCB.InvView, XMMatrixTranspose(invView));
@@ -536,10 +536,10 @@ void DynamicCubeMapApp::UpdateCubeMapFacePassCBs()
 		XMMATRIX view = mCubeMapCamera[i].GetView();
 		XMMATRIX proj = mCubeMapCamera[i].GetProj();
 
-		XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-		XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-		XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+		XMMATRIX viewProj = mCubeMapCamera[i].GetViewProj();
+		XMMATRIX invView = mCubeMapCamera[i].GetInvView();
+		XMMATRIX invProj = mCubeMapCamera[i].GetInvProj();
+		XMMATRIX invViewProj = mCubeMapCamera[i].GetInvViewProj();
 
 		XMStoreFloat4x4(&cubeFacePassCB.View, XMMatrixTranspose(view));
 		XMStoreFloat4x4(&cubeFacePassCB.InvView, XMMatrixTranspose(invView));
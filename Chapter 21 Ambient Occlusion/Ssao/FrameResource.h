@@ -59,6 +59,17 @@ struct SsaoConstants
     float OcclusionFadeStart = 0.2f;
     float OcclusionFadeEnd = 2.0f;
     float SurfaceEpsilon = 0.05f;
+
+    // Offset of the random vector map, changed every frame so that the
+    // accumulated frames use different sample directions.
+    DirectX::XMFLOAT2 NoiseOffset = { 0.0f, 0.0f };
+
+    // Maps this frame's NDC space to last frame's homogeneous clip space.
+    DirectX::XMFLOAT4X4 Reprojection = MathHelper::Identity4x4();
+
+    // Weight of this frame's ambient access against the reprojected history;
+    // 1 ignores the history.
+    float TemporalBlend = 1.0f;
 };
 
 struct MaterialData
@@ -19,6 +19,11 @@ cbuffer cbSsao : register(b0)
     float    gOcclusionFadeStart;
     float    gOcclusionFadeEnd;
     float    gSurfaceEpsilon;
+
+    // For temporal accumulation.
+    float2   gNoiseOffset;
+    float4x4 gReprojection;
+    float    gTemporalBlend;
 };
 
 cbuffer cbRootConstants : register(b1)
@@ -30,6 +35,7 @@ cbuffer cbRootConstants : register(b1)
 Texture2D gNormalMap    : register(t0);
 Texture2D gDepthMap     : register(t1);
 Texture2D gRandomVecMap : register(t2);
+Texture2D gHistoryMap   : register(t3);
 
 SamplerState gsamPointClamp : register(s0);
 SamplerState gsamLinearClamp : register(s1);
@@ -37,6 +43,9 @@ SamplerState gsamDepthMap : register(s2);
 SamplerState gsamLinearWrap : register(s3);
 
 static const int gSampleCount = 14;
+
+// Relative view depth difference above which the history is rejected.
+static const float gHistoryDepthTolerance = 0.05f;
  
 static const float2 gTexCoords[6] =
 {
@@ -123,8 +132,8 @@ float4 PS(VertexOut pin) : SV_Target
 
 	// Get viewspace normal and z-coord of this pixel.  
     float3 n = normalize(gNormalMap.SampleLevel(gsamPointClamp, pin.TexC, 0.0f).xyz);
-    float pz = gDepthMap.SampleLevel(gsamDepthMap, pin.TexC, 0.0f).r;
-    pz = NdcDepthToViewDepth(pz);
+    float depth = gDepthMap.SampleLevel(gsamDepthMap, pin.TexC, 0.0f).r;
+    float pz = NdcDepthToViewDepth(depth);
 
 	//
 	// Reconstruct full view space position (x,y,z).
@@ -135,7 +144,7 @@ float4 PS(VertexOut pin) : SV_Target
 	float3 p = (pz/pin.PosV.z)*pin.PosV;
 	
 	// Extract random vector and map from [0,1] --> [-1, +1].
-	float3 randVec = 2.0f*gRandomVecMap.SampleLevel(gsamLinearWrap, 4.0f*pin.TexC, 0.0f).rgb - 1.0f;
+	float3 randVec = 2.0f*gRandomVecMap.SampleLevel(gsamLinearWrap, 4.0f*pin.TexC + gNoiseOffset, 0.0f).rgb - 1.0f;
 
 	float occlusionSum = 0.0f;
 	
@@ -195,5 +204,33 @@ float4 PS(VertexOut pin) : SV_Target
 	float access = 1.0f - occlusionSum;
 
 	// Sharpen the contrast of the SSAO map to make the SSAO affect more dramatic.
-	return saturate(pow(access, 6.0f));
+	access = saturate(pow(access, 6.0f));
+
+	// Find where p was last frame and blend with the ambient access computed
+	// there, which accumulates the random directions of many frames.  Points
+	// that were off screen start over, as do points whose history belongs to
+	// a different surface (disoccluded by motion): the history stores the depth
+	// it was computed at, and it must match the depth p had last frame.  With
+	// no valid history (gTemporalBlend == 1) the history map is never read, so
+	// garbage in it cannot leak through the lerp.
+	if(gTemporalBlend < 1.0f)
+	{
+		float4 prevH = mul(float4(2.0f*pin.TexC.x - 1.0f, 1.0f - 2.0f*pin.TexC.y, depth, 1.0f), gReprojection);
+		float2 prevTexC = float2(0.5f, -0.5f)*prevH.xy/prevH.w + 0.5f;
+
+		if(prevH.w > 0.0f && all(prevTexC == saturate(prevTexC)))
+		{
+			float2 history = gHistoryMap.SampleLevel(gsamLinearClamp, prevTexC, 0.0f).rg;
+
+			float expectedZ = NdcDepthToViewDepth(prevH.z / prevH.w);
+			float historyZ = NdcDepthToViewDepth(history.y);
+
+			if(abs(expectedZ - historyZ) < gHistoryDepthTolerance*expectedZ)
+				access = lerp(history.x, access, gTemporalBlend);
+		}
+	}
+
+	// Keep the depth next to the ambient access so next frame can tell whether
+	// this history still belongs to the same surface.
+	return float4(access, depth, 0.0f, 0.0f);
 }
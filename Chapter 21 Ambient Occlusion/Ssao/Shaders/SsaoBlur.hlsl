@@ -27,7 +27,10 @@ cbuffer cbSsao : register(b0)
     float gOcclusionFadeEnd;
     float gSurfaceEpsilon;
 
-    
+    // For Ssao.hlsl
+    float2   gNoiseOffset;
+    float4x4 gReprojection;
+    float    gTemporalBlend;
 };
 
 cbuffer cbRootConstants : register(b1)
@@ -96,6 +96,11 @@ CD3DX12_GPU_DESCRIPTOR_HANDLE Ssao::AmbientMapSrv()const
     return mhAmbientMap0GpuSrv;
 }
 
+bool Ssao::HistoryValid()const
+{
+    return mHistoryValid;
+}
+
 void Ssao::BuildDescriptors(
     ID3D12Resource* depthStencilBuffer,
     CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuSrv,
@@ -105,19 +110,21 @@ void Ssao::BuildDescriptors(
     UINT rtvDescriptorSize)
 {
     // Save references to the descriptors.  The Ssao reserves heap space
-    // for 5 contiguous Srvs.
+    // for 6 contiguous Srvs.
 
     mhAmbientMap0CpuSrv = hCpuSrv;
     mhAmbientMap1CpuSrv = hCpuSrv.Offset(1, cbvSrvUavDescriptorSize);
     mhNormalMapCpuSrv = hCpuSrv.Offset(1, cbvSrvUavDescriptorSize);
     mhDepthMapCpuSrv = hCpuSrv.Offset(1, cbvSrvUavDescriptorSize);
     mhRandomVectorMapCpuSrv = hCpuSrv.Offset(1, cbvSrvUavDescriptorSize);
+    mhAmbientHistoryCpuSrv = hCpuSrv.Offset(1, cbvSrvUavDescriptorSize);
 
     mhAmbientMap0GpuSrv = hGpuSrv;
     mhAmbientMap1GpuSrv = hGpuSrv.Offset(1, cbvSrvUavDescriptorSize);
     mhNormalMapGpuSrv = hGpuSrv.Offset(1, cbvSrvUavDescriptorSize);
     mhDepthMapGpuSrv = hGpuSrv.Offset(1, cbvSrvUavDescriptorSize);
     mhRandomVectorMapGpuSrv = hGpuSrv.Offset(1, cbvSrvUavDescriptorSize);
+    mhAmbientHistoryGpuSrv = hGpuSrv.Offset(1, cbvSrvUavDescriptorSize);
 
     mhNormalMapCpuRtv = hCpuRtv;
     mhAmbientMap0CpuRtv = hCpuRtv.Offset(1, rtvDescriptorSize);
@@ -146,6 +153,7 @@ void Ssao::RebuildDescriptors(ID3D12Resource* depthStencilBuffer)
     srvDesc.Format = AmbientMapFormat;
     md3dDevice->CreateShaderResourceView(mAmbientMap0.Get(), &srvDesc, mhAmbientMap0CpuSrv);
     md3dDevice->CreateShaderResourceView(mAmbientMap1.Get(), &srvDesc, mhAmbientMap1CpuSrv);
+    md3dDevice->CreateShaderResourceView(mAmbientHistory.Get(), &srvDesc, mhAmbientHistoryCpuSrv);
 
     D3D12_RENDER_TARGET_VIEW_DESC rtvDesc = {};
     rtvDesc.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D;
@@ -217,6 +225,9 @@ void Ssao::ComputeSsao(
     // Bind the random vector map.
     cmdList->SetGraphicsRootDescriptorTable(3, mhRandomVectorMapGpuSrv);
 
+    // Bind last frame's ambient map.
+    cmdList->SetGraphicsRootDescriptorTable(4, mhAmbientHistoryGpuSrv);
+
     cmdList->SetPipelineState(mSsaoPso);
 
 	// Draw fullscreen quad.
@@ -229,6 +240,29 @@ void Ssao::ComputeSsao(
     cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mAmbientMap0.Get(),
         D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
 
+    // Keep the unblurred result for the next frame to blend with.
+    D3D12_RESOURCE_BARRIER toCopy[2] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(mAmbientMap0.Get(),
+            D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_SOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(mAmbientHistory.Get(),
+            D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_DEST)
+    };
+    cmdList->ResourceBarrier(2, toCopy);
+
+    cmdList->CopyResource(mAmbientHistory.Get(), mAmbientMap0.Get());
+
+    D3D12_RESOURCE_BARRIER toRead[2] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(mAmbientMap0.Get(),
+            D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_GENERIC_READ),
+        CD3DX12_RESOURCE_BARRIER::Transition(mAmbientHistory.Get(),
+            D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ)
+    };
+    cmdList->ResourceBarrier(2, toRead);
+
+    mHistoryValid = true;
+
     BlurAmbientMap(cmdList, currFrame, blurCount);
 }
  
@@ -302,6 +336,8 @@ void Ssao::BuildResources()
     mNormalMap = nullptr;
     mAmbientMap0 = nullptr;
     mAmbientMap1 = nullptr;
+    mAmbientHistory = nullptr;
+    mHistoryValid = false;
 
     D3D12_RESOURCE_DESC texDesc;
     ZeroMemory(&texDesc, sizeof(D3D12_RESOURCE_DESC));
@@ -351,6 +387,17 @@ void Ssao::BuildResources()
         D3D12_RESOURCE_STATE_GENERIC_READ,
         &optClear,
         IID_PPV_ARGS(&mAmbientMap1)));
+
+    // The history is only copied to and read, never rendered to.
+    texDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+    ThrowIfFailed(md3dDevice->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+        D3D12_HEAP_FLAG_NONE,
+        &texDesc,
+        D3D12_RESOURCE_STATE_GENERIC_READ,
+        nullptr,
+        IID_PPV_ARGS(&mAmbientHistory)));
 }
 
 void Ssao::BuildRandomVectorTexture(ID3D12GraphicsCommandList* cmdList)
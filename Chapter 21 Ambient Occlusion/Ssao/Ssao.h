@@ -22,7 +22,8 @@ public:
     Ssao& operator=(const Ssao& rhs) = delete;
     ~Ssao() = default; 
 
-    static const DXGI_FORMAT AmbientMapFormat = DXGI_FORMAT_R16_UNORM;
+    // Red holds the ambient access, green the NDC depth it was computed at.
+    static const DXGI_FORMAT AmbientMapFormat = DXGI_FORMAT_R16G16_UNORM;
     static const DXGI_FORMAT NormalMapFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
 
     static const int MaxBlurRadius = 5;
@@ -41,6 +42,12 @@ public:
 	CD3DX12_GPU_DESCRIPTOR_HANDLE NormalMapSrv()const;
     CD3DX12_GPU_DESCRIPTOR_HANDLE AmbientMapSrv()const;
 
+    ///<summary>
+    /// True if the ambient map of a previous ComputeSsao is kept to blend the
+    /// next one with.  False after the maps are rebuilt.
+    ///</summary>
+    bool HistoryValid()const;
+
 	void BuildDescriptors(
         ID3D12Resource* depthStencilBuffer,
 		CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuSrv,
@@ -63,6 +70,8 @@ public:
     /// quad to kick off the pixel shader to compute the AmbientMap.  We still keep the
     /// main depth buffer binded to the pipeline, but depth buffer read/writes
     /// are disabled, as we do not need the depth buffer computing the Ambient map.
+    /// The result before blurring is blended with the previous one, reprojected,
+    /// and kept for the next call.
     ///</summary>
 	void ComputeSsao(
         ID3D12GraphicsCommandList* cmdList, 
@@ -100,6 +109,10 @@ private:
     Microsoft::WRL::ComPtr<ID3D12Resource> mAmbientMap0;
     Microsoft::WRL::ComPtr<ID3D12Resource> mAmbientMap1;
 
+    // Unblurred ambient map of the previous frame.
+    Microsoft::WRL::ComPtr<ID3D12Resource> mAmbientHistory;
+    bool mHistoryValid = false;
+
     CD3DX12_CPU_DESCRIPTOR_HANDLE mhNormalMapCpuSrv;
     CD3DX12_GPU_DESCRIPTOR_HANDLE mhNormalMapGpuSrv;
     CD3DX12_CPU_DESCRIPTOR_HANDLE mhNormalMapCpuRtv;
@@ -119,6 +132,9 @@ private:
     CD3DX12_GPU_DESCRIPTOR_HANDLE mhAmbientMap1GpuSrv;
     CD3DX12_CPU_DESCRIPTOR_HANDLE mhAmbientMap1CpuRtv;
 
+    CD3DX12_CPU_DESCRIPTOR_HANDLE mhAmbientHistoryCpuSrv;
+    CD3DX12_GPU_DESCRIPTOR_HANDLE mhAmbientHistoryGpuSrv;
+
 	UINT mRenderTargetWidth;
 	UINT mRenderTargetHeight;
 
@@ -156,6 +156,9 @@ private:
 
     std::unique_ptr<Ssao> mSsao;
 
+    // Steps the random vector map offset from frame to frame.
+    UINT mSsaoNoiseIndex = 0;
+
     DirectX::BoundingSphere mSceneBounds;
 
     float mLightNearZ = 0.0f;
@@ -334,6 +337,9 @@ void SsaoApp::Update(const GameTimer& gt)
 	UpdateMainPassCB(gt);
     UpdateShadowPassCB(gt);
     UpdateSsaoCB(gt);
+
+    // This frame's matrices are final; the next frame reprojects from them.
+    mCamera.NextFrame();
 }
 
 void SsaoApp::Draw(const GameTimer& gt)
@@ -383,7 +389,8 @@ void SsaoApp::Draw(const GameTimer& gt)
 	// 
 	
     mCommandList->SetGraphicsRootSignature(mSsaoRootSignature.Get());
-    mSsao->ComputeSsao(mCommandList.Get(), mCurrFrameResource, 3);
+    // The accumulated map is less noisy, so fewer blur passes do.
+    mSsao->ComputeSsao(mCommandList.Get(), mCurrFrameResource, mSsao->HistoryValid() ? 1 : 3);
 	
 	//
 	// Main rendering pass.
@@ -616,10 +623,10 @@ void SsaoApp::UpdateMainPassCB(const GameTimer& gt)
 	XMMATRIX view = mCamera.GetView();
 	XMMATRIX proj = mCamera.GetProj();
 
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMMATRIX viewProj = mCamera.GetViewProj();
+	XMMATRIX invView = mCamera.GetInvView();
+	XMMATRIX invProj = mCamera.GetInvProj();
+	XMMATRIX invViewProj = mCamera.GetInvViewProj();
 
     // Transform NDC space [-1,+1]^2 to texture space [0,1]^2
     XMMATRIX T(
@@ -718,6 +725,15 @@ void SsaoApp::UpdateSsaoCB(const GameTimer& gt)
     ssaoCB.OcclusionFadeStart = 0.2f;
     ssaoCB.OcclusionFadeEnd = 1.0f;
     ssaoCB.SurfaceEpsilon = 0.05f;
+
+    // Accumulate the ambient access over the frames, rotating the random
+    // vectors so each frame samples different directions.
+    mSsaoNoiseIndex = (mSsaoNoiseIndex + 1) % 16;
+    ssaoCB.NoiseOffset.x = MathHelper::Halton(mSsaoNoiseIndex + 1, 2);
+    ssaoCB.NoiseOffset.y = MathHelper::Halton(mSsaoNoiseIndex + 1, 3);
+
+    XMStoreFloat4x4(&ssaoCB.Reprojection, XMMatrixTranspose(mCamera.GetReprojection()));
+    ssaoCB.TemporalBlend = mSsao->HistoryValid() ? 0.2f : 1.0f;
  
     auto currSsaoCB = mCurrFrameResource->SsaoCB.get();
     currSsaoCB->CopyData(0, ssaoCB);
@@ -813,14 +829,18 @@ void SsaoApp::BuildSsaoRootSignature()
     CD3DX12_DESCRIPTOR_RANGE texTable1;
     texTable1.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2, 0);
 
+    CD3DX12_DESCRIPTOR_RANGE texTable2;
+    texTable2.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3, 0);
+
     // Root parameter can be a table, root descriptor or root constants.
-    CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+    CD3DX12_ROOT_PARAMETER slotRootParameter[5];
 
     // Perfomance TIP: Order from most frequent to least frequent.
     slotRootParameter[0].InitAsConstantBufferView(0);
     slotRootParameter[1].InitAsConstants(1, 1);
     slotRootParameter[2].InitAsDescriptorTable(1, &texTable0, D3D12_SHADER_VISIBILITY_PIXEL);
     slotRootParameter[3].InitAsDescriptorTable(1, &texTable1, D3D12_SHADER_VISIBILITY_PIXEL);
+    slotRootParameter[4].InitAsDescriptorTable(1, &texTable2, D3D12_SHADER_VISIBILITY_PIXEL);
 
     const CD3DX12_STATIC_SAMPLER_DESC pointClamp(
         0, // shaderRegister
@@ -860,7 +880,7 @@ void SsaoApp::BuildSsaoRootSignature()
     };
 
     // A root signature is an array of root parameters.
-    CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+    CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(5, slotRootParameter,
         (UINT)staticSamplers.size(), staticSamplers.data(),
         D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -938,7 +958,7 @@ void SsaoApp::BuildDescriptorHeaps()
     mShadowMapHeapIndex = mSkyTexHeapIndex + 1;
     mSsaoHeapIndexStart = mShadowMapHeapIndex + 1;
     mSsaoAmbientMapIndex = mSsaoHeapIndexStart + 3;
-    mNullCubeSrvIndex = mSsaoHeapIndexStart + 5;
+    mNullCubeSrvIndex = mSsaoHeapIndexStart + 6;
     mNullTexSrvIndex1 = mNullCubeSrvIndex + 1;
     mNullTexSrvIndex2 = mNullTexSrvIndex1 + 1;
 
@@ -8,20 +8,7 @@
 #define ANIMATION_HELPER_H
 
 #include "../../Common/d3dUtil.h"
-
-///<summary>
-/// A Keyframe defines the bone transformation at an instant in time.
-///</summary>
-struct Keyframe
-{
-	Keyframe();
-	~Keyframe();
-
-    float TimePos;
-	DirectX::XMFLOAT3 Translation;
-    DirectX::XMFLOAT3 Scale;
-    DirectX::XMFLOAT4 RotationQuat;
-};
+#include "../../Common/KeyframeAnimation.h"
 
 ///<summary>
 /// A BoneAnimation is defined by a list of keyframes.  For time
@@ -39,6 +26,8 @@ struct BoneAnimation
 
 	std::vector<Keyframe> Keyframes; 	
 
+	KeyInterpolation Interpolation = KeyInterpolation::Linear;
+
 };
 
 #endif // ANIMATION_HELPER_H
\ No newline at end of file
@@ -0,0 +1,51 @@
+//***************************************************************************************
+// AllocationCounter.cpp
+//***************************************************************************************
+
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+#if defined(DEBUG) | defined(_DEBUG)
+
+namespace
+{
+	thread_local UINT64 gThreadAllocations = 0;
+}
+
+// The array and nothrow forms call these, so they are counted too.
+void* operator new(std::size_t size)
+{
+	++gThreadAllocations;
+
+	for(;;)
+	{
+		if(void* p = std::malloc(size == 0 ? 1 : size))
+			return p;
+
+		std::new_handler handler = std::get_new_handler();
+		if(handler == nullptr)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+void operator delete(void* p)noexcept
+{
+	std::free(p);
+}
+
+UINT64 ThreadAllocationCount()
+{
+	return gThreadAllocations;
+}
+
+#else
+
+UINT64 ThreadAllocationCount()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,15 @@
+//***************************************************************************************
+// AllocationCounter.h
+//
+// Debug builds replace the global operator new with one that counts the allocations
+// made by each thread, so code that must not allocate, like the per-frame animation
+// update, can assert that it did not.
+//***************************************************************************************
+
+#pragma once
+
+#include <Windows.h>
+
+// The number of heap allocations the calling thread has made through operator
+// new.  Always zero in release builds, which keep the default operator new.
+UINT64 ThreadAllocationCount();
@@ -0,0 +1,278 @@
+//***************************************************************************************
+// AnimationBlend.cpp
+//***************************************************************************************
+
+#include "AnimationBlend.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Loads the four quaternion channels of a group.
+	void LoadQuats(const BoneGroupPose& pose, XMVECTOR q[4])
+	{
+		for(int c = 0; c < 4; ++c)
+			q[c] = XMLoadFloat4A(&pose.RotationQuat[c]);
+	}
+
+	void NormalizeQuats(XMVECTOR q[4])
+	{
+		XMVECTOR lengthSq = q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3];
+		XMVECTOR invLength = XMVectorReciprocalSqrt(lengthSq);
+
+		for(int c = 0; c < 4; ++c)
+			q[c] = q[c]*invLength;
+	}
+
+	// Hamilton product p*q of four quaternion pairs, i.e. XMQuaternionMultiply(q, p):
+	// the rotation q followed by the rotation p.
+	void MultiplyQuats(const XMVECTOR p[4], const XMVECTOR q[4], XMVECTOR out[4])
+	{
+		out[0] = p[3]*q[0] + p[0]*q[3] + p[1]*q[2] - p[2]*q[1];
+		out[1] = p[3]*q[1] - p[0]*q[2] + p[1]*q[3] + p[2]*q[0];
+		out[2] = p[3]*q[2] + p[0]*q[1] - p[1]*q[0] + p[2]*q[3];
+		out[3] = p[3]*q[3] - p[0]*q[0] - p[1]*q[1] - p[2]*q[2];
+	}
+
+	// Cross-fades four bones from a to b.  Rotations use a normalized lerp along the
+	// shortest arc, which for blend weights (unlike keyframe interpolation) is the
+	// usual trade: no trigonometry, and the blend is commutative.
+	void LerpGroup(const BoneGroupPose& a, const BoneGroupPose& b, FXMVECTOR w, BoneGroupPose& out)
+	{
+		for(int c = 0; c < 3; ++c)
+		{
+			XMStoreFloat4A(&out.Translation[c],
+				XMVectorLerpV(XMLoadFloat4A(&a.Translation[c]), XMLoadFloat4A(&b.Translation[c]), w));
+			XMStoreFloat4A(&out.Scale[c],
+				XMVectorLerpV(XMLoadFloat4A(&a.Scale[c]), XMLoadFloat4A(&b.Scale[c]), w));
+		}
+
+		XMVECTOR qa[4];
+		XMVECTOR qb[4];
+		LoadQuats(a, qa);
+		LoadQuats(b, qb);
+
+		XMVECTOR dot = qa[0]*qb[0] + qa[1]*qb[1] + qa[2]*qb[2] + qa[3]*qb[3];
+		XMVECTOR wb = XMVectorSelect(w, -w, XMVectorLess(dot, XMVectorZero()));
+		XMVECTOR wa = XMVectorSplatOne() - w;
+
+		XMVECTOR q[4];
+		for(int c = 0; c < 4; ++c)
+			q[c] = qa[c]*wa + qb[c]*wb;
+
+		NormalizeQuats(q);
+
+		for(int c = 0; c < 4; ++c)
+			XMStoreFloat4A(&out.RotationQuat[c], q[c]);
+	}
+
+	// Applies the difference between additive and reference on top of base.  Translation
+	// differences are added, scale ratios multiplied, and the rotation difference
+	// (reference^-1 then additive, in the bone's local space) is applied before base.
+	void AddGroup(const BoneGroupPose& base, const BoneGroupPose& additive, const BoneGroupPose& reference,
+		FXMVECTOR w, BoneGroupPose& out)
+	{
+		const XMVECTOR one = XMVectorSplatOne();
+
+		for(int c = 0; c < 3; ++c)
+		{
+			XMVECTOR dT = XMLoadFloat4A(&additive.Translation[c]) - XMLoadFloat4A(&reference.Translation[c]);
+			XMStoreFloat4A(&out.Translation[c], XMVectorMultiplyAdd(dT, w, XMLoadFloat4A(&base.Translation[c])));
+
+			XMVECTOR dS = XMLoadFloat4A(&additive.Scale[c]) / XMLoadFloat4A(&reference.Scale[c]);
+			XMStoreFloat4A(&out.Scale[c], XMLoadFloat4A(&base.Scale[c])*XMVectorLerpV(one, dS, w));
+		}
+
+		XMVECTOR qBase[4];
+		XMVECTOR qAdd[4];
+		XMVECTOR qRefInv[4];
+		LoadQuats(base, qBase);
+		LoadQuats(additive, qAdd);
+		LoadQuats(reference, qRefInv);
+
+		// Unit quaternions: the inverse is the conjugate.
+		for(int c = 0; c < 3; ++c)
+			qRefInv[c] = -qRefInv[c];
+
+		XMVECTOR delta[4];
+		MultiplyQuats(qRefInv, qAdd, delta);
+
+		// Scale the delta rotation by nlerping from the identity, along the shortest arc.
+		XMVECTOR sign = XMVectorSelect(one, -one, XMVectorLess(delta[3], XMVectorZero()));
+		XMVECTOR wd = w*sign;
+		for(int c = 0; c < 3; ++c)
+			delta[c] = delta[c]*wd;
+		delta[3] = (one - w) + delta[3]*wd;
+
+		NormalizeQuats(delta);
+
+		XMVECTOR q[4];
+		MultiplyQuats(qBase, delta, q);
+
+		for(int c = 0; c < 4; ++c)
+			XMStoreFloat4A(&out.RotationQuat[c], q[c]);
+	}
+}
+
+BlendTree::BlendTree(const SkinnedData* skinnedInfo)
+	: mSkinnedInfo(skinnedInfo),
+	  mNumBones(skinnedInfo->BoneCount())
+{
+}
+
+int BlendTree::AddClip(ClipHandle clip, float timePos)
+{
+	assert(clip != InvalidClipHandle);
+
+	Node node;
+	node.Type = NodeType::Clip;
+	node.Clip = clip;
+	node.TimePos = timePos;
+	node.KeyframeCursors.assign(mNumBones, 0);
+
+	mNodes.push_back(std::move(node));
+	return (int)mNodes.size() - 1;
+}
+
+int BlendTree::AddLerp(int childA, int childB, float weight, int mask)
+{
+	Node node;
+	node.Type = NodeType::Lerp;
+	node.Children[0] = childA;
+	node.Children[1] = childB;
+	node.Weight = weight;
+	node.Mask = mask;
+
+	mNodes.push_back(std::move(node));
+	return (int)mNodes.size() - 1;
+}
+
+int BlendTree::AddAdditive(int base, int additive, float weight, int mask)
+{
+	assert(mNodes[additive].Type == NodeType::Clip);
+
+	Node node;
+	node.Type = NodeType::Additive;
+	node.Children[0] = base;
+	node.Children[1] = additive;
+	node.Weight = weight;
+	node.Mask = mask;
+
+	// The additive clip is measured against its own first frame.
+	ClipHandle clip = mNodes[additive].Clip;
+	std::vector<UINT> keyCursors(mNumBones, 0);
+	node.Reference.Resize(mNumBones);
+	mSkinnedInfo->GetClip(clip).Sample(mSkinnedInfo->GetClipStartTime(clip), node.Reference, keyCursors);
+
+	mNodes.push_back(std::move(node));
+	return (int)mNodes.size() - 1;
+}
+
+int BlendTree::AddMask(const std::vector<float>& boneWeights)
+{
+	assert(boneWeights.size() == mNumBones);
+
+	std::vector<XMFLOAT4A> mask((mNumBones + 3) / 4, XMFLOAT4A(0.0f, 0.0f, 0.0f, 0.0f));
+	for(UINT bone = 0; bone < mNumBones; ++bone)
+		(&mask[bone / 4].x)[bone % 4] = boneWeights[bone];
+
+	mMasks.push_back(std::move(mask));
+	return (int)mMasks.size() - 1;
+}
+
+void BlendTree::SetRoot(int node)
+{
+	mRoot = node;
+	mHeight = Height(node);
+}
+
+BlendTree::Node& BlendTree::GetNode(int node)
+{
+	return mNodes[node];
+}
+
+const BlendTree::Node& BlendTree::GetNode(int node)const
+{
+	return mNodes[node];
+}
+
+UINT BlendTree::Height(int node)const
+{
+	const Node& n = mNodes[node];
+	if(n.Type == NodeType::Clip)
+		return 1;
+
+	// Child A is evaluated in the node's own pose, child B one level down.
+	return MathHelper::Max(Height(n.Children[0]), 1 + Height(n.Children[1]));
+}
+
+void BlendTree::Evaluate(BlendScratch& scratch, BoneTransform3x4* finalTransforms)
+{
+	assert(mRoot != -1);
+
+	if(scratch.Poses.size() < mHeight)
+	{
+		scratch.Poses.resize(mHeight);
+		for(LocalPose& pose : scratch.Poses)
+			pose.Resize(mNumBones);
+	}
+
+	if(scratch.Matrices.ToParentTransforms.size() != mNumBones)
+		scratch.Matrices.Resize(mNumBones);
+
+	EvaluateNode(mRoot, 0, scratch);
+
+	// The hierarchy pass only runs once, on the blended pose.
+	mSkinnedInfo->GetFinalTransforms(scratch.Poses[0], scratch.Matrices, finalTransforms);
+}
+
+void BlendTree::EvaluateNode(int index, UINT level, BlendScratch& scratch)
+{
+	Node& node = mNodes[index];
+	LocalPose& pose = scratch.Poses[level];
+
+	if(node.Type == NodeType::Clip)
+	{
+		mSkinnedInfo->GetClip(node.Clip).Sample(node.TimePos, pose, node.KeyframeCursors);
+		return;
+	}
+
+	// A cross-fade that has fully settled on one side only needs that side.
+	if(node.Type == NodeType::Lerp && node.Mask == -1 && (node.Weight <= 0.0f || node.Weight >= 1.0f))
+	{
+		EvaluateNode(node.Children[node.Weight <= 0.0f ? 0 : 1], level, scratch);
+		return;
+	}
+
+	// An additive layer with no weight leaves the base pose unchanged.
+	if(node.Type == NodeType::Additive && node.Weight <= 0.0f)
+	{
+		EvaluateNode(node.Children[0], level, scratch);
+		return;
+	}
+
+	EvaluateNode(node.Children[0], level, scratch);
+	EvaluateNode(node.Children[1], level + 1, scratch);
+
+	const LocalPose& other = scratch.Poses[level + 1];
+
+	for(UINT g = 0; g < (UINT)pose.Groups.size(); ++g)
+	{
+		XMVECTOR w = GroupWeights(node, g);
+
+		if(node.Type == NodeType::Lerp)
+			LerpGroup(pose.Groups[g], other.Groups[g], w, pose.Groups[g]);
+		else
+			AddGroup(pose.Groups[g], other.Groups[g], node.Reference.Groups[g], w, pose.Groups[g]);
+	}
+}
+
+XMVECTOR BlendTree::GroupWeights(const Node& node, UINT group)const
+{
+	XMVECTOR w = XMVectorReplicate(node.Weight);
+
+	if(node.Mask != -1)
+		w = w*XMLoadFloat4A(&mMasks[node.Mask][group]);
+
+	return w;
+}
@@ -0,0 +1,115 @@
+//***************************************************************************************
+// AnimationBlend.h
+//
+// Blends several animation clips into one pose.  Clips are sampled, cross-faded and
+// layered in local TRS space (see LocalPose), four bones per SIMD operation, and the
+// hierarchy pass and bone offsets are applied once to the result.  That is cheaper
+// than evaluating the final transforms of every clip and blending matrices.
+//***************************************************************************************
+
+#pragma once
+
+#include "SkinnedData.h"
+
+///<summary>
+/// Working memory for BlendTree::Evaluate.  Like AnimationScratch, keep one per
+/// instance or per thread; BlendTree::Evaluate sizes it on first use.
+///</summary>
+struct BlendScratch
+{
+	AnimationScratch Matrices;
+
+	// One pose per level of the tree being evaluated.
+	std::vector<LocalPose> Poses;
+};
+
+///<summary>
+/// A small tree of blend nodes evaluated for one animated instance:
+///
+///   Clip:     samples a clip at its own time position.
+///   Lerp:     cross-fades from child A (weight 0) to child B (weight 1).
+///   Additive: adds the difference between an additive clip and that clip's first
+///             frame on top of a base pose, scaled by the weight.
+///
+/// Lerp and Additive nodes take an optional bone mask that scales the node weight
+/// per bone, e.g. to only play an upper body layer on the spine and arms.
+///
+/// The tree keeps each clip node's keyframe cursors, so one BlendTree belongs to
+/// one instance.  Build it once, then change node times and weights each frame.
+///</summary>
+class BlendTree
+{
+public:
+	enum class NodeType
+	{
+		Clip,
+		Lerp,
+		Additive
+	};
+
+	struct Node
+	{
+		NodeType Type = NodeType::Clip;
+
+		// Clip nodes.
+		ClipHandle Clip = InvalidClipHandle;
+		float TimePos = 0.0f;
+
+		// Lerp and Additive nodes.  Additive nodes blend Children[1] onto Children[0].
+		int Children[2] = { -1, -1 };
+		float Weight = 0.0f;
+		int Mask = -1;
+
+	private:
+		friend class BlendTree;
+
+		std::vector<UINT> KeyframeCursors;
+
+		// Additive nodes: the first frame of the additive clip, which the
+		// additive clip is measured against.
+		LocalPose Reference;
+	};
+
+	BlendTree(const SkinnedData* skinnedInfo);
+	BlendTree(const BlendTree& rhs) = delete;
+	BlendTree& operator=(const BlendTree& rhs) = delete;
+	~BlendTree() = default;
+
+	// Each Add returns the index of the new node.
+	int AddClip(ClipHandle clip, float timePos = 0.0f);
+	int AddLerp(int childA, int childB, float weight, int mask = -1);
+
+	// additive must be a Clip node.
+	int AddAdditive(int base, int additive, float weight, int mask = -1);
+
+	// boneWeights has one weight in [0, 1] per bone.  Returns the mask index.
+	int AddMask(const std::vector<float>& boneWeights);
+
+	void SetRoot(int node);
+
+	Node& GetNode(int node);
+	const Node& GetNode(int node)const;
+
+	// Evaluates the tree and writes BoneCount() final transforms.
+	void Evaluate(BlendScratch& scratch, BoneTransform3x4* finalTransforms);
+
+private:
+	// Evaluates the subtree of node into scratch.Poses[level].
+	void EvaluateNode(int node, UINT level, BlendScratch& scratch);
+
+	UINT Height(int node)const;
+
+	// Per group weight lanes: the node weight times the mask, if any.
+	DirectX::XMVECTOR GroupWeights(const Node& node, UINT group)const;
+
+private:
+	const SkinnedData* mSkinnedInfo = nullptr;
+	UINT mNumBones = 0;
+
+	std::vector<Node> mNodes;
+	int mRoot = -1;
+	UINT mHeight = 0;
+
+	// Each mask stores its bone weights in groups of four, like LocalPose.
+	std::vector<std::vector<DirectX::XMFLOAT4A>> mMasks;
+};
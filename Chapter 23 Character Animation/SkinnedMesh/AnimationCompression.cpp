@@ -0,0 +1,333 @@
+//***************************************************************************************
+// AnimationCompression.cpp
+//***************************************************************************************
+
+#include "AnimationCompression.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+AnimationCompressionReport AnimationCompressor::Compress(AnimationClip& clip,
+	const std::vector<int>& boneHierarchy,
+	const AnimationCompressionSettings& settings)
+{
+	assert(boneHierarchy.size() == clip.BoneAnimations.size());
+	assert(!clip.IsCompressed());
+
+	// Compressed tracks only interpolate linearly.
+	for(const BoneAnimation& bone : clip.BoneAnimations)
+		assert(bone.Interpolation == KeyInterpolation::Linear);
+
+	const UINT numBones = (UINT)clip.BoneAnimations.size();
+
+	AnimationCompressionReport report;
+
+	// levelStart has one entry per level plus one, and the root level has depth 0.
+	std::vector<UINT> order;
+	std::vector<UINT> levelStart;
+	SkinnedData::SortBonesByDepth(boneHierarchy, order, levelStart);
+	const UINT maxDepth = levelStart.size() > 1 ? (UINT)levelStart.size() - 2 : 0;
+
+	const float boneError = settings.MaxPositionError / (1.0f + maxDepth);
+	std::vector<float> reach = ComputeBoneReach(clip, boneHierarchy, settings.MinBoneReach);
+
+	// Keep the original keys to measure the result against.
+	AnimationClip original = clip;
+
+	for(UINT i = 0; i < numBones; ++i)
+	{
+		BoneAnimation& bone = clip.BoneAnimations[i];
+
+		report.RawBytes += bone.ByteSize();
+		report.RawKeyCount += (UINT)bone.Keyframes.size();
+
+		CompressBone(bone, boneError, reach[i], bone.Compressed);
+		std::vector<Keyframe>().swap(bone.Keyframes);
+
+		report.CompressedBytes += bone.ByteSize();
+		report.CompressedKeyCount += bone.Compressed.KeyCount();
+	}
+
+	// Drops the compiled keys, which would otherwise still hold the original data.
+	clip.Compile();
+
+	report.MaxPositionError = MeasureError(original, clip, boneHierarchy, reach);
+
+	return report;
+}
+
+std::vector<float> AnimationCompressor::ComputeBoneReach(const AnimationClip& clip,
+	const std::vector<int>& boneHierarchy, float minReach)
+{
+	const UINT numBones = (UINT)clip.BoneAnimations.size();
+
+	std::vector<UINT> order;
+	std::vector<UINT> levelStart;
+	SkinnedData::SortBonesByDepth(boneHierarchy, order, levelStart);
+
+	// The longest chain of bone lengths below each bone.  Walking the levels
+	// from the deepest up finishes every child before its parent.
+	std::vector<float> chainLength(numBones, 0.0f);
+	for(auto it = order.rbegin(); it != order.rend(); ++it)
+	{
+		UINT i = *it;
+		int parent = boneHierarchy[i];
+		if(parent < 0)
+			continue;
+
+		float boneLength = 0.0f;
+		for(const Keyframe& key : clip.BoneAnimations[i].Keyframes)
+		{
+			float length = XMVectorGetX(XMVector3Length(XMLoadFloat3(&key.Translation)));
+			boneLength = MathHelper::Max(boneLength, length);
+		}
+
+		chainLength[parent] = MathHelper::Max(chainLength[parent], chainLength[i] + boneLength);
+	}
+
+	for(float& length : chainLength)
+		length = MathHelper::Max(length, minReach);
+
+	return chainLength;
+}
+
+float AnimationCompressor::MeasureError(const AnimationClip& original, const AnimationClip& compressed,
+	const std::vector<int>& boneHierarchy, const std::vector<float>& boneReach)
+{
+	const UINT numBones = (UINT)original.BoneAnimations.size();
+
+	// Parents must be transformed to the root before their children.
+	std::vector<UINT> order;
+	std::vector<UINT> levelStart;
+	SkinnedData::SortBonesByDepth(boneHierarchy, order, levelStart);
+
+	// Every time at which some bone of the original had a key.
+	std::vector<float> times;
+	for(const BoneAnimation& bone : original.BoneAnimations)
+	{
+		for(const Keyframe& key : bone.Keyframes)
+			times.push_back(key.TimePos);
+	}
+	std::sort(times.begin(), times.end());
+	times.erase(std::unique(times.begin(), times.end()), times.end());
+
+	std::vector<XMFLOAT4X4> toParentA(numBones);
+	std::vector<XMFLOAT4X4> toParentB(numBones);
+	std::vector<XMFLOAT4X4> toRootA(numBones);
+	std::vector<XMFLOAT4X4> toRootB(numBones);
+
+	float maxError = 0.0f;
+
+	for(float t : times)
+	{
+		original.Interpolate(t, toParentA);
+		compressed.Interpolate(t, toParentB);
+
+		for(UINT i : order)
+		{
+			XMMATRIX toRootMatA = XMLoadFloat4x4(&toParentA[i]);
+			XMMATRIX toRootMatB = XMLoadFloat4x4(&toParentB[i]);
+
+			int parent = boneHierarchy[i];
+			if(parent >= 0)
+			{
+				toRootMatA = XMMatrixMultiply(toRootMatA, XMLoadFloat4x4(&toRootA[parent]));
+				toRootMatB = XMMatrixMultiply(toRootMatB, XMLoadFloat4x4(&toRootB[parent]));
+			}
+
+			XMStoreFloat4x4(&toRootA[i], toRootMatA);
+			XMStoreFloat4x4(&toRootB[i], toRootMatB);
+
+			// The joint itself and a point at the bone's reach along each axis.
+			const float r = boneReach[i];
+			const XMVECTOR points[4] =
+			{
+				XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+				XMVectorSet(r, 0.0f, 0.0f, 1.0f),
+				XMVectorSet(0.0f, r, 0.0f, 1.0f),
+				XMVectorSet(0.0f, 0.0f, r, 1.0f)
+			};
+
+			for(const XMVECTOR& p : points)
+			{
+				XMVECTOR a = XMVector3TransformCoord(p, toRootMatA);
+				XMVECTOR b = XMVector3TransformCoord(p, toRootMatB);
+				maxError = MathHelper::Max(maxError, XMVectorGetX(XMVector3Length(a - b)));
+			}
+		}
+	}
+
+	return maxError;
+}
+
+void AnimationCompressor::CompressBone(const BoneAnimation& bone, float maxError, float reach,
+	CompressedBoneTrack& track)
+{
+	const std::vector<Keyframe>& keys = bone.Keyframes;
+	const UINT numKeys = (UINT)keys.size();
+
+	// Quantize every key first, so that the reduction below measures the
+	// quantization error too.
+	CompressedBoneTrack full;
+	QuantizeTrack(keys, full);
+
+	std::vector<Keyframe> decoded(numKeys);
+	for(UINT i = 0; i < numKeys; ++i)
+		full.DecodeKey(i, decoded[i]);
+
+	// Can the keys strictly between a and b be dropped?
+	auto spanFits = [&](UINT a, UINT b)
+	{
+		const Keyframe& k0 = decoded[a];
+		const Keyframe& k1 = decoded[b];
+
+		for(UINT i = a + 1; i < b; ++i)
+		{
+			float lerpPercent = (keys[i].TimePos - k0.TimePos) / (k1.TimePos - k0.TimePos);
+
+			Keyframe key;
+			XMStoreFloat3(&key.Scale, XMVectorLerp(XMLoadFloat3(&k0.Scale), XMLoadFloat3(&k1.Scale), lerpPercent));
+			XMStoreFloat3(&key.Translation, XMVectorLerp(XMLoadFloat3(&k0.Translation), XMLoadFloat3(&k1.Translation), lerpPercent));
+			XMStoreFloat4(&key.RotationQuat, XMQuaternionSlerp(XMLoadFloat4(&k0.RotationQuat), XMLoadFloat4(&k1.RotationQuat), lerpPercent));
+
+			if(KeyError(keys[i], key, reach) > maxError)
+				return false;
+		}
+
+		return true;
+	};
+
+	// The first and last keys are always kept, so the clip length is unchanged.
+	std::vector<UINT> kept;
+	kept.push_back(0);
+	for(UINT a = 0; a + 1 < numKeys; )
+	{
+		UINT b = a + 1;
+		while(b + 1 < numKeys && spanFits(a, b + 1))
+			++b;
+
+		kept.push_back(b);
+		a = b;
+	}
+
+	track = CompressedBoneTrack();
+	track.TranslationMin = full.TranslationMin;
+	track.TranslationExtent = full.TranslationExtent;
+	track.ScaleMin = full.ScaleMin;
+	track.ScaleExtent = full.ScaleExtent;
+
+	for(UINT i : kept)
+	{
+		if(i >= numKeys)
+			break;
+
+		track.KeyTimes.push_back(full.KeyTimes[i]);
+		for(UINT c = 0; c < 3; ++c)
+		{
+			track.Translations.push_back(full.Translations[i*3 + c]);
+			track.Scales.push_back(full.Scales[i*3 + c]);
+			track.Rotations.push_back(full.Rotations[i*3 + c]);
+		}
+	}
+}
+
+float AnimationCompressor::KeyError(const Keyframe& a, const Keyframe& b, float reach)
+{
+	float translationError = XMVectorGetX(XMVector3Length(
+		XMLoadFloat3(&a.Translation) - XMLoadFloat3(&b.Translation)));
+
+	XMVECTOR ds = XMVectorAbs(XMLoadFloat3(&a.Scale) - XMLoadFloat3(&b.Scale));
+	float scaleError = reach*MathHelper::Max(XMVectorGetX(ds), MathHelper::Max(XMVectorGetY(ds), XMVectorGetZ(ds)));
+
+	// Rotating by the angle theta between the two rotations moves a point at
+	// distance reach by 2*reach*sin(theta/2) = 2*reach*sqrt(1 - dot^2).
+	float dot = fabsf(XMVectorGetX(XMQuaternionDot(XMLoadFloat4(&a.RotationQuat), XMLoadFloat4(&b.RotationQuat))));
+	dot = MathHelper::Min(dot, 1.0f);
+	float rotationError = 2.0f*reach*sqrtf(1.0f - dot*dot);
+
+	return translationError + scaleError + rotationError;
+}
+
+void AnimationCompressor::QuantizeTrack(const std::vector<Keyframe>& keys, CompressedBoneTrack& track)
+{
+	const UINT numKeys = (UINT)keys.size();
+
+	XMVECTOR tMin = XMVectorReplicate(+MathHelper::Infinity);
+	XMVECTOR tMax = XMVectorReplicate(-MathHelper::Infinity);
+	XMVECTOR sMin = tMin;
+	XMVECTOR sMax = tMax;
+	for(const Keyframe& key : keys)
+	{
+		tMin = XMVectorMin(tMin, XMLoadFloat3(&key.Translation));
+		tMax = XMVectorMax(tMax, XMLoadFloat3(&key.Translation));
+		sMin = XMVectorMin(sMin, XMLoadFloat3(&key.Scale));
+		sMax = XMVectorMax(sMax, XMLoadFloat3(&key.Scale));
+	}
+
+	XMStoreFloat3(&track.TranslationMin, tMin);
+	XMStoreFloat3(&track.TranslationExtent, tMax - tMin);
+	XMStoreFloat3(&track.ScaleMin, sMin);
+	XMStoreFloat3(&track.ScaleExtent, sMax - sMin);
+
+	auto quantize = [](float v, float minValue, float extent)
+	{
+		if(extent <= 0.0f)
+			return (std::uint16_t)0;
+
+		float q = (v - minValue) / extent * 65535.0f + 0.5f;
+		return (std::uint16_t)MathHelper::Clamp(q, 0.0f, 65535.0f);
+	};
+
+	track.KeyTimes.resize(numKeys);
+	track.Translations.resize(numKeys*3);
+	track.Scales.resize(numKeys*3);
+	track.Rotations.resize(numKeys*3);
+
+	for(UINT i = 0; i < numKeys; ++i)
+	{
+		const Keyframe& key = keys[i];
+		track.KeyTimes[i] = key.TimePos;
+
+		const float* t = &key.Translation.x;
+		const float* tm = &track.TranslationMin.x;
+		const float* te = &track.TranslationExtent.x;
+		const float* s = &key.Scale.x;
+		const float* sm = &track.ScaleMin.x;
+		const float* se = &track.ScaleExtent.x;
+		for(UINT c = 0; c < 3; ++c)
+		{
+			track.Translations[i*3 + c] = quantize(t[c], tm[c], te[c]);
+			track.Scales[i*3 + c] = quantize(s[c], sm[c], se[c]);
+		}
+
+		// Smallest three: drop the largest component, made positive (q and -q
+		// are the same rotation), and store the others, which then lie in
+		// [-1/sqrt(2), 1/sqrt(2)], with 15 bits each.
+		XMFLOAT4 quat;
+		XMStoreFloat4(&quat, XMQuaternionNormalize(XMLoadFloat4(&key.RotationQuat)));
+		float* q = &quat.x;
+
+		UINT largest = 0;
+		for(UINT c = 1; c < 4; ++c)
+		{
+			if(fabsf(q[c]) > fabsf(q[largest]))
+				largest = c;
+		}
+
+		const float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+		const float range = 0.70710678f;
+
+		std::uint16_t* r = &track.Rotations[i*3];
+		for(UINT c = 0, j = 0; c < 4; ++c)
+		{
+			if(c == largest)
+				continue;
+
+			float v = (sign*q[c] / range + 1.0f)*0.5f*32767.0f + 0.5f;
+			r[j++] = (std::uint16_t)MathHelper::Clamp(v, 0.0f, 32767.0f);
+		}
+
+		r[0] |= (std::uint16_t)((largest & 1) << 15);
+		r[1] |= (std::uint16_t)((largest >> 1) << 15);
+	}
+}
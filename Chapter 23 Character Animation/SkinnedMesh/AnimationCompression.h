@@ -0,0 +1,76 @@
+//***************************************************************************************
+// AnimationCompression.h
+//
+// Offline compression of animation clips.  Keys that interpolation can reproduce
+// within an error budget are dropped, and the remaining keys are quantized into a
+// CompressedBoneTrack (see SkinnedData.h), which BoneAnimation::Interpolate decodes.
+//***************************************************************************************
+
+#pragma once
+
+#include "SkinnedData.h"
+
+struct AnimationCompressionSettings
+{
+	// Largest allowed displacement, in model space units, of any joint or of
+	// any point within a bone's reach.
+	float MaxPositionError = 0.001f;
+
+	// Lower bound on how far a bone's rotation reaches, so that rotation errors
+	// of leaf bones, which carry skin but no child joints, are still measured.
+	float MinBoneReach = 0.1f;
+};
+
+struct AnimationCompressionReport
+{
+	std::size_t RawBytes = 0;
+	std::size_t CompressedBytes = 0;
+
+	UINT RawKeyCount = 0;
+	UINT CompressedKeyCount = 0;
+
+	// Largest model space displacement of a joint or reach point between the
+	// original and the compressed clip, measured at every original key time.
+	float MaxPositionError = 0.0f;
+};
+
+///<summary>
+/// Errors add up down the hierarchy: a bone inherits the errors of all its
+/// ancestors.  To keep every joint within MaxPositionError, each bone gets
+/// MaxPositionError/(1 + maxDepth), where maxDepth is the depth of the deepest
+/// bone.  A bone's local error is measured as the displacement it causes at its
+/// reach, the distance to its farthest descendant joint: translation errors move
+/// everything directly, rotation and scale errors move points in proportion to
+/// their distance from the joint.
+///
+/// Keys are reduced greedily: starting from a kept key, the next kept key is the
+/// farthest one such that interpolating the quantized keys reproduces all the
+/// original keys in between within the budget.
+///</summary>
+class AnimationCompressor
+{
+public:
+	// Compresses every bone of clip in place.  boneHierarchy gives the parent
+	// index of every bone, as in SkinnedData::Set.
+	static AnimationCompressionReport Compress(AnimationClip& clip,
+		const std::vector<int>& boneHierarchy,
+		const AnimationCompressionSettings& settings = AnimationCompressionSettings());
+
+	// Largest model space displacement between two clips of the same skeleton.
+	static float MeasureError(const AnimationClip& original, const AnimationClip& compressed,
+		const std::vector<int>& boneHierarchy, const std::vector<float>& boneReach);
+
+	// For every bone, the distance to its farthest descendant joint over the
+	// whole clip, but at least minReach.
+	static std::vector<float> ComputeBoneReach(const AnimationClip& clip,
+		const std::vector<int>& boneHierarchy, float minReach);
+
+private:
+	static void CompressBone(const BoneAnimation& bone, float maxError, float reach,
+		CompressedBoneTrack& track);
+
+	// Displacement at distance reach caused by using b in place of a.
+	static float KeyError(const Keyframe& a, const Keyframe& b, float reach);
+
+	static void QuantizeTrack(const std::vector<Keyframe>& keys, CompressedBoneTrack& track);
+};
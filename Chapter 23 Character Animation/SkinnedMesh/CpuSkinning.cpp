@@ -0,0 +1,215 @@
+//***************************************************************************************
+// CpuSkinning.cpp
+//***************************************************************************************
+
+#include "CpuSkinning.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Transforms (p, 1) or (n, 0) by the final transform M: with the
+	// transposed rows of BoneTransform3x4, each output component is one dot
+	// product.
+	XMVECTOR TransformByRows(FXMVECTOR v, FXMVECTOR row0, FXMVECTOR row1, GXMVECTOR row2)
+	{
+		XMVECTOR x = XMVector4Dot(v, row0);
+		XMVECTOR y = XMVector4Dot(v, row1);
+		XMVECTOR z = XMVector4Dot(v, row2);
+
+		return XMVectorSelect(XMVectorSelect(z, y, g_XMSelect1100.v), x, g_XMSelect1000.v);
+	}
+
+	void StoreVertex(CpuSkinnedVertices& out, UINT i, FXMVECTOR p, FXMVECTOR n)
+	{
+		XMFLOAT3 position;
+		XMFLOAT3 normal;
+		XMStoreFloat3(&position, p);
+		XMStoreFloat3(&normal, XMVector3Normalize(n));
+
+		out.PosX[i] = position.x;
+		out.PosY[i] = position.y;
+		out.PosZ[i] = position.z;
+
+		out.NormalX[i] = normal.x;
+		out.NormalY[i] = normal.y;
+		out.NormalZ[i] = normal.z;
+	}
+}
+
+XMFLOAT3 CpuSkinnedVertices::Position(UINT i)const
+{
+	return XMFLOAT3(PosX[i], PosY[i], PosZ[i]);
+}
+
+XMFLOAT3 CpuSkinnedVertices::Normal(UINT i)const
+{
+	return XMFLOAT3(NormalX[i], NormalY[i], NormalZ[i]);
+}
+
+CpuSkinner::CpuSkinner(const std::vector<M3DLoader::SkinnedVertex>& vertices)
+{
+	mVertices.resize(vertices.size());
+
+	for(UINT i = 0; i < (UINT)vertices.size(); ++i)
+	{
+		const M3DLoader::SkinnedVertex& v = vertices[i];
+		BindVertex& bind = mVertices[i];
+
+		bind.Position = XMFLOAT4A(v.Pos.x, v.Pos.y, v.Pos.z, 1.0f);
+		bind.Normal = XMFLOAT4A(v.Normal.x, v.Normal.y, v.Normal.z, 0.0f);
+
+		// The fourth weight is implied, as in the vertex shaders.
+		float w3 = 1.0f - v.BoneWeights.x - v.BoneWeights.y - v.BoneWeights.z;
+		bind.Weights = XMFLOAT4A(v.BoneWeights.x, v.BoneWeights.y, v.BoneWeights.z, w3);
+
+		for(int k = 0; k < 4; ++k)
+			bind.BoneIndices[k] = v.BoneIndices[k];
+	}
+}
+
+UINT CpuSkinner::VertexCount()const
+{
+	return (UINT)mVertices.size();
+}
+
+void CpuSkinner::Skin(const BoneTransform3x4* palette, UINT numBones, Mode mode,
+	CpuSkinnedVertices& out)const
+{
+	const UINT numVertices = (UINT)mVertices.size();
+	const UINT paddedCount = (numVertices + 3) & ~3u;
+
+	if(out.PosX.size() != paddedCount)
+	{
+		out.PosX.assign(paddedCount, 0.0f);
+		out.PosY.assign(paddedCount, 0.0f);
+		out.PosZ.assign(paddedCount, 0.0f);
+		out.NormalX.assign(paddedCount, 0.0f);
+		out.NormalY.assign(paddedCount, 0.0f);
+		out.NormalZ.assign(paddedCount, 0.0f);
+	}
+	out.VertexCount = numVertices;
+
+	if(mode == Mode::DualQuaternion)
+	{
+		// Convert every bone once, rather than once per influence.
+		out.BoneDualQuats.resize(2*numBones);
+		for(UINT b = 0; b < numBones; ++b)
+		{
+			const BoneTransform3x4& M = palette[b];
+
+			XMMATRIX T(
+				XMLoadFloat4(&M.Rows[0]),
+				XMLoadFloat4(&M.Rows[1]),
+				XMLoadFloat4(&M.Rows[2]),
+				g_XMIdentityR3.v);
+			XMMATRIX boneTransform = XMMatrixTranspose(T);
+
+			XMVECTOR real = XMQuaternionNormalize(XMQuaternionRotationMatrix(boneTransform));
+
+			// dual = 0.5*t*real, with t the translation as a pure quaternion.
+			XMVECTOR t = XMVectorAndInt(boneTransform.r[3], g_XMMask3.v);
+			XMVECTOR dual = XMQuaternionMultiply(real, t)*0.5f;
+
+			XMStoreFloat4A(&out.BoneDualQuats[2*b + 0], real);
+			XMStoreFloat4A(&out.BoneDualQuats[2*b + 1], dual);
+		}
+	}
+
+	const XMFLOAT4A* dualQuats = out.BoneDualQuats.data();
+
+	concurrency::parallel_for(0u, numVertices, ChunkSize, [&](UINT first)
+	{
+		UINT last = MathHelper::Min(first + ChunkSize, numVertices);
+
+		if(mode == Mode::DualQuaternion)
+			SkinDualQuaternion(dualQuats, first, last, out);
+		else
+			SkinLinear(palette, first, last, out);
+	});
+}
+
+void CpuSkinner::SkinLinear(const BoneTransform3x4* palette, UINT first, UINT last,
+	CpuSkinnedVertices& out)const
+{
+	for(UINT i = first; i < last; ++i)
+	{
+		const BindVertex& v = mVertices[i];
+		XMVECTOR weights = XMLoadFloat4A(&v.Weights);
+
+		// Blend the bone matrices, then transform once.  This is the same as
+		// blending the transformed points, as the vertex shaders do.
+		XMVECTOR row0 = XMVectorZero();
+		XMVECTOR row1 = XMVectorZero();
+		XMVECTOR row2 = XMVectorZero();
+
+		const XMVECTOR w[4] =
+		{
+			XMVectorSplatX(weights),
+			XMVectorSplatY(weights),
+			XMVectorSplatZ(weights),
+			XMVectorSplatW(weights)
+		};
+
+		for(int k = 0; k < 4; ++k)
+		{
+			const BoneTransform3x4& M = palette[v.BoneIndices[k]];
+			row0 = XMVectorMultiplyAdd(w[k], XMLoadFloat4(&M.Rows[0]), row0);
+			row1 = XMVectorMultiplyAdd(w[k], XMLoadFloat4(&M.Rows[1]), row1);
+			row2 = XMVectorMultiplyAdd(w[k], XMLoadFloat4(&M.Rows[2]), row2);
+		}
+
+		XMVECTOR p = TransformByRows(XMLoadFloat4A(&v.Position), row0, row1, row2);
+		XMVECTOR n = TransformByRows(XMLoadFloat4A(&v.Normal), row0, row1, row2);
+
+		StoreVertex(out, i, p, n);
+	}
+}
+
+void CpuSkinner::SkinDualQuaternion(const XMFLOAT4A* dualQuats, UINT first, UINT last,
+	CpuSkinnedVertices& out)const
+{
+	for(UINT i = first; i < last; ++i)
+	{
+		const BindVertex& v = mVertices[i];
+		XMVECTOR weights = XMLoadFloat4A(&v.Weights);
+
+		const XMVECTOR w[4] =
+		{
+			XMVectorSplatX(weights),
+			XMVectorSplatY(weights),
+			XMVectorSplatZ(weights),
+			XMVectorSplatW(weights)
+		};
+
+		XMVECTOR pivot = XMLoadFloat4A(&dualQuats[2*v.BoneIndices[0]]);
+
+		XMVECTOR real = XMVectorZero();
+		XMVECTOR dual = XMVectorZero();
+		for(int k = 0; k < 4; ++k)
+		{
+			XMVECTOR r = XMLoadFloat4A(&dualQuats[2*v.BoneIndices[k] + 0]);
+			XMVECTOR d = XMLoadFloat4A(&dualQuats[2*v.BoneIndices[k] + 1]);
+
+			// q and -q are the same rotation; blend along the shortest path.
+			XMVECTOR sign = XMVectorSelect(g_XMOne.v, g_XMNegativeOne.v,
+				XMVectorLess(XMQuaternionDot(r, pivot), XMVectorZero()));
+			XMVECTOR ws = w[k]*sign;
+
+			real = XMVectorMultiplyAdd(ws, r, real);
+			dual = XMVectorMultiplyAdd(ws, d, dual);
+		}
+
+		XMVECTOR invLength = XMVectorReciprocalSqrt(XMQuaternionLengthSq(real));
+		real = real*invLength;
+		dual = dual*invLength;
+
+		// translation = 2*dual*conjugate(real).
+		XMVECTOR t = XMQuaternionMultiply(XMQuaternionConjugate(real), dual)*2.0f;
+
+		XMVECTOR p = XMVector3Rotate(XMLoadFloat4A(&v.Position), real) + t;
+		XMVECTOR n = XMVector3Rotate(XMLoadFloat4A(&v.Normal), real);
+
+		StoreVertex(out, i, p, n);
+	}
+}
@@ -0,0 +1,85 @@
+//***************************************************************************************
+// CpuSkinning.h
+//
+// Skins a mesh on the CPU with the same bone palette the vertex shaders use, for
+// systems that need the deformed mesh rather than the bind pose: picking, bounds,
+// shadow caster culling, physics.  Vertices are processed in parallel chunks, one
+// vertex per SIMD operation, and the results are written as separate x, y and z
+// arrays so that consumers can load four vertices at a time.
+//***************************************************************************************
+
+#pragma once
+
+#include "LoadM3d.h"
+#include <ppl.h>
+
+///<summary>
+/// The output of CpuSkinner::Skin for one character.  Each array holds
+/// VertexCount entries, padded with zeros to a multiple of four.
+///</summary>
+struct CpuSkinnedVertices
+{
+	DirectX::XMFLOAT3 Position(UINT i)const;
+	DirectX::XMFLOAT3 Normal(UINT i)const;
+
+	UINT VertexCount = 0;
+
+	std::vector<float> PosX;
+	std::vector<float> PosY;
+	std::vector<float> PosZ;
+
+	std::vector<float> NormalX;
+	std::vector<float> NormalY;
+	std::vector<float> NormalZ;
+
+	// Working memory for dual quaternion skinning: the real and dual part of
+	// every bone's transform.
+	std::vector<DirectX::XMFLOAT4A> BoneDualQuats;
+};
+
+class CpuSkinner
+{
+public:
+	enum class Mode
+	{
+		// Blends the bone matrices, like the vertex shaders.
+		LinearBlend,
+
+		// Blends the bones as dual quaternions, which keeps the volume around
+		// twisting joints.  Bone scale is ignored in this mode.
+		DualQuaternion
+	};
+
+	CpuSkinner(const std::vector<M3DLoader::SkinnedVertex>& vertices);
+	CpuSkinner(const CpuSkinner& rhs) = delete;
+	CpuSkinner& operator=(const CpuSkinner& rhs) = delete;
+	~CpuSkinner() = default;
+
+	UINT VertexCount()const;
+
+	// Deforms the bind pose with palette, which holds numBones final transforms
+	// as returned by SkinnedData::GetFinalTransforms.  The skinner itself is not
+	// modified, so several characters sharing one mesh can be skinned at once.
+	void Skin(const BoneTransform3x4* palette, UINT numBones, Mode mode,
+		CpuSkinnedVertices& out)const;
+
+private:
+	void SkinLinear(const BoneTransform3x4* palette, UINT first, UINT last,
+		CpuSkinnedVertices& out)const;
+	void SkinDualQuaternion(const DirectX::XMFLOAT4A* dualQuats, UINT first, UINT last,
+		CpuSkinnedVertices& out)const;
+
+	struct BindVertex
+	{
+		DirectX::XMFLOAT4A Position; // w = 1
+		DirectX::XMFLOAT4A Normal;   // w = 0
+		DirectX::XMFLOAT4A Weights;  // all four weights, summing to one
+		BYTE BoneIndices[4];
+	};
+
+private:
+	// Vertices per parallel task.
+	static const UINT ChunkSize = 1024;
+
+	std::vector<BindVertex> mVertices;
+};
@@ -0,0 +1,163 @@
+//***************************************************************************************
+// PoseCache.cpp
+//***************************************************************************************
+
+#include "PoseCache.h"
+#include <cstring>
+
+using namespace DirectX;
+
+float PoseCache::Stats::HitRate()const
+{
+	UINT64 lookups = Hits + Misses;
+	return lookups > 0 ? (float)Hits / lookups : 0.0f;
+}
+
+double PoseCache::Stats::EstimatedSecondsSaved()const
+{
+	if(EvaluatedPoses == 0)
+		return 0.0;
+
+	return Hits*(EvaluationSeconds / EvaluatedPoses);
+}
+
+PoseCache::PoseCache(const SkinnedData* skinnedInfo, UINT capacity, float sampleRate)
+	: mSkinnedInfo(skinnedInfo),
+	  mNumBones(skinnedInfo->BoneCount()),
+	  mCapacity(capacity),
+	  mSampleRate(sampleRate)
+{
+	assert(capacity > 0);
+
+	// The palettes are allocated up front and reused by eviction.
+	mSlots.reserve(capacity);
+	mPalettes.resize(capacity*mNumBones, BoneTransform3x4::Identity());
+	mSlotIndices.reserve(capacity);
+}
+
+float PoseCache::QuantizeTime(float timePos)const
+{
+	if(mSampleRate <= 0.0f)
+		return timePos;
+
+	return floorf(timePos*mSampleRate + 0.5f) / mSampleRate;
+}
+
+UINT64 PoseCache::MakeKey(ClipHandle clip, float timePos)const
+{
+	UINT tick = 0;
+	if(mSampleRate > 0.0f)
+	{
+		tick = (UINT)(INT)floorf(timePos*mSampleRate + 0.5f);
+	}
+	else
+	{
+		static_assert(sizeof(tick) == sizeof(timePos), "float and UINT sizes differ");
+		std::memcpy(&tick, &timePos, sizeof(tick));
+	}
+
+	return ((UINT64)(UINT)clip << 32) | tick;
+}
+
+void PoseCache::BeginFrame()
+{
+	++mFrame;
+}
+
+BoneTransform3x4* PoseCache::Acquire(ClipHandle clip, float timePos, bool& evaluate)
+{
+	UINT64 key = MakeKey(clip, timePos);
+
+	auto it = mSlotIndices.find(key);
+	if(it != mSlotIndices.end())
+	{
+		Slot& slot = mSlots[it->second];
+		slot.LastUsedFrame = mFrame;
+		mLru.splice(mLru.begin(), mLru, slot.LruPosition);
+
+		++mStats.Hits;
+		evaluate = false;
+		return &mPalettes[it->second*mNumBones];
+	}
+
+	++mStats.Misses;
+
+	UINT index = 0;
+	if(mSlots.size() < mCapacity)
+	{
+		index = (UINT)mSlots.size();
+		mSlots.push_back(Slot());
+		mLru.push_front(index);
+		mSlots[index].LruPosition = mLru.begin();
+	}
+	else
+	{
+		// Every use moves a slot to the front, so if the least recently used
+		// slot was used this frame, all of them were.
+		index = mLru.back();
+		if(mSlots[index].LastUsedFrame == mFrame)
+		{
+			++mStats.Overflows;
+			evaluate = false;
+			return nullptr;
+		}
+
+		mSlotIndices.erase(mSlots[index].Key);
+		mLru.splice(mLru.begin(), mLru, mSlots[index].LruPosition);
+		++mStats.Evictions;
+	}
+
+	Slot& slot = mSlots[index];
+	slot.Key = key;
+	slot.LastUsedFrame = mFrame;
+	mSlotIndices[key] = index;
+
+	evaluate = true;
+	return &mPalettes[index*mNumBones];
+}
+
+const BoneTransform3x4* PoseCache::GetFinalTransforms(ClipHandle clip, float timePos,
+	AnimationScratch& scratch, std::vector<UINT>& keyCursors)
+{
+	bool evaluate = false;
+	BoneTransform3x4* palette = Acquire(clip, timePos, evaluate);
+
+	if(evaluate)
+	{
+		__int64 countsPerSec = 0;
+		__int64 startTime = 0;
+		__int64 endTime = 0;
+		QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+		QueryPerformanceCounter((LARGE_INTEGER*)&startTime);
+
+		mSkinnedInfo->GetFinalTransforms(clip, QuantizeTime(timePos), scratch, keyCursors, palette);
+
+		QueryPerformanceCounter((LARGE_INTEGER*)&endTime);
+		RecordEvaluation(1, (double)(endTime - startTime) / countsPerSec);
+	}
+
+	return palette;
+}
+
+void PoseCache::RecordEvaluation(UINT64 poses, double seconds)
+{
+	mStats.EvaluatedPoses += poses;
+	mStats.EvaluationSeconds += seconds;
+}
+
+const PoseCache::Stats& PoseCache::GetStats()const
+{
+	return mStats;
+}
+
+void PoseCache::ResetStats()
+{
+	mStats = Stats();
+}
+
+void PoseCache::Clear()
+{
+	mSlots.clear();
+	mLru.clear();
+	mSlotIndices.clear();
+}
@@ -0,0 +1,96 @@
+//***************************************************************************************
+// PoseCache.h
+//
+// Caches final bone transforms by (clip, time), so that instances playing the same
+// clip at the same time share one evaluated palette.  With a fixed sample rate, the
+// time is rounded to the sample grid, which lets instances that are almost in
+// lockstep share poses too.
+//***************************************************************************************
+
+#pragma once
+
+#include "SkinnedData.h"
+#include <list>
+
+class PoseCache
+{
+public:
+	struct Stats
+	{
+		UINT64 Hits = 0;
+		UINT64 Misses = 0;
+		UINT64 Evictions = 0;
+
+		// Misses that could not get a slot because every slot was in use this frame.
+		UINT64 Overflows = 0;
+
+		// Poses evaluated for the cache, and the time it took.
+		UINT64 EvaluatedPoses = 0;
+		double EvaluationSeconds = 0.0;
+
+		float HitRate()const;
+
+		// Time the hits would have cost at the measured cost of a pose.
+		double EstimatedSecondsSaved()const;
+	};
+
+	// capacity is the number of palettes kept.  A sampleRate of zero keys the
+	// cache on the exact time.
+	PoseCache(const SkinnedData* skinnedInfo, UINT capacity, float sampleRate = 0.0f);
+	PoseCache(const PoseCache& rhs) = delete;
+	PoseCache& operator=(const PoseCache& rhs) = delete;
+	~PoseCache() = default;
+
+	// The time that the pose for timePos is evaluated at.
+	float QuantizeTime(float timePos)const;
+
+	// Starts a new frame.  Slots used during the current frame are never evicted,
+	// so palettes returned by Acquire stay valid until the next BeginFrame.
+	void BeginFrame();
+
+	// Returns the palette (BoneCount() matrices) for the pose of clip at timePos.
+	// When evaluate is set, the palette is new and the caller must fill it for
+	// QuantizeTime(timePos) before anyone reads it.  Returns nullptr when every
+	// slot is already in use this frame.
+	BoneTransform3x4* Acquire(ClipHandle clip, float timePos, bool& evaluate);
+
+	// Convenience for single callers: Acquire, evaluating the pose on a miss.
+	// Returns nullptr when the cache is full for this frame.
+	const BoneTransform3x4* GetFinalTransforms(ClipHandle clip, float timePos,
+		AnimationScratch& scratch, std::vector<UINT>& keyCursors);
+
+	// Adds to the evaluation cost statistics.
+	void RecordEvaluation(UINT64 poses, double seconds);
+
+	const Stats& GetStats()const;
+	void ResetStats();
+
+	void Clear();
+
+private:
+	UINT64 MakeKey(ClipHandle clip, float timePos)const;
+
+	struct Slot
+	{
+		UINT64 Key = 0;
+		UINT64 LastUsedFrame = 0;
+		std::list<UINT>::iterator LruPosition;
+	};
+
+private:
+	const SkinnedData* mSkinnedInfo = nullptr;
+	UINT mNumBones = 0;
+	UINT mCapacity = 0;
+	float mSampleRate = 0.0f;
+
+	UINT64 mFrame = 1;
+
+	std::vector<Slot> mSlots;
+	std::vector<BoneTransform3x4> mPalettes;
+
+	// Slot indices, most recently used first.
+	std::list<UINT> mLru;
+	std::unordered_map<UINT64, UINT> mSlotIndices;
+
+	Stats mStats;
+};
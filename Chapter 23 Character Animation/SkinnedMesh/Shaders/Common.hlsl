@@ -64,7 +64,8 @@ cbuffer cbPerObject : register(b0)
 
 cbuffer cbSkinned : register(b1)
 {
-    float4x4 gBoneTransforms[96];
+    // Bone transforms are affine, so their constant last column is not sent.
+    float4x3 gBoneTransforms[96];
 };
 
 // Constant data that varies per material.
@@ -0,0 +1,100 @@
+//***************************************************************************************
+// SkinnedBounds.cpp
+//***************************************************************************************
+
+#include "SkinnedBounds.h"
+
+using namespace DirectX;
+
+SkinnedBounds::SkinnedBounds(const std::vector<M3DLoader::SkinnedVertex>& vertices, UINT numBones)
+{
+	XMVECTOR vMin0 = XMVectorReplicate(+MathHelper::Infinity);
+	XMVECTOR vMax0 = XMVectorReplicate(-MathHelper::Infinity);
+
+	std::vector<XMVECTOR> boneMin(numBones, vMin0);
+	std::vector<XMVECTOR> boneMax(numBones, vMax0);
+	std::vector<bool> used(numBones, false);
+
+	for(const M3DLoader::SkinnedVertex& v : vertices)
+	{
+		// The fourth weight is implied, as in the vertex shaders.
+		const float weights[4] =
+		{
+			v.BoneWeights.x,
+			v.BoneWeights.y,
+			v.BoneWeights.z,
+			1.0f - v.BoneWeights.x - v.BoneWeights.y - v.BoneWeights.z
+		};
+
+		XMVECTOR P = XMLoadFloat3(&v.Pos);
+
+		for(int k = 0; k < 4; ++k)
+		{
+			if(weights[k] <= 0.0f)
+				continue;
+
+			UINT bone = v.BoneIndices[k];
+			boneMin[bone] = XMVectorMin(boneMin[bone], P);
+			boneMax[bone] = XMVectorMax(boneMax[bone], P);
+			used[bone] = true;
+		}
+	}
+
+	for(UINT bone = 0; bone < numBones; ++bone)
+	{
+		if(!used[bone])
+			continue;
+
+		BoneBox box;
+		XMStoreFloat4A(&box.Center, XMVectorSetW(0.5f*(boneMin[bone] + boneMax[bone]), 1.0f));
+		XMStoreFloat4A(&box.Extents, XMVectorSetW(0.5f*(boneMax[bone] - boneMin[bone]), 0.0f));
+		box.Bone = bone;
+
+		mBoxes.push_back(box);
+	}
+}
+
+UINT SkinnedBounds::BoxCount()const
+{
+	return (UINT)mBoxes.size();
+}
+
+void SkinnedBounds::ComputeBounds(const BoneTransform3x4* palette, BoundingBox& bounds)const
+{
+	XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+	XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+
+	for(const BoneBox& box : mBoxes)
+	{
+		const BoneTransform3x4& M = palette[box.Bone];
+		XMVECTOR row0 = XMLoadFloat4(&M.Rows[0]);
+		XMVECTOR row1 = XMLoadFloat4(&M.Rows[1]);
+		XMVECTOR row2 = XMLoadFloat4(&M.Rows[2]);
+
+		XMVECTOR C = XMLoadFloat4A(&box.Center);
+		XMVECTOR E = XMLoadFloat4A(&box.Extents);
+
+		// The rows hold the columns of the bone's matrix, so each component of
+		// the transformed center is one dot product.  The transformed extents
+		// are the extents dotted with the absolute values of the same rows.
+		XMVECTOR c = XMVectorSelect(XMVectorSelect(
+			XMVector4Dot(C, row2), XMVector4Dot(C, row1), g_XMSelect1100.v),
+			XMVector4Dot(C, row0), g_XMSelect1000.v);
+
+		XMVECTOR e = XMVectorSelect(XMVectorSelect(
+			XMVector4Dot(E, XMVectorAbs(row2)), XMVector4Dot(E, XMVectorAbs(row1)), g_XMSelect1100.v),
+			XMVector4Dot(E, XMVectorAbs(row0)), g_XMSelect1000.v);
+
+		vMin = XMVectorMin(vMin, c - e);
+		vMax = XMVectorMax(vMax, c + e);
+	}
+
+	if(mBoxes.empty())
+	{
+		vMin = XMVectorZero();
+		vMax = XMVectorZero();
+	}
+
+	XMStoreFloat3(&bounds.Center, 0.5f*(vMin + vMax));
+	XMStoreFloat3(&bounds.Extents, 0.5f*(vMax - vMin));
+}
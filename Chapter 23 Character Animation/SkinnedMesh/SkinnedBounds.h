@@ -0,0 +1,40 @@
+//***************************************************************************************
+// SkinnedBounds.h
+//
+// Bounding boxes that follow the animation of a skinned mesh.  At load time every
+// bone gets the box of the bind pose vertices it influences.  A skinned vertex is a
+// weighted average of the vertex transformed by each of its bones, so it lies within
+// the union of the bone boxes transformed by their final transforms, which gives a
+// tight box for any pose without touching the vertices.
+//***************************************************************************************
+
+#pragma once
+
+#include "LoadM3d.h"
+
+class SkinnedBounds
+{
+public:
+	SkinnedBounds(const std::vector<M3DLoader::SkinnedVertex>& vertices, UINT numBones);
+	SkinnedBounds(const SkinnedBounds& rhs) = delete;
+	SkinnedBounds& operator=(const SkinnedBounds& rhs) = delete;
+	~SkinnedBounds() = default;
+
+	// Number of bones that influence at least one vertex.
+	UINT BoxCount()const;
+
+	// The mesh space bounds of the pose given by palette, as returned by
+	// SkinnedData::GetFinalTransforms.
+	void ComputeBounds(const BoneTransform3x4* palette, DirectX::BoundingBox& bounds)const;
+
+private:
+	struct BoneBox
+	{
+		DirectX::XMFLOAT4A Center;  // w = 1
+		DirectX::XMFLOAT4A Extents; // w = 0
+		UINT Bone = 0;
+	};
+
+	// Only bones with vertices have a box.
+	std::vector<BoneBox> mBoxes;
+};
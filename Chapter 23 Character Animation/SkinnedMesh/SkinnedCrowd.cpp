@@ -0,0 +1,197 @@
+//***************************************************************************************
+// SkinnedCrowd.cpp
+//***************************************************************************************
+
+#include "SkinnedCrowd.h"
+#include "AllocationCounter.h"
+
+using namespace DirectX;
+
+SkinnedCrowd::SkinnedCrowd(const SkinnedData* skinnedInfo)
+	: mSkinnedInfo(skinnedInfo),
+	  mNumBones(skinnedInfo->BoneCount())
+{
+}
+
+UINT SkinnedCrowd::InstanceCount()const
+{
+	return (UINT)mInstances.size();
+}
+
+UINT SkinnedCrowd::BoneCount()const
+{
+	return mNumBones;
+}
+
+UINT SkinnedCrowd::AddInstance(ClipHandle clip, float timePos, float playbackRate)
+{
+	UINT index = (UINT)mInstances.size();
+
+	mInstances.push_back(Instance());
+	mInstances.back().KeyframeCursors.assign(mNumBones, 0);
+	mInstances.back().PlaybackRate = playbackRate;
+	SetClip(index, clip, timePos);
+
+	mPalette.resize(mInstances.size()*mNumBones, BoneTransform3x4::Identity());
+
+	// The resize may have moved the palette.
+	for(UINT i = 0; i < (UINT)mInstances.size(); ++i)
+		mInstances[i].FinalTransforms = &mPalette[i*mNumBones];
+
+	mPendingInstances.reserve(mInstances.size());
+
+	return index;
+}
+
+void SkinnedCrowd::SetClip(UINT instance, ClipHandle clip, float timePos)
+{
+	assert(clip != InvalidClipHandle);
+
+	Instance& inst = mInstances[instance];
+	inst.Clip = clip;
+	inst.TimePos = timePos;
+	inst.ClipStartTime = mSkinnedInfo->GetClipStartTime(clip);
+	inst.ClipEndTime = mSkinnedInfo->GetClipEndTime(clip);
+
+	// The cursors refer to the old clip's keyframes; make the next sample seek.
+	std::fill(inst.KeyframeCursors.begin(), inst.KeyframeCursors.end(), 0);
+}
+
+void SkinnedCrowd::SetPlaybackRate(UINT instance, float playbackRate)
+{
+	mInstances[instance].PlaybackRate = playbackRate;
+}
+
+void SkinnedCrowd::EnablePoseCache(UINT capacity, float sampleRate)
+{
+	if(capacity == 0)
+	{
+		mPoseCache.reset();
+		for(UINT i = 0; i < (UINT)mInstances.size(); ++i)
+			mInstances[i].FinalTransforms = &mPalette[i*mNumBones];
+	}
+	else
+	{
+		mPoseCache = std::make_unique<PoseCache>(mSkinnedInfo, capacity, sampleRate);
+	}
+}
+
+const PoseCache* SkinnedCrowd::GetPoseCache()const
+{
+	return mPoseCache.get();
+}
+
+void SkinnedCrowd::Update(float dt)
+{
+	if(mPoseCache)
+		UpdateCached(dt);
+	else
+		UpdateUncached(dt);
+}
+
+void SkinnedCrowd::UpdateUncached(float dt)
+{
+	const UINT numInstances = (UINT)mInstances.size();
+
+	concurrency::parallel_for(0u, numInstances, ChunkSize, [this, dt, numInstances](UINT first)
+	{
+		AnimationScratch& scratch = mScratch.local();
+		if(scratch.ToParentTransforms.size() != mNumBones)
+			scratch.Resize(mNumBones);
+
+		// Once the thread's scratch exists, animating must not allocate.
+		const UINT64 allocations = ThreadAllocationCount();
+
+		UINT last = MathHelper::Min(first + ChunkSize, numInstances);
+		for(UINT i = first; i < last; ++i)
+		{
+			Instance& inst = mInstances[i];
+			AdvanceTime(inst, dt);
+
+			mSkinnedInfo->GetFinalTransforms(inst.Clip, inst.TimePos, scratch,
+				inst.KeyframeCursors, inst.FinalTransforms);
+		}
+
+		assert(ThreadAllocationCount() == allocations && "The animation update allocated.");
+	});
+}
+
+void SkinnedCrowd::UpdateCached(float dt)
+{
+	const UINT numInstances = (UINT)mInstances.size();
+
+	// The cache lookups are cheap, so they run serially and only the poses that
+	// missed are evaluated in parallel.
+	mPoseCache->BeginFrame();
+	mPendingInstances.clear();
+
+	for(UINT i = 0; i < numInstances; ++i)
+	{
+		Instance& inst = mInstances[i];
+		AdvanceTime(inst, dt);
+
+		bool evaluate = false;
+		inst.FinalTransforms = mPoseCache->Acquire(inst.Clip, inst.TimePos, evaluate);
+
+		// The cache is full this frame; fall back to the instance's own palette.
+		if(inst.FinalTransforms == nullptr)
+		{
+			inst.FinalTransforms = &mPalette[i*mNumBones];
+			evaluate = true;
+		}
+
+		if(evaluate)
+			mPendingInstances.push_back(i);
+	}
+
+	__int64 countsPerSec = 0;
+	__int64 startTime = 0;
+	__int64 endTime = 0;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+	QueryPerformanceCounter((LARGE_INTEGER*)&startTime);
+
+	const UINT numPending = (UINT)mPendingInstances.size();
+
+	concurrency::parallel_for(0u, numPending, ChunkSize, [this, numPending](UINT first)
+	{
+		AnimationScratch& scratch = mScratch.local();
+		if(scratch.ToParentTransforms.size() != mNumBones)
+			scratch.Resize(mNumBones);
+
+		UINT last = MathHelper::Min(first + ChunkSize, numPending);
+		for(UINT p = first; p < last; ++p)
+		{
+			Instance& inst = mInstances[mPendingInstances[p]];
+
+			// Every instance that shares the pose reads it at the quantized time.
+			mSkinnedInfo->GetFinalTransforms(inst.Clip, mPoseCache->QuantizeTime(inst.TimePos), scratch,
+				inst.KeyframeCursors, inst.FinalTransforms);
+		}
+	});
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&endTime);
+	mPoseCache->RecordEvaluation(numPending, (double)(endTime - startTime) / countsPerSec);
+}
+
+void SkinnedCrowd::AdvanceTime(Instance& inst, float dt)
+{
+	inst.TimePos += dt*inst.PlaybackRate;
+
+	// Loop animation, in either playback direction.
+	float duration = inst.ClipEndTime - inst.ClipStartTime;
+	if(duration > 0.0f && (inst.TimePos > inst.ClipEndTime || inst.TimePos < inst.ClipStartTime))
+	{
+		float t = fmodf(inst.TimePos - inst.ClipStartTime, duration);
+		inst.TimePos = inst.ClipStartTime + (t < 0.0f ? t + duration : t);
+	}
+}
+
+const BoneTransform3x4* SkinnedCrowd::GetFinalTransforms(UINT instance)const
+{
+	return mInstances[instance].FinalTransforms;
+}
+
+const std::vector<BoneTransform3x4>& SkinnedCrowd::Palette()const
+{
+	return mPalette;
+}
@@ -0,0 +1,93 @@
+//***************************************************************************************
+// SkinnedCrowd.h
+//
+// Animates many instances of one skinned model.  Each instance plays its own clip at
+// its own time and playback rate.  The instances are updated in parallel chunks and
+// their final bone transforms are written into one contiguous palette buffer, instance
+// after instance, ready to be copied to the GPU.
+//
+// With a pose cache enabled, instances that play the same clip at the same
+// (quantized) time share one palette, which is only evaluated once.
+//***************************************************************************************
+
+#pragma once
+
+#include "SkinnedData.h"
+#include "PoseCache.h"
+#include <ppl.h>
+
+class SkinnedCrowd
+{
+public:
+	SkinnedCrowd(const SkinnedData* skinnedInfo);
+	SkinnedCrowd(const SkinnedCrowd& rhs) = delete;
+	SkinnedCrowd& operator=(const SkinnedCrowd& rhs) = delete;
+	~SkinnedCrowd() = default;
+
+	UINT InstanceCount()const;
+	UINT BoneCount()const;
+
+	// Adds an instance and returns its index.  The palette is resized here,
+	// never during Update.
+	UINT AddInstance(ClipHandle clip, float timePos = 0.0f, float playbackRate = 1.0f);
+
+	void SetClip(UINT instance, ClipHandle clip, float timePos = 0.0f);
+	void SetPlaybackRate(UINT instance, float playbackRate);
+
+	// Shares evaluated poses between instances through a cache of capacity
+	// palettes; see PoseCache.  A capacity of zero disables the cache.
+	void EnablePoseCache(UINT capacity, float sampleRate = 0.0f);
+	const PoseCache* GetPoseCache()const;
+
+	// Advances and evaluates every instance.  Looping clips wrap around.
+	void Update(float dt);
+
+	// BoneCount() final transforms of the given instance.  With the pose cache
+	// enabled, instances may return the same pointer.
+	const BoneTransform3x4* GetFinalTransforms(UINT instance)const;
+
+	// The final transforms of all instances, InstanceCount()*BoneCount() matrices.
+	// Only filled when the pose cache is disabled.
+	const std::vector<BoneTransform3x4>& Palette()const;
+
+private:
+	struct Instance
+	{
+		ClipHandle Clip = InvalidClipHandle;
+		float TimePos = 0.0f;
+		float PlaybackRate = 1.0f;
+
+		// Cached so the update does not recompute the clip length.
+		float ClipStartTime = 0.0f;
+		float ClipEndTime = 0.0f;
+
+		std::vector<UINT> KeyframeCursors;
+
+		// Where the last Update wrote the instance's final transforms.
+		BoneTransform3x4* FinalTransforms = nullptr;
+	};
+
+	void AdvanceTime(Instance& inst, float dt);
+
+	void UpdateUncached(float dt);
+	void UpdateCached(float dt);
+
+private:
+	// Instances per parallel task.  Large enough to amortize the task overhead,
+	// small enough to balance well across cores.
+	static const UINT ChunkSize = 32;
+
+	const SkinnedData* mSkinnedInfo = nullptr;
+	UINT mNumBones = 0;
+
+	std::vector<Instance> mInstances;
+	std::vector<BoneTransform3x4> mPalette;
+
+	std::unique_ptr<PoseCache> mPoseCache;
+
+	// Instances whose pose missed the cache this frame.
+	std::vector<UINT> mPendingInstances;
+
+	// One scratch per worker thread, created on first use and then reused.
+	concurrency::combinable<AnimationScratch> mScratch;
+};
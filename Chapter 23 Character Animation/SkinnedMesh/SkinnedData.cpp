@@ -1,83 +1,423 @@
 #include "SkinnedData.h"
+#include <stdexcept>
 
 using namespace DirectX;
 
-Keyframe::Keyframe()
-	: TimePos(0.0f),
-	Translation(0.0f, 0.0f, 0.0f),
-	Scale(1.0f, 1.0f, 1.0f),
-	RotationQuat(0.0f, 0.0f, 0.0f, 1.0f)
+bool CompressedBoneTrack::Empty()const
 {
+	return KeyTimes.empty();
 }
 
-Keyframe::~Keyframe()
+UINT CompressedBoneTrack::KeyCount()const
 {
+	return (UINT)KeyTimes.size();
 }
- 
+
+std::size_t CompressedBoneTrack::ByteSize()const
+{
+	return sizeof(CompressedBoneTrack) +
+		KeyTimes.size()*sizeof(float) +
+		(Translations.size() + Scales.size() + Rotations.size())*sizeof(std::uint16_t);
+}
+
+void CompressedBoneTrack::DecodeKey(UINT i, Keyframe& key)const
+{
+	const float invMax = 1.0f / 65535.0f;
+
+	const std::uint16_t* t = &Translations[i*3];
+	key.Translation.x = TranslationMin.x + TranslationExtent.x*(t[0]*invMax);
+	key.Translation.y = TranslationMin.y + TranslationExtent.y*(t[1]*invMax);
+	key.Translation.z = TranslationMin.z + TranslationExtent.z*(t[2]*invMax);
+
+	const std::uint16_t* s = &Scales[i*3];
+	key.Scale.x = ScaleMin.x + ScaleExtent.x*(s[0]*invMax);
+	key.Scale.y = ScaleMin.y + ScaleExtent.y*(s[1]*invMax);
+	key.Scale.z = ScaleMin.z + ScaleExtent.z*(s[2]*invMax);
+
+	// Smallest three: the top bits of the first two words give the index of the
+	// dropped (largest, made positive) component; the low 15 bits map the
+	// others from [0, 32767] back to [-1/sqrt(2), 1/sqrt(2)].
+	const std::uint16_t* r = &Rotations[i*3];
+	UINT largest = (r[0] >> 15) | ((r[1] >> 15) << 1);
+
+	const float range = 0.70710678f;
+	float c[3];
+	for(int k = 0; k < 3; ++k)
+		c[k] = ((r[k] & 0x7fff)*(2.0f / 32767.0f) - 1.0f)*range;
+
+	float w = sqrtf(MathHelper::Max(1.0f - c[0]*c[0] - c[1]*c[1] - c[2]*c[2], 0.0f));
+
+	float* q = &key.RotationQuat.x;
+	for(UINT k = 0, j = 0; k < 4; ++k)
+		q[k] = (k == largest) ? w : c[j++];
+
+	key.TimePos = KeyTimes[i];
+}
+
+void CompressedBoneTrack::Interpolate(float t, Keyframe& key, UINT& keyCursor)const
+{
+	const UINT numKeys = (UINT)KeyTimes.size();
+
+	if( t <= KeyTimes.front() )
+	{
+		DecodeKey(0, key);
+		keyCursor = 0;
+	}
+	else if( t >= KeyTimes.back() )
+	{
+		DecodeKey(numKeys - 1, key);
+		keyCursor = numKeys - 2;
+	}
+	else
+	{
+		UINT i = KeyframeAnimation::FindKeyPair(numKeys, t, keyCursor,
+			[this](UINT k) { return KeyTimes[k]; });
+		keyCursor = i;
+
+		Keyframe k0;
+		Keyframe k1;
+		DecodeKey(i, k0);
+		DecodeKey(i+1, k1);
+
+		float lerpPercent = (t - k0.TimePos) / (k1.TimePos - k0.TimePos);
+
+		XMStoreFloat3(&key.Scale, XMVectorLerp(XMLoadFloat3(&k0.Scale), XMLoadFloat3(&k1.Scale), lerpPercent));
+		XMStoreFloat3(&key.Translation, XMVectorLerp(XMLoadFloat3(&k0.Translation), XMLoadFloat3(&k1.Translation), lerpPercent));
+		XMStoreFloat4(&key.RotationQuat, XMQuaternionSlerp(XMLoadFloat4(&k0.RotationQuat), XMLoadFloat4(&k1.RotationQuat), lerpPercent));
+	}
+
+	key.TimePos = t;
+}
+
 float BoneAnimation::GetStartTime()const
 {
+	if(!Compressed.Empty())
+		return Compressed.KeyTimes.front();
+
 	// Keyframes are sorted by time, so first keyframe gives start time.
 	return Keyframes.front().TimePos;
 }
 
 float BoneAnimation::GetEndTime()const
 {
+	if(!Compressed.Empty())
+		return Compressed.KeyTimes.back();
+
 	// Keyframes are sorted by time, so last keyframe gives end time.
 	float f = Keyframes.back().TimePos;
 
 	return f;
 }
 
+std::size_t BoneAnimation::ByteSize()const
+{
+	if(!Compressed.Empty())
+		return Compressed.ByteSize();
+
+	return sizeof(BoneAnimation) + Keyframes.size()*sizeof(Keyframe);
+}
+
 void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M)const
 {
-	if( t <= Keyframes.front().TimePos )
+	// Without a cursor every call is a seek.
+	UINT keyCursor = 0;
+	Interpolate(t, M, keyCursor);
+}
+
+void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M, UINT& keyCursor)const
+{
+	Keyframe key;
+	Interpolate(t, key, keyCursor);
+
+	KeyframeAnimation::ToMatrix(key, M);
+}
+
+void BoneAnimation::Interpolate(float t, Keyframe& key, UINT& keyCursor)const
+{
+	if(!Compressed.Empty())
+		Compressed.Interpolate(t, key, keyCursor);
+	else
+		KeyframeAnimation::Interpolate(Keyframes, Interpolation, t, key, keyCursor);
+}
+
+UINT BoneAnimation::FindKeyframe(float t, UINT keyCursor)const
+{
+	return KeyframeAnimation::FindKeyPair(Keyframes, t, keyCursor);
+}
+
+namespace
+{
+	// Interpolates four bones from key0 to key1.  The rotations are slerped lane
+	// by lane exactly like XMQuaternionSlerpV: take the shortest arc, and fall back
+	// to a lerp when the keys nearly coincide.
+	void SlerpGroup(const BoneGroupPose& key0, const BoneGroupPose& key1, FXMVECTOR s, BoneGroupPose& out)
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.front().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.front().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR oneMinusEpsilon = XMVectorReplicate(1.0f - 0.00001f);
 
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		for(int c = 0; c < 3; ++c)
+		{
+			XMStoreFloat4A(&out.Translation[c],
+				XMVectorLerpV(XMLoadFloat4A(&key0.Translation[c]), XMLoadFloat4A(&key1.Translation[c]), s));
+			XMStoreFloat4A(&out.Scale[c],
+				XMVectorLerpV(XMLoadFloat4A(&key0.Scale[c]), XMLoadFloat4A(&key1.Scale[c]), s));
+		}
+
+		XMVECTOR q0[4];
+		XMVECTOR q1[4];
+		for(int c = 0; c < 4; ++c)
+		{
+			q0[c] = XMLoadFloat4A(&key0.RotationQuat[c]);
+			q1[c] = XMLoadFloat4A(&key1.RotationQuat[c]);
+		}
+
+		XMVECTOR cosOmega = q0[0]*q1[0] + q0[1]*q1[1] + q0[2]*q1[2] + q0[3]*q1[3];
+
+		XMVECTOR negative = XMVectorLess(cosOmega, XMVectorZero());
+		XMVECTOR sign = XMVectorSelect(one, -one, negative);
+		cosOmega = cosOmega*sign;
+
+		XMVECTOR sinOmega = XMVectorSqrt(XMVectorMax(one - cosOmega*cosOmega, XMVectorZero()));
+		XMVECTOR omega = XMVectorATan2(sinOmega, cosOmega);
+		XMVECTOR invSinOmega = XMVectorReciprocal(sinOmega);
+
+		XMVECTOR w0 = XMVectorSin((one - s)*omega)*invSinOmega;
+		XMVECTOR w1 = XMVectorSin(s*omega)*invSinOmega;
+
+		XMVECTOR useSlerp = XMVectorLess(cosOmega, oneMinusEpsilon);
+		w0 = XMVectorSelect(one - s, w0, useSlerp);
+		w1 = XMVectorSelect(s, w1, useSlerp)*sign;
+
+		for(int c = 0; c < 4; ++c)
+			XMStoreFloat4A(&out.RotationQuat[c], q0[c]*w0 + q1[c]*w1);
 	}
-	else if( t >= Keyframes.back().TimePos )
+
+	// Builds the affine matrices S*R*T (see XMMatrixRotationQuaternion and
+	// XMMatrixAffineTransformation) of the first count bones of a group,
+	// computing one matrix element per lane.
+	void GroupToMatrices(const BoneGroupPose& pose, UINT count, XMFLOAT4X4* out)
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.back().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.back().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR two = XMVectorReplicate(2.0f);
+		const XMVECTOR zero = XMVectorZero();
+
+		XMVECTOR qx = XMLoadFloat4A(&pose.RotationQuat[0]);
+		XMVECTOR qy = XMLoadFloat4A(&pose.RotationQuat[1]);
+		XMVECTOR qz = XMLoadFloat4A(&pose.RotationQuat[2]);
+		XMVECTOR qw = XMLoadFloat4A(&pose.RotationQuat[3]);
+
+		XMVECTOR sx = XMLoadFloat4A(&pose.Scale[0]);
+		XMVECTOR sy = XMLoadFloat4A(&pose.Scale[1]);
+		XMVECTOR sz = XMLoadFloat4A(&pose.Scale[2]);
+
+		XMVECTOR xx = qx*qx, yy = qy*qy, zz = qz*qz;
+		XMVECTOR xy = qx*qy, xz = qx*qz, yz = qy*qz;
+		XMVECTOR wx = qw*qx, wy = qw*qy, wz = qw*qz;
+
+		XMMATRIX rows[4];
+		rows[0] = XMMATRIX(
+			sx*(one - two*(yy + zz)),
+			sx*(two*(xy + wz)),
+			sx*(two*(xz - wy)),
+			zero);
+		rows[1] = XMMATRIX(
+			sy*(two*(xy - wz)),
+			sy*(one - two*(xx + zz)),
+			sy*(two*(yz + wx)),
+			zero);
+		rows[2] = XMMATRIX(
+			sz*(two*(xz + wy)),
+			sz*(two*(yz - wx)),
+			sz*(one - two*(xx + yy)),
+			zero);
+		rows[3] = XMMATRIX(
+			XMLoadFloat4A(&pose.Translation[0]),
+			XMLoadFloat4A(&pose.Translation[1]),
+			XMLoadFloat4A(&pose.Translation[2]),
+			one);
+
+		// Transposing lane-major rows gives one matrix row per bone.
+		for(int r = 0; r < 4; ++r)
+			rows[r] = XMMatrixTranspose(rows[r]);
+
+		for(UINT lane = 0; lane < count; ++lane)
+		{
+			XMMATRIX M(rows[0].r[lane], rows[1].r[lane], rows[2].r[lane], rows[3].r[lane]);
+			XMStoreFloat4x4(&out[lane], M);
+		}
+	}
 
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+	// Loads four affine matrices, one per lane: m[r][c] holds element (r, c) of
+	// every matrix.  The last column is always (0, 0, 0, 1) and is left out.
+	void LoadAffineLanes(const XMFLOAT4X4* const src[4], XMVECTOR m[4][3])
+	{
+		XMMATRIX M[4];
+		for(int lane = 0; lane < 4; ++lane)
+			M[lane] = XMLoadFloat4x4(src[lane]);
+
+		for(int r = 0; r < 4; ++r)
+		{
+			XMMATRIX columns = XMMatrixTranspose(XMMATRIX(M[0].r[r], M[1].r[r], M[2].r[r], M[3].r[r]));
+			for(int c = 0; c < 3; ++c)
+				m[r][c] = columns.r[c];
+		}
 	}
-	else
+
+	// out = a*b, lane by lane, for affine matrices held as in LoadAffineLanes.
+	void MultiplyAffineLanes(const XMVECTOR a[4][3], const XMVECTOR b[4][3], XMVECTOR out[4][3])
 	{
-		for(UINT i = 0; i < Keyframes.size()-1; ++i)
+		for(int r = 0; r < 4; ++r)
 		{
-			if( t >= Keyframes[i].TimePos && t <= Keyframes[i+1].TimePos )
+			for(int c = 0; c < 3; ++c)
 			{
-				float lerpPercent = (t - Keyframes[i].TimePos) / (Keyframes[i+1].TimePos - Keyframes[i].TimePos);
+				XMVECTOR v = XMVectorMultiplyAdd(a[r][0], b[0][c],
+					XMVectorMultiplyAdd(a[r][1], b[1][c], a[r][2]*b[2][c]));
 
-				XMVECTOR s0 = XMLoadFloat3(&Keyframes[i].Scale);
-				XMVECTOR s1 = XMLoadFloat3(&Keyframes[i+1].Scale);
+				// Only the last row has a one in the implicit last column of a.
+				out[r][c] = r == 3 ? v + b[3][c] : v;
+			}
+		}
+	}
+}
 
-				XMVECTOR p0 = XMLoadFloat3(&Keyframes[i].Translation);
-				XMVECTOR p1 = XMLoadFloat3(&Keyframes[i+1].Translation);
+void LocalPose::Resize(UINT numBones)
+{
+	BoneCount = numBones;
+	Groups.resize((numBones + 3) / 4);
 
-				XMVECTOR q0 = XMLoadFloat4(&Keyframes[i].RotationQuat);
-				XMVECTOR q1 = XMLoadFloat4(&Keyframes[i+1].RotationQuat);
+	Keyframe identity;
+	for(UINT bone = numBones; bone < Groups.size()*4; ++bone)
+		SetBone(bone, identity);
+}
 
-				XMVECTOR S = XMVectorLerp(s0, s1, lerpPercent);
-				XMVECTOR P = XMVectorLerp(p0, p1, lerpPercent);
-				XMVECTOR Q = XMQuaternionSlerp(q0, q1, lerpPercent);
+void LocalPose::SetBone(UINT bone, const Keyframe& key)
+{
+	BoneGroupPose& group = Groups[bone / 4];
+	UINT lane = bone % 4;
 
-				XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-				XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+	(&group.Translation[0].x)[lane] = key.Translation.x;
+	(&group.Translation[1].x)[lane] = key.Translation.y;
+	(&group.Translation[2].x)[lane] = key.Translation.z;
 
-				break;
-			}
+	(&group.Scale[0].x)[lane] = key.Scale.x;
+	(&group.Scale[1].x)[lane] = key.Scale.y;
+	(&group.Scale[2].x)[lane] = key.Scale.z;
+
+	(&group.RotationQuat[0].x)[lane] = key.RotationQuat.x;
+	(&group.RotationQuat[1].x)[lane] = key.RotationQuat.y;
+	(&group.RotationQuat[2].x)[lane] = key.RotationQuat.z;
+	(&group.RotationQuat[3].x)[lane] = key.RotationQuat.w;
+}
+
+void LocalPose::ToMatrices(XMFLOAT4X4* toParentTransforms)const
+{
+	for(UINT g = 0; g < (UINT)Groups.size(); ++g)
+	{
+		UINT count = MathHelper::Min(BoneCount - g*4, 4u);
+		GroupToMatrices(Groups[g], count, &toParentTransforms[g*4]);
+	}
+}
+
+void CompiledClip::Build(const std::vector<BoneAnimation>& boneAnimations)
+{
+	BoneCount = (UINT)boneAnimations.size();
+	GroupCount = (BoneCount + 3) / 4;
+
+	// The shared key times are the union of every bone's key times.
+	KeyTimes.clear();
+	for(UINT i = 0; i < BoneCount; ++i)
+	{
+		for(const Keyframe& key : boneAnimations[i].Keyframes)
+			KeyTimes.push_back(key.TimePos);
+	}
+
+	std::sort(KeyTimes.begin(), KeyTimes.end());
+	KeyTimes.erase(std::unique(KeyTimes.begin(), KeyTimes.end()), KeyTimes.end());
+
+	// Interpolation needs a pair of keys to bracket t.
+	if(KeyTimes.size() == 1)
+		KeyTimes.push_back(KeyTimes.front());
+
+	const UINT numKeys = (UINT)KeyTimes.size();
+	Keys.resize(numKeys*GroupCount);
+
+	// Resample one key at a time into a pose, then copy its groups out.
+	LocalPose pose;
+	pose.Resize(BoneCount);
+
+	std::vector<UINT> keyCursors(BoneCount, 0);
+	for(UINT k = 0; k < numKeys; ++k)
+	{
+		for(UINT bone = 0; bone < BoneCount; ++bone)
+		{
+			Keyframe key;
+			boneAnimations[bone].Interpolate(KeyTimes[k], key, keyCursors[bone]);
+			pose.SetBone(bone, key);
 		}
+
+		std::copy(pose.Groups.begin(), pose.Groups.end(), Keys.begin() + k*GroupCount);
 	}
 }
 
+bool CompiledClip::Empty()const
+{
+	return Keys.empty();
+}
+
+UINT CompiledClip::FindKey(float t, UINT keyCursor)const
+{
+	return KeyframeAnimation::FindKeyPair((UINT)KeyTimes.size(), t, keyCursor,
+		[this](UINT i) { return KeyTimes[i]; });
+}
+
+UINT CompiledClip::LocateKey(float t, UINT& keyCursor, float& lerpPercent)const
+{
+	// Clamp to the clip, which gives the first/last key like BoneAnimation does.
+	t = MathHelper::Clamp(t, KeyTimes.front(), KeyTimes.back());
+
+	UINT k = FindKey(t, keyCursor);
+	keyCursor = k;
+
+	float span = KeyTimes[k+1] - KeyTimes[k];
+	lerpPercent = span > 0.0f ? (t - KeyTimes[k]) / span : 0.0f;
+
+	return k;
+}
+
+void CompiledClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms, UINT& keyCursor)const
+{
+	float lerpPercent = 0.0f;
+	UINT k = LocateKey(t, keyCursor, lerpPercent);
+
+	const XMVECTOR s = XMVectorReplicate(lerpPercent);
+
+	const BoneGroupPose* keys0 = &Keys[k*GroupCount];
+	const BoneGroupPose* keys1 = &Keys[(k+1)*GroupCount];
+
+	for(UINT g = 0; g < GroupCount; ++g)
+	{
+		BoneGroupPose group;
+		SlerpGroup(keys0[g], keys1[g], s, group);
+
+		UINT count = MathHelper::Min(BoneCount - g*4, 4u);
+		GroupToMatrices(group, count, &boneTransforms[g*4]);
+	}
+}
+
+void CompiledClip::Sample(float t, LocalPose& pose, UINT& keyCursor)const
+{
+	float lerpPercent = 0.0f;
+	UINT k = LocateKey(t, keyCursor, lerpPercent);
+
+	const XMVECTOR s = XMVectorReplicate(lerpPercent);
+
+	const BoneGroupPose* keys0 = &Keys[k*GroupCount];
+	const BoneGroupPose* keys1 = &Keys[(k+1)*GroupCount];
+
+	for(UINT g = 0; g < GroupCount; ++g)
+		SlerpGroup(keys0[g], keys1[g], s, pose.Groups[g]);
+}
+
 float AnimationClip::GetClipStartTime()const
 {
 	// Find smallest start time over all bones in this clip.
@@ -104,22 +444,186 @@ float AnimationClip::GetClipEndTime()const
 
 void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms)const
 {
+	if(!Compiled.Empty())
+	{
+		UINT keyCursor = 0;
+		Compiled.Interpolate(t, boneTransforms, keyCursor);
+		return;
+	}
+
 	for(UINT i = 0; i < BoneAnimations.size(); ++i)
 	{
 		BoneAnimations[i].Interpolate(t, boneTransforms[i]);
 	}
 }
 
+void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms, std::vector<UINT>& keyCursors)const
+{
+	// A fresh (or resized) instance starts searching from the first keyframe.
+	if(keyCursors.size() != BoneAnimations.size())
+		keyCursors.assign(BoneAnimations.size(), 0);
+
+	if(!Compiled.Empty())
+	{
+		Compiled.Interpolate(t, boneTransforms, keyCursors[0]);
+		return;
+	}
+
+	for(UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		BoneAnimations[i].Interpolate(t, boneTransforms[i], keyCursors[i]);
+	}
+}
+
+void AnimationClip::Sample(float t, LocalPose& pose, std::vector<UINT>& keyCursors)const
+{
+	if(keyCursors.size() != BoneAnimations.size())
+		keyCursors.assign(BoneAnimations.size(), 0);
+
+	if(!Compiled.Empty())
+	{
+		Compiled.Sample(t, pose, keyCursors[0]);
+		return;
+	}
+
+	for(UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		Keyframe key;
+		BoneAnimations[i].Interpolate(t, key, keyCursors[i]);
+		pose.SetBone(i, key);
+	}
+}
+
+void AnimationClip::Compile()
+{
+	bool linear = true;
+	for(const BoneAnimation& bone : BoneAnimations)
+	{
+		if(bone.Interpolation != KeyInterpolation::Linear)
+			linear = false;
+	}
+
+	if(IsCompressed() || !linear)
+		Compiled = CompiledClip();
+	else
+		Compiled.Build(BoneAnimations);
+
+	// The compiled clip must play back like the bone animations it came from.
+	assert(MaxCompiledError(256) < 1e-3f && "The compiled clip differs from its bone animations.");
+}
+
+float AnimationClip::MaxCompiledError(UINT numSamples)const
+{
+	if(Compiled.Empty() || numSamples == 0)
+		return 0.0f;
+
+	const UINT numBones = (UINT)BoneAnimations.size();
+	const float startTime = GetClipStartTime();
+	const float duration = GetClipEndTime() - startTime;
+
+	std::vector<XMFLOAT4X4> compiled(numBones);
+	std::vector<XMFLOAT4X4> reference(numBones);
+	std::vector<UINT> keyCursors(numBones, 0);
+	UINT compiledCursor = 0;
+
+	float maxError = 0.0f;
+	for(UINT i = 0; i < numSamples; ++i)
+	{
+		// Include both ends of the clip.
+		float t = startTime + (numSamples > 1 ? duration*i / (numSamples - 1) : 0.0f);
+
+		Compiled.Interpolate(t, compiled, compiledCursor);
+		for(UINT bone = 0; bone < numBones; ++bone)
+			BoneAnimations[bone].Interpolate(t, reference[bone], keyCursors[bone]);
+
+		for(UINT bone = 0; bone < numBones; ++bone)
+		{
+			for(int r = 0; r < 4; ++r)
+			{
+				for(int c = 0; c < 4; ++c)
+				{
+					float expected = reference[bone].m[r][c];
+					float error = fabsf(compiled[bone].m[r][c] - expected) / MathHelper::Max(fabsf(expected), 1.0f);
+					maxError = MathHelper::Max(maxError, error);
+				}
+			}
+		}
+	}
+
+	return maxError;
+}
+
+bool AnimationClip::IsCompressed()const
+{
+	for(const BoneAnimation& bone : BoneAnimations)
+	{
+		if(!bone.Compressed.Empty())
+			return true;
+	}
+
+	return false;
+}
+
+BoneTransform3x4 BoneTransform3x4::Identity()
+{
+	BoneTransform3x4 I;
+	I.Rows[0] = XMFLOAT4(1.0f, 0.0f, 0.0f, 0.0f);
+	I.Rows[1] = XMFLOAT4(0.0f, 1.0f, 0.0f, 0.0f);
+	I.Rows[2] = XMFLOAT4(0.0f, 0.0f, 1.0f, 0.0f);
+
+	return I;
+}
+
+void AnimationScratch::Resize(UINT numBones)
+{
+	ToParentTransforms.resize(numBones);
+	ToRootTransforms.resize(numBones);
+}
+
+ClipHandle SkinnedData::FindClip(const std::string& clipName)const
+{
+	auto clip = mClipHandles.find(clipName);
+	return clip != mClipHandles.end() ? clip->second : InvalidClipHandle;
+}
+
 float SkinnedData::GetClipStartTime(const std::string& clipName)const
 {
-	auto clip = mAnimations.find(clipName);
-	return clip->second.GetClipStartTime();
+	return GetClipStartTime(FindClip(clipName));
 }
 
 float SkinnedData::GetClipEndTime(const std::string& clipName)const
 {
-	auto clip = mAnimations.find(clipName);
-	return clip->second.GetClipEndTime();
+	return GetClipEndTime(FindClip(clipName));
+}
+
+float SkinnedData::GetClipStartTime(ClipHandle clip)const
+{
+	return mClips[clip].GetClipStartTime();
+}
+
+float SkinnedData::GetClipEndTime(ClipHandle clip)const
+{
+	return mClips[clip].GetClipEndTime();
+}
+
+const AnimationClip& SkinnedData::GetClip(ClipHandle clip)const
+{
+	return mClips[clip];
+}
+
+AnimationClip& SkinnedData::GetClip(ClipHandle clip)
+{
+	return mClips[clip];
+}
+
+UINT SkinnedData::ClipCount()const
+{
+	return (UINT)mClips.size();
+}
+
+const std::vector<int>& SkinnedData::BoneHierarchy()const
+{
+	return mBoneHierarchy;
 }
 
 UINT SkinnedData::BoneCount()const
@@ -133,48 +637,194 @@ void SkinnedData::Set(std::vector<int>& boneHierarchy,
 {
 	mBoneHierarchy = boneHierarchy;
 	mBoneOffsets   = boneOffsets;
-	mAnimations    = animations;
+
+	assert(mBoneHierarchy.size() == mBoneOffsets.size());
+	BuildComposeGroups();
+
+	mClips.clear();
+	mClipHandles.clear();
+	for(auto& clip : animations)
+	{
+		mClipHandles[clip.first] = (ClipHandle)mClips.size();
+		mClips.push_back(clip.second);
+		mClips.back().Compile();
+	}
 }
  
-void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos,  std::vector<XMFLOAT4X4>& finalTransforms)const
+void SkinnedData::SortBonesByDepth(const std::vector<int>& boneHierarchy,
+	std::vector<UINT>& boneOrder, std::vector<UINT>& levelStart)
 {
-	UINT numBones = mBoneOffsets.size();
+	const UINT numBones = (UINT)boneHierarchy.size();
+
+	// A bone's depth is one more than its parent's.  Walking up to the root
+	// also verifies the hierarchy: every parent index must be valid and no
+	// bone may be its own ancestor.  A chain longer than the bone count must
+	// loop, so that bounds the walk even in release builds.
+	std::vector<UINT> depth(numBones, 0);
+	UINT maxDepth = 0;
+	for(UINT i = 0; i < numBones; ++i)
+	{
+		UINT d = 0;
+		int parent = boneHierarchy[i];
+		for( ; parent >= 0 && parent < (int)numBones && d < numBones; parent = boneHierarchy[parent])
+			++d;
+
+		if(parent >= (int)numBones)
+			throw std::runtime_error("Bad parent index in the bone hierarchy.");
+		if(parent >= 0)
+			throw std::runtime_error("The bone hierarchy has a cycle.");
+
+		depth[i] = d;
+		maxDepth = MathHelper::Max(maxDepth, d);
+	}
 
-	std::vector<XMFLOAT4X4> toParentTransforms(numBones);
+	boneOrder.resize(numBones);
+	levelStart.clear();
+	if(numBones == 0)
+		return;
 
-	// Interpolate all the bones of this clip at the given time instance.
-	auto clip = mAnimations.find(clipName);
-	clip->second.Interpolate(timePos, toParentTransforms);
+	// Counting sort by depth; bones of one level keep their index order.
+	levelStart.assign(maxDepth + 2, 0);
+	for(UINT i = 0; i < numBones; ++i)
+		++levelStart[depth[i] + 1];
+	for(UINT d = 1; d < (UINT)levelStart.size(); ++d)
+		levelStart[d] += levelStart[d - 1];
+
+	std::vector<UINT> next(levelStart.begin(), levelStart.end() - 1);
+	for(UINT i = 0; i < numBones; ++i)
+		boneOrder[next[depth[i]]++] = i;
+}
+
+void SkinnedData::BuildComposeGroups()
+{
+	std::vector<UINT> boneOrder;
+	std::vector<UINT> levelStart;
+	SortBonesByDepth(mBoneHierarchy, boneOrder, levelStart);
+
+	mComposeGroups.clear();
+	for(UINT level = 0; level + 1 < (UINT)levelStart.size(); ++level)
+	{
+		for(UINT first = levelStart[level]; first < levelStart[level + 1]; first += 4)
+		{
+			ComposeGroup group;
+			group.Count = MathHelper::Min(levelStart[level + 1] - first, 4u);
+
+			for(UINT lane = 0; lane < 4; ++lane)
+			{
+				UINT bone = boneOrder[first + (lane < group.Count ? lane : 0)];
+				group.Bones[lane] = bone;
+				group.Parents[lane] = mBoneHierarchy[bone];
+
+				for(int r = 0; r < 4; ++r)
+				{
+					for(int c = 0; c < 3; ++c)
+						(&group.Offsets[r][c].x)[lane] = mBoneOffsets[bone].m[r][c];
+				}
+			}
+
+			mComposeGroups.push_back(group);
+		}
+	}
+}
+
+void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos,  std::vector<BoneTransform3x4>& finalTransforms)const
+{
+	AnimationScratch scratch;
+	scratch.Resize(BoneCount());
+
+	std::vector<UINT> keyCursors(BoneCount(), 0);
+
+	GetFinalTransforms(FindClip(clipName), timePos, scratch, keyCursors, finalTransforms.data());
+}
+
+void SkinnedData::GetFinalTransforms(ClipHandle clip, float timePos, AnimationScratch& scratch,
+	std::vector<UINT>& keyCursors, BoneTransform3x4* finalTransforms)const
+{
+	assert(clip != InvalidClipHandle && "Unknown animation clip.");
+
+	// Interpolate all the bones of this clip at the given time instance,
+	// continuing from where this instance's last sample left off.
+	mClips[clip].Interpolate(timePos, scratch.ToParentTransforms, keyCursors);
+
+	ComposeFinalTransforms(scratch, finalTransforms);
+}
+
+void SkinnedData::GetFinalTransforms(const LocalPose& pose, AnimationScratch& scratch, BoneTransform3x4* finalTransforms)const
+{
+	pose.ToMatrices(scratch.ToParentTransforms.data());
+
+	ComposeFinalTransforms(scratch, finalTransforms);
+}
+
+void SkinnedData::ComposeFinalTransforms(AnimationScratch& scratch, BoneTransform3x4* finalTransforms)const
+{
+	const std::vector<XMFLOAT4X4>& toParentTransforms = scratch.ToParentTransforms;
 
 	//
 	// Traverse the hierarchy and transform all the bones to the root space.
+	// The bones are visited level by level, so a bone's parent has always
+	// been transformed already, and the bones of a level are independent,
+	// which lets four of them be multiplied at once.
 	//
 
-	std::vector<XMFLOAT4X4> toRootTransforms(numBones);
+	std::vector<XMFLOAT4X4>& toRootTransforms = scratch.ToRootTransforms;
 
-	// The root bone has index 0.  The root bone has no parent, so its toRootTransform
-	// is just its local bone transform.
-	toRootTransforms[0] = toParentTransforms[0];
+	// Root bones have no parent, so their toRootTransform is just their
+	// local bone transform.
+	static const XMFLOAT4X4 identity = MathHelper::Identity4x4();
 
-	// Now find the toRootTransform of the children.
-	for(UINT i = 1; i < numBones; ++i)
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR one = XMVectorSplatOne();
+
+	for(const ComposeGroup& group : mComposeGroups)
 	{
-		XMMATRIX toParent = XMLoadFloat4x4(&toParentTransforms[i]);
+		const XMFLOAT4X4* toParent[4];
+		const XMFLOAT4X4* parentToRoot[4];
+		for(UINT lane = 0; lane < 4; ++lane)
+		{
+			toParent[lane] = &toParentTransforms[group.Bones[lane]];
+			parentToRoot[lane] = group.Parents[lane] >= 0 ? &toRootTransforms[group.Parents[lane]] : &identity;
+		}
 
-		int parentIndex = mBoneHierarchy[i];
-		XMMATRIX parentToRoot = XMLoadFloat4x4(&toRootTransforms[parentIndex]);
+		XMVECTOR local[4][3];
+		XMVECTOR parent[4][3];
+		LoadAffineLanes(toParent, local);
+		LoadAffineLanes(parentToRoot, parent);
 
-		XMMATRIX toRoot = XMMatrixMultiply(toParent, parentToRoot);
+		XMVECTOR toRoot[4][3];
+		MultiplyAffineLanes(local, parent, toRoot);
 
-		XMStoreFloat4x4(&toRootTransforms[i], toRoot);
-	}
+		// Premultiply by the bone offset transform to get the final transform.
+		XMVECTOR offset[4][3];
+		for(int r = 0; r < 4; ++r)
+		{
+			for(int c = 0; c < 3; ++c)
+				offset[r][c] = XMLoadFloat4A(&group.Offsets[r][c]);
+		}
 
-	// Premultiply by the bone offset transform to get the final transform.
-	for(UINT i = 0; i < numBones; ++i)
-	{
-		XMMATRIX offset = XMLoadFloat4x4(&mBoneOffsets[i]);
-		XMMATRIX toRoot = XMLoadFloat4x4(&toRootTransforms[i]);
-        XMMATRIX finalTransform = XMMatrixMultiply(offset, toRoot);
-		XMStoreFloat4x4(&finalTransforms[i], XMMatrixTranspose(finalTransform));
+		XMVECTOR finalTransform[4][3];
+		MultiplyAffineLanes(offset, toRoot, finalTransform);
+
+		// Transposing element-major rows gives one matrix row per bone.
+		XMMATRIX rows[4];
+		for(int r = 0; r < 4; ++r)
+			rows[r] = XMMatrixTranspose(XMMATRIX(toRoot[r][0], toRoot[r][1], toRoot[r][2], r == 3 ? one : zero));
+
+		for(UINT lane = 0; lane < group.Count; ++lane)
+		{
+			XMMATRIX M(rows[0].r[lane], rows[1].r[lane], rows[2].r[lane], rows[3].r[lane]);
+			XMStoreFloat4x4(&toRootTransforms[group.Bones[lane]], M);
+		}
+
+		// Column c of the final transform is row c of its 3x4 form; the last
+		// column, (0, 0, 0, 1), is not stored.
+		for(int c = 0; c < 3; ++c)
+		{
+			XMMATRIX columns = XMMatrixTranspose(XMMATRIX(
+				finalTransform[0][c], finalTransform[1][c], finalTransform[2][c], finalTransform[3][c]));
+
+			for(UINT lane = 0; lane < group.Count; ++lane)
+				XMStoreFloat4(&finalTransforms[group.Bones[lane]].Rows[c], columns.r[lane]);
+		}
 	}
 }
\ No newline at end of file
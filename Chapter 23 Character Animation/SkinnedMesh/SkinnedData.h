@@ -3,19 +3,41 @@
 
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
+#include "../../Common/KeyframeAnimation.h"
 
 ///<summary>
-/// A Keyframe defines the bone transformation at an instant in time.
+/// The keyframes of one bone after AnimationCompressor (AnimationCompression.h)
+/// removed the redundant ones and quantized the rest.  Translations and scales
+/// are stored with 16 bits per component relative to the track's range, and
+/// rotations with 48 bits using the smallest-three encoding: the largest
+/// component is dropped (it follows from the unit length) and the other three
+/// are stored with 15 bits each, plus 2 bits for which component was dropped.
 ///</summary>
-struct Keyframe
+struct CompressedBoneTrack
 {
-	Keyframe();
-	~Keyframe();
+	bool Empty()const;
+	UINT KeyCount()const;
 
-    float TimePos;
-	DirectX::XMFLOAT3 Translation;
-    DirectX::XMFLOAT3 Scale;
-    DirectX::XMFLOAT4 RotationQuat;
+	// Memory used by the track, for compression reports.
+	std::size_t ByteSize()const;
+
+	void DecodeKey(UINT i, Keyframe& key)const;
+
+	// Same contract as BoneAnimation::Interpolate.
+	void Interpolate(float t, Keyframe& key, UINT& keyCursor)const;
+
+	std::vector<float> KeyTimes;
+
+	// Three 16-bit values per key each.
+	std::vector<std::uint16_t> Translations;
+	std::vector<std::uint16_t> Scales;
+	std::vector<std::uint16_t> Rotations;
+
+	// Dequantized value = Min + Extent*q/65535.
+	DirectX::XMFLOAT3 TranslationMin = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 TranslationExtent = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 ScaleMin = { 1.0f, 1.0f, 1.0f };
+	DirectX::XMFLOAT3 ScaleExtent = { 0.0f, 0.0f, 0.0f };
 };
 
 ///<summary>
@@ -32,7 +54,98 @@ struct BoneAnimation
 
     void Interpolate(float t, DirectX::XMFLOAT4X4& M)const;
 
+	// Same as above, but keyCursor remembers the keyframe the last call ended
+	// at.  Playing forward then only steps ahead from the cursor, which is O(1)
+	// per frame; seeking backwards or far ahead falls back to a binary search.
+    void Interpolate(float t, DirectX::XMFLOAT4X4& M, UINT& keyCursor)const;
+
+	// Interpolates the keyframes bounding t into the local TRS transform key,
+	// without building the matrix.  key.TimePos is set to t.
+    void Interpolate(float t, Keyframe& key, UINT& keyCursor)const;
+
+	// Returns the index i of the keyframe pair [i, i+1] that bounds t.
+	UINT FindKeyframe(float t, UINT keyCursor)const;
+
+	// Size of the keyframe data, compressed or not.
+	std::size_t ByteSize()const;
+
 	std::vector<Keyframe> Keyframes; 	
+
+	KeyInterpolation Interpolation = KeyInterpolation::Linear;
+
+	// Compressed tracks always interpolate linearly.  When not empty, this replaces Keyframes (which are then cleared) and
+	// Interpolate decodes the keys from it.
+	CompressedBoneTrack Compressed;
+};
+
+///<summary>
+/// Local (to-parent) transforms of four bones in structure-of-arrays form.
+/// Lane k of each channel belongs to bone 4*groupIndex + k, so one SIMD
+/// operation processes the same channel of four bones.
+///</summary>
+struct BoneGroupPose
+{
+	DirectX::XMFLOAT4A Translation[3]; // x, y, z
+	DirectX::XMFLOAT4A Scale[3];       // x, y, z
+	DirectX::XMFLOAT4A RotationQuat[4];// x, y, z, w
+};
+
+///<summary>
+/// The local transforms of a whole skeleton, four bones per BoneGroupPose.
+/// Poses are sampled, blended and layered in this form; the bone matrices are
+/// only built once the final local pose is known.
+///</summary>
+struct LocalPose
+{
+	// Lanes past the last bone are set to the identity transform.
+	void Resize(UINT numBones);
+
+	void SetBone(UINT bone, const Keyframe& key);
+
+	// Builds the bone-to-parent matrices, BoneCount entries.
+	void ToMatrices(DirectX::XMFLOAT4X4* toParentTransforms)const;
+
+	UINT BoneCount = 0;
+	std::vector<BoneGroupPose> Groups;
+};
+
+///<summary>
+/// A CompiledClip stores every bone of an AnimationClip resampled onto one
+/// shared list of key times, as one LocalPose-style group array per key.
+/// Sampling the whole skeleton then walks one contiguous array and
+/// interpolates four bones per SIMD operation, instead of visiting one
+/// keyframe vector per bone.
+///
+/// The shared key times are the union of all the bones' key times, so the
+/// resampling is exact: translation and scale are piecewise linear, and
+/// slerp stays on the same arc between the inserted keys.
+///</summary>
+struct CompiledClip
+{
+	void Build(const std::vector<BoneAnimation>& boneAnimations);
+	bool Empty()const;
+
+	// Interpolates all bones at time t.  All bones share the key times, so a
+	// single keyCursor serves the whole skeleton.
+	void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms, UINT& keyCursor)const;
+
+	// Same as above, but leaves the result in local TRS form.
+	void Sample(float t, LocalPose& pose, UINT& keyCursor)const;
+
+	// Returns the index i of the key pair [i, i+1] that bounds t.
+	UINT FindKey(float t, UINT keyCursor)const;
+
+	UINT BoneCount = 0;
+	UINT GroupCount = 0;
+
+	std::vector<float> KeyTimes;
+
+	// KeyTimes.size()*GroupCount entries; all the groups of key 0, then key 1, ...
+	std::vector<BoneGroupPose> Keys;
+
+private:
+	// Returns the key pair index and the interpolation parameter for t.
+	UINT LocateKey(float t, UINT& keyCursor, float& lerpPercent)const;
 };
 
 ///<summary>
@@ -47,7 +160,61 @@ struct AnimationClip
 
     void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms)const;
 
+	// keyCursors holds one keyframe cursor per bone; see BoneAnimation::Interpolate.
+	// Once the clip is compiled only keyCursors[0] is used.
+    void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms,
+		std::vector<UINT>& keyCursors)const;
+
+	// Samples the local TRS transforms of all bones at time t.
+    void Sample(float t, LocalPose& pose, std::vector<UINT>& keyCursors)const;
+
+	// Builds the SoA representation that Interpolate prefers over BoneAnimations.
+	// Compressed clips are not compiled, as that would expand them again, and
+	// neither are clips with non-linear bones, which the SoA form cannot represent.
+	void Compile();
+	bool IsCompressed()const;
+
+	// The largest difference between the bone matrices sampled through Compiled
+	// and through BoneAnimations, at numSamples times spread over the clip.  Each
+	// element's difference is taken relative to its size, or absolute below one.
+	// Zero when the clip is not compiled.
+	float MaxCompiledError(UINT numSamples)const;
+
     std::vector<BoneAnimation> BoneAnimations; 	
+
+	CompiledClip Compiled;
+};
+
+// Identifies an animation clip of a SkinnedData.  Resolve it once from the
+// clip name with SkinnedData::FindClip instead of looking the name up every frame.
+typedef int ClipHandle;
+const ClipHandle InvalidClipHandle = -1;
+
+///<summary>
+/// A final bone transform as uploaded to the shaders.  Bone transforms are
+/// affine, so the last column of the matrix is always (0, 0, 0, 1); only the
+/// first three columns are stored, each as one row here.  HLSL reads this as a
+/// column-major float4x3 (see cbSkinned in Common.hlsl), which is the
+/// matrix without its last column, so mul(float4(p, 1), M) still works.
+///</summary>
+struct BoneTransform3x4
+{
+	static BoneTransform3x4 Identity();
+
+	DirectX::XMFLOAT4 Rows[3];
+};
+
+///<summary>
+/// Working memory for SkinnedData::GetFinalTransforms.  Callers keep one around
+/// (per instance, or per thread when animating in parallel) so that evaluating
+/// a pose does not touch the heap.
+///</summary>
+struct AnimationScratch
+{
+	void Resize(UINT numBones);
+
+	std::vector<DirectX::XMFLOAT4X4> ToParentTransforms;
+	std::vector<DirectX::XMFLOAT4X4> ToRootTransforms;
 };
 
 class SkinnedData
@@ -56,27 +223,90 @@ public:
 
 	UINT BoneCount()const;
 
+	// Returns InvalidClipHandle if there is no clip with the given name.
+	ClipHandle FindClip(const std::string& clipName)const;
+
 	float GetClipStartTime(const std::string& clipName)const;
 	float GetClipEndTime(const std::string& clipName)const;
+	float GetClipStartTime(ClipHandle clip)const;
+	float GetClipEndTime(ClipHandle clip)const;
+
+	const AnimationClip& GetClip(ClipHandle clip)const;
+	AnimationClip& GetClip(ClipHandle clip);
+	UINT ClipCount()const;
+
+	// Gives the parent index of every bone; the root's parent is -1.
+	const std::vector<int>& BoneHierarchy()const;
+
+	// Sorts the bones by depth in the hierarchy, so every parent comes before its
+	// children.  The bones of level d are boneOrder[levelStart[d]] up to
+	// boneOrder[levelStart[d+1]], in index order, so levelStart has one entry
+	// more than there are levels.  Throws std::runtime_error if a parent index
+	// is out of range or the hierarchy has a cycle.
+	static void SortBonesByDepth(const std::vector<int>& boneHierarchy,
+		std::vector<UINT>& boneOrder, std::vector<UINT>& levelStart);
 
 	void Set(
 		std::vector<int>& boneHierarchy, 
 		std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
 		std::unordered_map<std::string, AnimationClip>& animations);
 
-	 // In a real project, you'd want to cache the result if there was a chance
-	 // that you were calling this several times with the same clipName at 
-	 // the same timePos.
+	 // If this may be called several times with the same clip at the same
+	 // timePos, cache the result; see PoseCache.
     void GetFinalTransforms(const std::string& clipName, float timePos, 
-		 std::vector<DirectX::XMFLOAT4X4>& finalTransforms)const;
+		 std::vector<BoneTransform3x4>& finalTransforms)const;
+
+	// Allocation free version for per-frame use.  scratch must have been sized
+	// with Resize(BoneCount()), keyCursors holds the instance's keyframe cursors
+	// (BoneCount() entries; see AnimationClip::Interpolate), and finalTransforms
+	// must have room for BoneCount() matrices.
+    void GetFinalTransforms(ClipHandle clip, float timePos,
+		 AnimationScratch& scratch,
+		 std::vector<UINT>& keyCursors,
+		 BoneTransform3x4* finalTransforms)const;
+
+	// Final transforms of an already sampled (and possibly blended) local pose.
+    void GetFinalTransforms(const LocalPose& pose,
+		 AnimationScratch& scratch,
+		 BoneTransform3x4* finalTransforms)const;
+
+private:
+	// Up to four bones of one depth level, which do not depend on each other and
+	// are composed together, one bone per SIMD lane.  Unused lanes repeat the
+	// first bone and are never stored.
+	struct ComposeGroup
+	{
+		UINT Count = 0;
+		UINT Bones[4];
+		int Parents[4];
+
+		// Element (r, c) of the four bones' offset transforms.  The transforms
+		// are affine, so the last column is always (0, 0, 0, 1) and not stored.
+		DirectX::XMFLOAT4A Offsets[4][3];
+	};
+
+	// Concatenates the interpolated bone-to-parent transforms down the hierarchy
+	// one depth level at a time, four bones of a level at once, and applies the
+	// bone offsets.
+	void ComposeFinalTransforms(AnimationScratch& scratch,
+		BoneTransform3x4* finalTransforms)const;
+
+	// Splits the levels of SortBonesByDepth into mComposeGroups.
+	void BuildComposeGroups();
 
 private:
     // Gives parentIndex of ith bone.
 	std::vector<int> mBoneHierarchy;
 
 	std::vector<DirectX::XMFLOAT4X4> mBoneOffsets;
+
+	// The bones level by level, so every parent is composed before its children.
+	std::vector<ComposeGroup> mComposeGroups;
    
-	std::unordered_map<std::string, AnimationClip> mAnimations;
+	// Clips are stored contiguously and addressed by ClipHandle; the map only
+	// resolves names.
+	std::vector<AnimationClip> mClips;
+	std::unordered_map<std::string, ClipHandle> mClipHandles;
 };
  
 #endif // SKINNEDDATA_H
\ No newline at end of file
@@ -1,5 +1,16 @@
 //***************************************************************************************
 // SkinnedMeshApp.cpp by Frank Luna (C) 2015 All Rights Reserved.
+//
+// Press '1' to measure the keyframe search of 1000 soldiers and check the compiled clip.
+// Press '2' to measure how animating 10000 soldiers scales with the thread count.
+// Press '3' to measure the cost per soldier of cross-fading two poses.
+// Press '4' to compress the soldier's clip and report the memory saved and the error.
+// Press '5' to measure skinning 16 soldiers on the CPU every frame.
+// Press '6' to measure the cost of step, linear and spline key interpolation.
+// Press '7' to measure sharing poses between 10000 soldiers through a pose cache.
+//
+// Measurements are written to the debugger output, with a summary in the window
+// caption.
 //***************************************************************************************
 
 #include "../../Common/d3dApp.h"
@@ -11,6 +22,11 @@
 #include "ShadowMap.h"
 #include "Ssao.h"
 #include "SkinnedData.h"
+#include "SkinnedCrowd.h"
+#include "SkinnedBounds.h"
+#include "AnimationBlend.h"
+#include "AnimationCompression.h"
+#include "CpuSkinning.h"
 #include "LoadM3d.h"
 
 using Microsoft::WRL::ComPtr;
@@ -19,28 +35,37 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
-struct SkinnedModelInstance
+namespace
 {
-    SkinnedData* SkinnedInfo = nullptr;
-    std::vector<DirectX::XMFLOAT4X4> FinalTransforms;
-    std::string ClipName;
-    float TimePos = 0.0f;
-
-    // Called every frame and increments the time position, interpolates the 
-    // animations for each bone based on the current animation clip, and 
-    // generates the final transforms which are ultimately set to the effect
-    // for processing in the vertex shader.
-    void UpdateSkinnedAnimation(float dt)
-    {
-        TimePos += dt;
+	__int64 ReadCounter()
+	{
+		__int64 count = 0;
+		QueryPerformanceCounter((LARGE_INTEGER*)&count);
+		return count;
+	}
 
-        // Loop animation
-        if(TimePos > SkinnedInfo->GetClipEndTime(ClipName))
-            TimePos = 0.0f;
+	// Milliseconds since a ReadCounter() reading.
+	double MillisecondsSince(__int64 startCount)
+	{
+		__int64 countsPerSec = 0;
+		QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
 
-        // Compute the final transforms for this time position.
-        SkinnedInfo->GetFinalTransforms(ClipName, TimePos, FinalTransforms);
-    }
+		return 1000.0*(double)(ReadCounter() - startCount) / (double)countsPerSec;
+	}
+
+	// The measurements store a result of their loops here, so the compiler
+	// cannot drop the loops as dead code.
+	volatile float gMeasureSink = 0.0f;
+}
+
+// Links a skinned render-item to the crowd member that animates it.
+struct SkinnedModelInstance
+{
+    SkinnedCrowd* Crowd = nullptr;
+    UINT CrowdIndex = 0;
+
+    // Mesh space bounds of the current pose, updated every frame.
+    BoundingBox Bounds;
 };
 
 // Lightweight structure stores parameters to draw a shape.  This will
@@ -114,11 +139,23 @@ private:
     virtual void OnMouseMove(WPARAM btnState, int x, int y)override;
 
     void OnKeyboardInput(const GameTimer& gt);
+
+	// True on the first frame key is held down.
+	bool KeyPressed(int key);
+
+	void MeasureKeyframeSearch();
+	void MeasureCrowdScaling();
+	void MeasureBlendCost();
+	void MeasureCompression();
+	void MeasureCpuSkinning();
+	void MeasureKeyInterpolation();
+	void MeasurePoseCache();
 	void AnimateMaterials(const GameTimer& gt);
 	void UpdateObjectCBs(const GameTimer& gt);
     void UpdateSkinnedCBs(const GameTimer& gt);
 	void UpdateMaterialBuffer(const GameTimer& gt);
     void UpdateShadowTransform(const GameTimer& gt);
+    void CullSkinnedRenderItems();
 	void UpdateMainPassCB(const GameTimer& gt);
     void UpdateShadowPassCB(const GameTimer& gt);
     void UpdateSsaoCB(const GameTimer& gt);
@@ -189,12 +226,20 @@ private:
     std::string mSkinnedModelFilename = "Models\\soldier.m3d";
     std::unique_ptr<SkinnedModelInstance> mSkinnedModelInst; 
     SkinnedData mSkinnedInfo;
+    std::unique_ptr<SkinnedCrowd> mSkinnedCrowd;
+    std::unique_ptr<SkinnedBounds> mSkinnedBounds;
+    std::unique_ptr<CpuSkinner> mCpuSkinner;
     std::vector<M3DLoader::Subset> mSkinnedSubsets;
     std::vector<M3DLoader::M3dMaterial> mSkinnedMats;
     std::vector<std::string> mSkinnedTextureNames;
 
 	Camera mCamera;
 
+    // The skinned render items that survived culling against the camera and
+    // against the shadow map volume this frame.
+    std::vector<RenderItem*> mVisibleSkinnedRitems;
+    std::vector<RenderItem*> mShadowCastingSkinnedRitems;
+
     std::unique_ptr<ShadowMap> mShadowMap;
 
     std::unique_ptr<Ssao> mSsao;
@@ -208,6 +253,9 @@ private:
     XMFLOAT4X4 mLightProj = MathHelper::Identity4x4();
     XMFLOAT4X4 mShadowTransform = MathHelper::Identity4x4();
 
+    // The volume the shadow map covers, in light view space.
+    BoundingBox mShadowVolume;
+
     float mLightRotationAngle = 0.0f;
     XMFLOAT3 mBaseLightDirections[3] = {
         XMFLOAT3(0.57735f, -0.57735f, 0.57735f),
@@ -217,6 +265,9 @@ private:
     XMFLOAT3 mRotatedLightDirections[3];
 
     POINT mLastMousePos;
+
+	// Whether each virtual key was down last frame, for KeyPressed.
+	bool mKeyDown[256] = {};
 };
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
@@ -240,6 +291,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
         MessageBox(nullptr, e.ToString().c_str(), L"HR Failed", MB_OK);
         return 0;
     }
+    catch(std::exception& e)
+    {
+        MessageBoxA(nullptr, e.what(), "Error", MB_OK);
+        return 0;
+    }
 }
 
 SkinnedMeshApp::SkinnedMeshApp(HINSTANCE hInstance)
@@ -375,6 +431,7 @@ void SkinnedMeshApp::Update(const GameTimer& gt)
     UpdateSkinnedCBs(gt);
 	UpdateMaterialBuffer(gt);
     UpdateShadowTransform(gt);
+    CullSkinnedRenderItems();
 	UpdateMainPassCB(gt);
     UpdateShadowPassCB(gt);
     UpdateSsaoCB(gt);
@@ -478,7 +535,7 @@ void SkinnedMeshApp::Draw(const GameTimer& gt)
     DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
 
     mCommandList->SetPipelineState(mPSOs["skinnedOpaque"].Get());
-    DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::SkinnedOpaque]);
+    DrawRenderItems(mCommandList.Get(), mVisibleSkinnedRitems);
 
     mCommandList->SetPipelineState(mPSOs["debug"].Get());
     DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Debug]);
@@ -555,9 +612,472 @@ void SkinnedMeshApp::OnKeyboardInput(const GameTimer& gt)
 	if(GetAsyncKeyState('D') & 0x8000)
 		mCamera.Strafe(10.0f*dt);
 
+	if(KeyPressed('1'))
+		MeasureKeyframeSearch();
+
+	if(KeyPressed('2'))
+		MeasureCrowdScaling();
+
+	if(KeyPressed('3'))
+		MeasureBlendCost();
+
+	if(KeyPressed('4'))
+		MeasureCompression();
+
+	if(KeyPressed('5'))
+		MeasureCpuSkinning();
+
+	if(KeyPressed('6'))
+		MeasureKeyInterpolation();
+
+	if(KeyPressed('7'))
+		MeasurePoseCache();
+
 	mCamera.UpdateViewMatrix();
 }
+
+bool SkinnedMeshApp::KeyPressed(int key)
+{
+	bool down = (GetAsyncKeyState(key) & 0x8000) != 0;
+	bool pressed = down && !mKeyDown[key];
+	mKeyDown[key] = down;
+
+	return pressed;
+}
+
+void SkinnedMeshApp::MeasureKeyframeSearch()
+{
+	// Sample every bone of 1000 soldiers for a second of 60 Hz frames, each
+	// soldier at its own point in the clip, and find the keyframes three ways:
+	// scanning from the first key as the original Interpolate did, seeking with
+	// a binary search every time, and stepping on from each soldier's cursor.
+	const AnimationClip& clip = mSkinnedInfo.GetClip(mSkinnedInfo.FindClip("Take1"));
+
+	const UINT numInstances = 1000;
+	const UINT numFrames = 60;
+	const UINT numBones = (UINT)clip.BoneAnimations.size();
+	const float dt = 1.0f / 60.0f;
+
+	const float startTime = clip.GetClipStartTime();
+	const float duration = clip.GetClipEndTime() - startTime;
+
+	enum class Search { Scan, Seek, Cursor };
+
+	std::vector<UINT> cursors(numInstances*numBones, 0);
+
+	auto measure = [&](Search search)
+	{
+		std::fill(cursors.begin(), cursors.end(), 0);
+		float sum = 0.0f;
+
+		__int64 startCount = ReadCounter();
+
+		for(UINT frame = 0; frame < numFrames; ++frame)
+		{
+			for(UINT inst = 0; inst < numInstances; ++inst)
+			{
+				float t = startTime + fmodf(0.37f*inst + frame*dt, duration);
+
+				for(UINT bone = 0; bone < numBones; ++bone)
+				{
+					const BoneAnimation& anim = clip.BoneAnimations[bone];
+
+					UINT cursor = 0;
+					if(search == Search::Scan)
+					{
+						while(cursor + 2 < anim.Keyframes.size() && t > anim.Keyframes[cursor + 1].TimePos)
+							++cursor;
+					}
+					else if(search == Search::Cursor)
+					{
+						cursor = cursors[inst*numBones + bone];
+					}
+
+					Keyframe key;
+					anim.Interpolate(t, key, cursor);
+					sum += key.Translation.x;
+
+					cursors[inst*numBones + bone] = cursor;
+				}
+			}
+		}
+
+		gMeasureSink = sum;
+
+		return MillisecondsSince(startCount) / numFrames;
+	};
+
+	double scanMs = measure(Search::Scan);
+	double seekMs = measure(Search::Seek);
+	double cursorMs = measure(Search::Cursor);
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"Keyframe search, " << numInstances << L" soldiers x " << numBones << L" bones: " <<
+		scanMs << L" ms scan, " << seekMs << L" ms seek, " << cursorMs << L" ms cursor per frame, " <<
+		L"compiled clip max error " << clip.MaxCompiledError(1000);
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMainWndCaption = outs.str();
+}
  
+void SkinnedMeshApp::MeasureCrowdScaling()
+{
+	// 10000 soldiers, each at its own time and playback rate.
+	const UINT numInstances = 10000;
+	const UINT numFrames = 10;
+	const float dt = 1.0f / 60.0f;
+
+	SkinnedCrowd crowd(&mSkinnedInfo);
+	ClipHandle clip = mSkinnedInfo.FindClip("Take1");
+	for(UINT i = 0; i < numInstances; ++i)
+		crowd.AddInstance(clip, MathHelper::RandF(0.0f, 5.0f), MathHelper::RandF(0.8f, 1.2f));
+
+	// Warm up the caches and the worker threads' scratch.
+	crowd.Update(dt);
+
+	// Measure with 1, 2, 4, ... threads, up to one per processor.
+	const UINT maxThreads = concurrency::GetProcessorCount();
+	double singleThreadRate = 0.0;
+
+	std::wostringstream outs;
+	outs.precision(3);
+
+	for(UINT threads = 1; ; threads = MathHelper::Min(2*threads, maxThreads))
+	{
+		concurrency::CurrentScheduler::Create(concurrency::SchedulerPolicy(2,
+			concurrency::MinConcurrency, 1, concurrency::MaxConcurrency, threads));
+
+		__int64 startCount = ReadCounter();
+		for(UINT frame = 0; frame < numFrames; ++frame)
+			crowd.Update(dt);
+		double ms = MillisecondsSince(startCount) / numFrames;
+
+		concurrency::CurrentScheduler::Detach();
+
+		double rate = numInstances / ms;
+		if(threads == 1)
+			singleThreadRate = rate;
+
+		outs.str(L"");
+		outs << L"Crowd of " << numInstances << L" soldiers, " << threads << L" threads: " <<
+			ms << L" ms per frame, " << rate << L" soldiers/ms, " <<
+			rate / singleThreadRate << L"x one thread";
+
+		OutputDebugString((outs.str() + L"\n").c_str());
+
+		if(threads == maxThreads)
+			break;
+	}
+
+	mMainWndCaption = outs.str();
+}
+
+void SkinnedMeshApp::MeasureBlendCost()
+{
+	// Cross-fade two poses for each of 1000 soldiers over a second of 60 Hz
+	// frames.  The soldier has a single clip, so the two poses are "Take1" at two
+	// different times.  The blend tree samples both in local space and builds the
+	// final transforms once; the alternative evaluates the final transforms of
+	// both poses and blends the matrices.
+	const UINT numInstances = 1000;
+	const UINT numFrames = 60;
+	const UINT numBones = mSkinnedInfo.BoneCount();
+	const float dt = 1.0f / 60.0f;
+
+	ClipHandle clip = mSkinnedInfo.FindClip("Take1");
+	const float startTime = mSkinnedInfo.GetClipStartTime(clip);
+	const float duration = mSkinnedInfo.GetClipEndTime(clip) - startTime;
+
+	std::vector<BoneTransform3x4> finalTransforms(numBones);
+
+	auto timeAt = [&](UINT inst, UINT frame, float offset)
+	{
+		return startTime + fmodf(0.37f*inst + offset + frame*dt, duration);
+	};
+
+	// Blend tree, one per soldier.
+	std::vector<std::unique_ptr<BlendTree>> trees(numInstances);
+	for(auto& tree : trees)
+	{
+		tree = std::make_unique<BlendTree>(&mSkinnedInfo);
+		int a = tree->AddClip(clip);
+		int b = tree->AddClip(clip);
+		tree->SetRoot(tree->AddLerp(a, b, 0.5f));
+	}
+
+	BlendScratch blendScratch;
+	trees[0]->Evaluate(blendScratch, finalTransforms.data());
+
+	float sum = 0.0f;
+	__int64 startCount = ReadCounter();
+
+	for(UINT frame = 0; frame < numFrames; ++frame)
+	{
+		for(UINT inst = 0; inst < numInstances; ++inst)
+		{
+			BlendTree& tree = *trees[inst];
+			tree.GetNode(0).TimePos = timeAt(inst, frame, 0.0f);
+			tree.GetNode(1).TimePos = timeAt(inst, frame, 0.5f);
+
+			tree.Evaluate(blendScratch, finalTransforms.data());
+			sum += finalTransforms[0].Rows[0].w;
+		}
+	}
+
+	double blendTreeUs = 1000.0*MillisecondsSince(startCount) / (numFrames*numInstances);
+
+	// Two full evaluations and a matrix blend.
+	std::vector<UINT> cursors(2*numInstances*numBones, 0);
+	std::vector<BoneTransform3x4> transformsA(numBones);
+	std::vector<BoneTransform3x4> transformsB(numBones);
+
+	AnimationScratch scratch;
+	scratch.Resize(numBones);
+
+	std::vector<UINT> keyCursors(numBones);
+
+	startCount = ReadCounter();
+
+	for(UINT frame = 0; frame < numFrames; ++frame)
+	{
+		for(UINT inst = 0; inst < numInstances; ++inst)
+		{
+			UINT* instCursors = &cursors[2*inst*numBones];
+
+			std::copy(instCursors, instCursors + numBones, keyCursors.begin());
+			mSkinnedInfo.GetFinalTransforms(clip, timeAt(inst, frame, 0.0f), scratch, keyCursors, transformsA.data());
+			std::copy(keyCursors.begin(), keyCursors.end(), instCursors);
+
+			std::copy(instCursors + numBones, instCursors + 2*numBones, keyCursors.begin());
+			mSkinnedInfo.GetFinalTransforms(clip, timeAt(inst, frame, 0.5f), scratch, keyCursors, transformsB.data());
+			std::copy(keyCursors.begin(), keyCursors.end(), instCursors + numBones);
+
+			for(UINT bone = 0; bone < numBones; ++bone)
+			{
+				for(int r = 0; r < 3; ++r)
+				{
+					XMVECTOR rowA = XMLoadFloat4(&transformsA[bone].Rows[r]);
+					XMVECTOR rowB = XMLoadFloat4(&transformsB[bone].Rows[r]);
+					XMStoreFloat4(&finalTransforms[bone].Rows[r], XMVectorLerp(rowA, rowB, 0.5f));
+				}
+			}
+
+			sum += finalTransforms[0].Rows[0].w;
+		}
+	}
+
+	double matrixBlendUs = 1000.0*MillisecondsSince(startCount) / (numFrames*numInstances);
+
+	gMeasureSink = sum;
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"Cross-fade per soldier, " << numBones << L" bones: " <<
+		blendTreeUs << L" us blend tree, " << matrixBlendUs << L" us two evaluations and matrix blend (" <<
+		matrixBlendUs / blendTreeUs << L"x)";
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMainWndCaption = outs.str();
+}
+
+void SkinnedMeshApp::MeasureCompression()
+{
+	// Compress a copy of the soldier's clip with a few error budgets, in model
+	// space units.  The clip the demo plays is left alone.
+	const AnimationClip& clip = mSkinnedInfo.GetClip(mSkinnedInfo.FindClip("Take1"));
+	const float maxErrors[] = { 0.0001f, 0.001f, 0.01f };
+
+	std::wostringstream outs;
+	outs.precision(3);
+
+	for(float maxError : maxErrors)
+	{
+		AnimationClip compressed = clip;
+
+		AnimationCompressionSettings settings;
+		settings.MaxPositionError = maxError;
+
+		__int64 startCount = ReadCounter();
+		AnimationCompressionReport report = AnimationCompressor::Compress(compressed,
+			mSkinnedInfo.BoneHierarchy(), settings);
+		double ms = MillisecondsSince(startCount);
+
+		outs.str(L"");
+		outs << L"Compression, budget " << maxError << L": " <<
+			report.RawKeyCount << L" -> " << report.CompressedKeyCount << L" keys, " <<
+			report.RawBytes / 1024.0 << L" -> " << report.CompressedBytes / 1024.0 << L" KB (" <<
+			100.0*(1.0 - (double)report.CompressedBytes / report.RawBytes) << L"% saved), max error " <<
+			report.MaxPositionError << L", " << ms << L" ms";
+
+		OutputDebugString((outs.str() + L"\n").c_str());
+	}
+
+	mMainWndCaption = outs.str();
+}
+
+void SkinnedMeshApp::MeasureCpuSkinning()
+{
+	// Animate and skin 16 soldiers for a second of 60 Hz frames, as a game would
+	// for the characters its picking or physics needs the deformed mesh of.
+	const UINT numInstances = 16;
+	const UINT numFrames = 60;
+	const float dt = 1.0f / 60.0f;
+
+	SkinnedCrowd crowd(&mSkinnedInfo);
+	ClipHandle clip = mSkinnedInfo.FindClip("Take1");
+	for(UINT i = 0; i < numInstances; ++i)
+		crowd.AddInstance(clip, MathHelper::RandF(0.0f, 5.0f));
+
+	std::vector<CpuSkinnedVertices> skinned(numInstances);
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"CPU skinning, " << numInstances << L" soldiers x " << mCpuSkinner->VertexCount() << L" vertices:";
+
+	const CpuSkinner::Mode modes[] = { CpuSkinner::Mode::LinearBlend, CpuSkinner::Mode::DualQuaternion };
+	const wchar_t* modeNames[] = { L" linear blend ", L", dual quaternion " };
+
+	for(int m = 0; m < 2; ++m)
+	{
+		crowd.Update(dt);
+
+		// Warm up the output arrays.
+		for(UINT i = 0; i < numInstances; ++i)
+			mCpuSkinner->Skin(crowd.GetFinalTransforms(i), crowd.BoneCount(), modes[m], skinned[i]);
+
+		double skinMs = 0.0;
+		for(UINT frame = 0; frame < numFrames; ++frame)
+		{
+			crowd.Update(dt);
+
+			__int64 startCount = ReadCounter();
+			for(UINT i = 0; i < numInstances; ++i)
+				mCpuSkinner->Skin(crowd.GetFinalTransforms(i), crowd.BoneCount(), modes[m], skinned[i]);
+			skinMs += MillisecondsSince(startCount);
+		}
+
+		gMeasureSink = skinned[0].PosX[0];
+
+		outs << modeNames[m] << skinMs / numFrames << L" ms";
+	}
+
+	outs << L" per frame";
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMainWndCaption = outs.str();
+}
+
+void SkinnedMeshApp::MeasureKeyInterpolation()
+{
+	// Interpolate every bone of 1000 soldiers for a second of 60 Hz frames with
+	// each interpolation mode, using the soldier's keys and keyframe cursors so
+	// that only the evaluators differ.
+	const AnimationClip& clip = mSkinnedInfo.GetClip(mSkinnedInfo.FindClip("Take1"));
+
+	const UINT numInstances = 1000;
+	const UINT numFrames = 60;
+	const UINT numBones = (UINT)clip.BoneAnimations.size();
+	const float dt = 1.0f / 60.0f;
+
+	const float startTime = clip.GetClipStartTime();
+	const float duration = clip.GetClipEndTime() - startTime;
+
+	std::vector<UINT> cursors(numInstances*numBones, 0);
+
+	auto measure = [&](KeyInterpolation mode)
+	{
+		std::fill(cursors.begin(), cursors.end(), 0);
+		float sum = 0.0f;
+
+		__int64 startCount = ReadCounter();
+
+		for(UINT frame = 0; frame < numFrames; ++frame)
+		{
+			for(UINT inst = 0; inst < numInstances; ++inst)
+			{
+				float t = startTime + fmodf(0.37f*inst + frame*dt, duration);
+
+				for(UINT bone = 0; bone < numBones; ++bone)
+				{
+					const std::vector<Keyframe>& keys = clip.BoneAnimations[bone].Keyframes;
+					if(keys.size() < 2)
+						continue;
+
+					Keyframe key;
+					KeyframeAnimation::Interpolate(keys, mode, t, key, cursors[inst*numBones + bone]);
+					sum += key.RotationQuat.x;
+				}
+			}
+		}
+
+		gMeasureSink = sum;
+
+		return MillisecondsSince(startCount) / numFrames;
+	};
+
+	double stepMs = measure(KeyInterpolation::Step);
+	double linearMs = measure(KeyInterpolation::Linear);
+	double splineMs = measure(KeyInterpolation::Spline);
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"Key interpolation, " << numInstances << L" soldiers x " << numBones << L" bones: " <<
+		stepMs << L" ms step, " << linearMs << L" ms linear, " << splineMs << L" ms spline per frame";
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMainWndCaption = outs.str();
+}
+
+void SkinnedMeshApp::MeasurePoseCache()
+{
+	// 10000 soldiers in lockstep groups: every soldier of a group starts at the
+	// same time and plays at the same rate, as in a marching army.  The crowd is
+	// animated without and then with a pose cache sampled at 30 Hz, so each group
+	// evaluates one pose per frame instead of one per soldier.
+	const UINT numInstances = 10000;
+	const UINT numGroups = 32;
+	const UINT numFrames = 60;
+	const UINT cacheCapacity = 2*numGroups;
+	const float cacheSampleRate = 30.0f;
+	const float dt = 1.0f / 60.0f;
+
+	SkinnedCrowd crowd(&mSkinnedInfo);
+	ClipHandle clip = mSkinnedInfo.FindClip("Take1");
+	const float duration = mSkinnedInfo.GetClipEndTime(clip) - mSkinnedInfo.GetClipStartTime(clip);
+	for(UINT i = 0; i < numInstances; ++i)
+		crowd.AddInstance(clip, mSkinnedInfo.GetClipStartTime(clip) + duration*(i % numGroups) / numGroups);
+
+	// Warm up the caches and the worker threads' scratch.
+	crowd.Update(dt);
+
+	__int64 startCount = ReadCounter();
+	for(UINT frame = 0; frame < numFrames; ++frame)
+		crowd.Update(dt);
+	double uncachedMs = MillisecondsSince(startCount) / numFrames;
+
+	// The statistics start with the cache, so they include its first, cold frame.
+	crowd.EnablePoseCache(cacheCapacity, cacheSampleRate);
+
+	startCount = ReadCounter();
+	for(UINT frame = 0; frame < numFrames; ++frame)
+		crowd.Update(dt);
+	double cachedMs = MillisecondsSince(startCount) / numFrames;
+
+	const PoseCache::Stats& stats = crowd.GetPoseCache()->GetStats();
+
+	std::wostringstream outs;
+	outs.precision(3);
+	outs << L"Pose cache, " << numInstances << L" soldiers in " << numGroups << L" groups: " <<
+		uncachedMs << L" ms uncached, " << cachedMs << L" ms cached per frame, " <<
+		100.0f*stats.HitRate() << L"% hits, " <<
+		1000.0*stats.EstimatedSecondsSaved() / numFrames << L" ms saved per frame (" <<
+		stats.Overflows << L" overflows)";
+
+	OutputDebugString((outs.str() + L"\n").c_str());
+	mMainWndCaption = outs.str();
+}
+
 void SkinnedMeshApp::AnimateMaterials(const GameTimer& gt)
 {
 	
@@ -592,15 +1112,19 @@ void SkinnedMeshApp::UpdateSkinnedCBs(const GameTimer& gt)
 {
     auto currSkinnedCB = mCurrFrameResource->SkinnedCB.get();
    
-    // We only have one skinned model being animated.
-    mSkinnedModelInst->UpdateSkinnedAnimation(gt.DeltaTime());
+    // Animate every crowd member at once.
+    mSkinnedCrowd->Update(gt.DeltaTime());
         
+    // We only have one skinned model being animated.
     SkinnedConstants skinnedConstants;
+    const BoneTransform3x4* finalTransforms = mSkinnedCrowd->GetFinalTransforms(mSkinnedModelInst->CrowdIndex);
     std::copy(
-        std::begin(mSkinnedModelInst->FinalTransforms),
-        std::end(mSkinnedModelInst->FinalTransforms),
+        finalTransforms,
+        finalTransforms + mSkinnedCrowd->BoneCount(),
         &skinnedConstants.BoneTransforms[0]);
 
+    mSkinnedBounds->ComputeBounds(finalTransforms, mSkinnedModelInst->Bounds);
+
     currSkinnedCB->CopyData(0, skinnedConstants);
 }
  
@@ -659,6 +1183,8 @@ void SkinnedMeshApp::UpdateShadowTransform(const GameTimer& gt)
     mLightFarZ = f;
     XMMATRIX lightProj = XMMatrixOrthographicOffCenterLH(l, r, b, t, n, f);
 
+    BoundingBox::CreateFromPoints(mShadowVolume, XMVectorSet(l, b, n, 1.0f), XMVectorSet(r, t, f, 1.0f));
+
     // Transform NDC space [-1,+1]^2 to texture space [0,1]^2
     XMMATRIX T(
         0.5f, 0.0f, 0.0f, 0.0f,
@@ -672,15 +1198,49 @@ void SkinnedMeshApp::UpdateShadowTransform(const GameTimer& gt)
     XMStoreFloat4x4(&mShadowTransform, S);
 }
 
+void SkinnedMeshApp::CullSkinnedRenderItems()
+{
+    XMMATRIX invView = mCamera.GetInvView();
+    XMMATRIX lightView = XMLoadFloat4x4(&mLightView);
+
+    mVisibleSkinnedRitems.clear();
+    mShadowCastingSkinnedRitems.clear();
+
+    for(auto ri : mRitemLayer[(int)RenderLayer::SkinnedOpaque])
+    {
+        const BoundingBox& bounds = ri->SkinnedModelInst->Bounds;
+
+        XMMATRIX world = XMLoadFloat4x4(&ri->World);
+        XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(world), world);
+
+        // View space to the object's local space.
+        XMMATRIX viewToLocal = XMMatrixMultiply(invView, invWorld);
+
+        // Transform the camera frustum from view space to the object's local space.
+        BoundingFrustum localSpaceFrustum;
+        mCamera.GetFrustum().Transform(localSpaceFrustum, viewToLocal);
+
+        if(localSpaceFrustum.Contains(bounds) != DirectX::DISJOINT)
+            mVisibleSkinnedRitems.push_back(ri);
+
+        // Shadow casters just have to overlap the volume the shadow map covers.
+        BoundingBox lightSpaceBounds;
+        bounds.Transform(lightSpaceBounds, XMMatrixMultiply(world, lightView));
+
+        if(mShadowVolume.Intersects(lightSpaceBounds))
+            mShadowCastingSkinnedRitems.push_back(ri);
+    }
+}
+
 void SkinnedMeshApp::UpdateMainPassCB(const GameTimer& gt)
 {
 	XMMATRIX view = mCamera.GetView();
 	XMMATRIX proj = mCamera.GetProj();
 
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMMATRIX viewProj = mCamera.GetViewProj();
+	XMMATRIX invView = mCamera.GetInvView();
+	XMMATRIX invProj = mCamera.GetInvProj();
+	XMMATRIX invViewProj = mCamera.GetInvViewProj();
 
     // Transform NDC space [-1,+1]^2 to texture space [0,1]^2
     XMMATRIX T(
@@ -1283,11 +1843,13 @@ void SkinnedMeshApp::LoadSkinnedModel()
 	m3dLoader.LoadM3d(mSkinnedModelFilename, vertices, indices, 
         mSkinnedSubsets, mSkinnedMats, mSkinnedInfo);
 
+    mSkinnedCrowd = std::make_unique<SkinnedCrowd>(&mSkinnedInfo);
+    mSkinnedBounds = std::make_unique<SkinnedBounds>(vertices, mSkinnedInfo.BoneCount());
+    mCpuSkinner = std::make_unique<CpuSkinner>(vertices);
+
     mSkinnedModelInst = std::make_unique<SkinnedModelInstance>();
-    mSkinnedModelInst->SkinnedInfo = &mSkinnedInfo;
-    mSkinnedModelInst->FinalTransforms.resize(mSkinnedInfo.BoneCount());
-    mSkinnedModelInst->ClipName = "Take1";
-    mSkinnedModelInst->TimePos = 0.0f;
+    mSkinnedModelInst->Crowd = mSkinnedCrowd.get();
+    mSkinnedModelInst->CrowdIndex = mSkinnedCrowd->AddInstance(mSkinnedInfo.FindClip("Take1"), 0.0f);
  
 	const UINT vbByteSize = (UINT)vertices.size() * sizeof(SkinnedVertex);
     const UINT ibByteSize = (UINT)indices.size()  * sizeof(std::uint16_t);
@@ -1821,7 +2383,7 @@ void SkinnedMeshApp::DrawSceneToShadowMap()
     DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
 
     mCommandList->SetPipelineState(mPSOs["skinnedShadow_opaque"].Get());
-    DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::SkinnedOpaque]);
+    DrawRenderItems(mCommandList.Get(), mShadowCastingSkinnedRitems);
 
     // Change back to GENERIC_READ so we can read the texture in a shader.
     mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mShadowMap->Resource(),
@@ -1856,7 +2418,7 @@ void SkinnedMeshApp::DrawNormalsAndDepth()
     DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
 
     mCommandList->SetPipelineState(mPSOs["skinnedDrawNormals"].Get());
-    DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::SkinnedOpaque]);
+    DrawRenderItems(mCommandList.Get(), mVisibleSkinnedRitems);
 
     // Change back to GENERIC_READ so we can read the texture in a shader.
     mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(normalMap,
@@ -3,14 +3,44 @@
 //***************************************************************************************
 
 #include "Waves.h"
+#include <DirectXPackedVector.h>
 #include <ppl.h>
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <random>
 
 using namespace DirectX;
+using namespace DirectX::PackedVector;
 
-Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
+namespace
+{
+	// Maps a height storage type to the type the recurrence is evaluated in.
+	template<typename T>
+	struct WaveHeight
+	{
+		typedef T Compute;
+
+		static Compute Load(T h) { return h; }
+		static T Store(Compute h) { return h; }
+	};
+
+	// fp16 heights are widened to fp32 for the arithmetic and only rounded
+	// back to fp16 when the new solution is written.
+	template<>
+	struct WaveHeight<std::uint16_t>
+	{
+		typedef float Compute;
+
+		static Compute Load(std::uint16_t h) { return XMConvertHalfToFloat(h); }
+		static std::uint16_t Store(Compute h) { return XMConvertFloatToHalf(h); }
+	};
+}
+
+Waves::Waves(int m, int n, float dx, float dt, float speed, float damping, Precision precision)
 {
     mNumRows = m;
     mNumCols = n;
@@ -18,37 +48,36 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mVertexCount = m*n;
     mTriangleCount = (m - 1)*(n - 1) * 2;
 
+    mPrecision = precision;
+
     mTimeStep = dt;
     mSpatialStep = dx;
 
-    float d = damping*dt + 2.0f;
-    float e = (speed*speed)*(dt*dt) / (dx*dx);
-    mK1 = (damping*dt - 2.0f) / d;
-    mK2 = (4.0f - 8.0f*e) / d;
-    mK3 = (2.0f*e) / d;
-
-    mPrevSolution.resize(m*n);
-    mCurrSolution.resize(m*n);
-    mNormals.resize(m*n);
-    mTangentX.resize(m*n);
-
-    // Generate grid vertices in system memory.
+    double d = (double)damping*dt + 2.0;
+    double e = ((double)speed*speed)*((double)dt*dt) / ((double)dx*dx);
+    mK1 = ((double)damping*dt - 2.0) / d;
+    mK2 = (4.0 - 8.0*e) / d;
+    mK3 = (2.0*e) / d;
 
-    float halfWidth = (n - 1)*dx*0.5f;
-    float halfDepth = (m - 1)*dx*0.5f;
-    for(int i = 0; i < m; ++i)
+    // The grid starts flat, so all heights start at zero.
+    switch(mPrecision)
     {
-        float z = halfDepth - i*dx;
-        for(int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j*dx;
-
-            mPrevSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mCurrSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
-            mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
-        }
+    case Precision::Half:
+        mPrevHalf.assign(m*n, XMConvertFloatToHalf(0.0f));
+        mCurrHalf.assign(m*n, XMConvertFloatToHalf(0.0f));
+        break;
+    case Precision::Single:
+        mPrevSingle.assign(m*n, 0.0f);
+        mCurrSingle.assign(m*n, 0.0f);
+        break;
+    case Precision::Double:
+        mPrevDouble.assign(m*n, 0.0);
+        mCurrDouble.assign(m*n, 0.0);
+        break;
     }
+
+    mNormals.assign(m*n, XMFLOAT3(0.0f, 1.0f, 0.0f));
+    mTangentX.assign(m*n, XMFLOAT3(1.0f, 0.0f, 0.0f));
 }
 
 Waves::~Waves()
@@ -85,73 +114,169 @@ float Waves::Depth()const
 	return mNumRows*mSpatialStep;
 }
 
-void Waves::Update(float dt)
+Waves::Precision Waves::HeightPrecision()const
+{
+	return mPrecision;
+}
+
+XMFLOAT3 Waves::Position(int i)const
+{
+	// The x/z coordinates never change, so derive them from the grid
+	// instead of storing them next to the heights.
+	int row = i / mNumCols;
+	int col = i % mNumCols;
+
+	float halfWidth = (mNumCols - 1)*mSpatialStep*0.5f;
+	float halfDepth = (mNumRows - 1)*mSpatialStep*0.5f;
+
+	return XMFLOAT3(-halfWidth + col*mSpatialStep, Height(i), halfDepth - row*mSpatialStep);
+}
+
+float Waves::Height(int i)const
 {
-	static float t = 0;
+	switch(mPrecision)
+	{
+	case Precision::Half:
+		return XMConvertHalfToFloat(mCurrHalf[i]);
+	case Precision::Double:
+		return (float)mCurrDouble[i];
+	default:
+		return mCurrSingle[i];
+	}
+}
+
+double Waves::ExactHeight(int i)const
+{
+	switch(mPrecision)
+	{
+	case Precision::Half:
+		return XMConvertHalfToFloat(mCurrHalf[i]);
+	case Precision::Double:
+		return mCurrDouble[i];
+	default:
+		return mCurrSingle[i];
+	}
+}
 
+void Waves::Update(float dt)
+{
 	// Accumulate time.
-	t += dt;
+	mAccumTime += dt;
 
 	// Only update the simulation at the specified time step.
-	if( t >= mTimeStep )
+	if( mAccumTime >= mTimeStep )
 	{
-		// Only update interior points; we use zero boundary conditions.
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows-1; ++i)
-		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-
-				mPrevSolution[i*mNumCols+j].y = 
-					mK1*mPrevSolution[i*mNumCols+j].y +
-					mK2*mCurrSolution[i*mNumCols+j].y +
-					mK3*(mCurrSolution[(i+1)*mNumCols+j].y + 
-					     mCurrSolution[(i-1)*mNumCols+j].y + 
-					     mCurrSolution[i*mNumCols+j+1].y + 
-						 mCurrSolution[i*mNumCols+j-1].y);
-			}
-		});
+		Step();
+
+		mAccumTime = 0.0f; // reset time
+	}
+}
+
+void Waves::Step()
+{
+	StepHeights();
+
+	switch(mPrecision)
+	{
+	case Precision::Half:
+		ComputeNormals(mCurrHalf);
+		break;
+	case Precision::Single:
+		ComputeNormals(mCurrSingle);
+		break;
+	case Precision::Double:
+		ComputeNormals(mCurrDouble);
+		break;
+	}
+}
+
+void Waves::StepHeights()
+{
+	switch(mPrecision)
+	{
+	case Precision::Half:
+		StepSolution(mPrevHalf, mCurrHalf);
 
 		// We just overwrote the previous buffer with the new data, so
 		// this data needs to become the current solution and the old
 		// current solution becomes the new previous solution.
-		std::swap(mPrevSolution, mCurrSolution);
+		std::swap(mPrevHalf, mCurrHalf);
+		break;
+	case Precision::Single:
+		StepSolution(mPrevSingle, mCurrSingle);
+		std::swap(mPrevSingle, mCurrSingle);
+		break;
+	case Precision::Double:
+		StepSolution(mPrevDouble, mCurrDouble);
+		std::swap(mPrevDouble, mCurrDouble);
+		break;
+	}
+}
+
+template<typename HeightT>
+void Waves::StepSolution(std::vector<HeightT>& prev, const std::vector<HeightT>& curr)
+{
+	typedef typename WaveHeight<HeightT>::Compute Compute;
 
-		t = 0.0f; // reset time
+	const Compute k1 = (Compute)mK1;
+	const Compute k2 = (Compute)mK2;
+	const Compute k3 = (Compute)mK3;
 
-		//
-		// Compute normals using finite difference scheme.
-		//
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows - 1; ++i)
+	// Only update interior points; we use zero boundary conditions.
+	concurrency::parallel_for(1, mNumRows - 1, [&](int i)
+	//for(int i = 1; i < mNumRows-1; ++i)
+	{
+		for(int j = 1; j < mNumCols-1; ++j)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				float l = mCurrSolution[i*mNumCols+j-1].y;
-				float r = mCurrSolution[i*mNumCols+j+1].y;
-				float t = mCurrSolution[(i-1)*mNumCols+j].y;
-				float b = mCurrSolution[(i+1)*mNumCols+j].y;
-				mNormals[i*mNumCols+j].x = -r+l;
-				mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
-				mNormals[i*mNumCols+j].z = b-t;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
-				XMStoreFloat3(&mNormals[i*mNumCols+j], n);
-
-				mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
-				XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
-			}
-		});
-	}
+			// After this update we will be discarding the old previous
+			// buffer, so overwrite that buffer with the new update.
+			// Note how we can do this inplace (read/write to same element)
+			// because we won't need prev_ij again and the assignment happens last.
+
+			// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+			// Moreover, our +z axis goes "down"; this is just to
+			// keep consistent with our row indices going down.
+
+			Compute h =
+				k1*WaveHeight<HeightT>::Load(prev[i*mNumCols+j]) +
+				k2*WaveHeight<HeightT>::Load(curr[i*mNumCols+j]) +
+				k3*(WaveHeight<HeightT>::Load(curr[(i+1)*mNumCols+j]) +
+				    WaveHeight<HeightT>::Load(curr[(i-1)*mNumCols+j]) +
+				    WaveHeight<HeightT>::Load(curr[i*mNumCols+j+1]) +
+				    WaveHeight<HeightT>::Load(curr[i*mNumCols+j-1]));
+
+			prev[i*mNumCols+j] = WaveHeight<HeightT>::Store(h);
+		}
+	});
+}
+
+template<typename HeightT>
+void Waves::ComputeNormals(const std::vector<HeightT>& curr)
+{
+	//
+	// Compute normals using finite difference scheme.
+	//
+	concurrency::parallel_for(1, mNumRows - 1, [&](int i)
+	//for(int i = 1; i < mNumRows - 1; ++i)
+	{
+		for(int j = 1; j < mNumCols-1; ++j)
+		{
+			float l = (float)WaveHeight<HeightT>::Load(curr[i*mNumCols+j-1]);
+			float r = (float)WaveHeight<HeightT>::Load(curr[i*mNumCols+j+1]);
+			float t = (float)WaveHeight<HeightT>::Load(curr[(i-1)*mNumCols+j]);
+			float b = (float)WaveHeight<HeightT>::Load(curr[(i+1)*mNumCols+j]);
+			mNormals[i*mNumCols+j].x = -r+l;
+			mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
+			mNormals[i*mNumCols+j].z = b-t;
+
+			XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
+			XMStoreFloat3(&mNormals[i*mNumCols+j], n);
+
+			mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
+			XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
+			XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
+		}
+	});
 }
 
 void Waves::Disturb(int i, int j, float magnitude)
@@ -160,13 +285,146 @@ void Waves::Disturb(int i, int j, float magnitude)
 	assert(i > 1 && i < mNumRows-2);
 	assert(j > 1 && j < mNumCols-2);
 
-	float halfMag = 0.5f*magnitude;
+	switch(mPrecision)
+	{
+	case Precision::Half:
+		DisturbSolution(mCurrHalf, i, j, magnitude);
+		break;
+	case Precision::Single:
+		DisturbSolution(mCurrSingle, i, j, magnitude);
+		break;
+	case Precision::Double:
+		DisturbSolution(mCurrDouble, i, j, magnitude);
+		break;
+	}
+}
+
+template<typename HeightT>
+void Waves::DisturbSolution(std::vector<HeightT>& curr, int i, int j, float magnitude)
+{
+	typedef typename WaveHeight<HeightT>::Compute Compute;
+
+	const Compute mag = (Compute)magnitude;
+	const Compute halfMag = (Compute)0.5*mag;
 
 	// Disturb the ijth vertex height and its neighbors.
-	mCurrSolution[i*mNumCols+j].y     += magnitude;
-	mCurrSolution[i*mNumCols+j+1].y   += halfMag;
-	mCurrSolution[i*mNumCols+j-1].y   += halfMag;
-	mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
-	mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+	auto add = [&curr](int k, Compute dh)
+	{
+		curr[k] = WaveHeight<HeightT>::Store(WaveHeight<HeightT>::Load(curr[k]) + dh);
+	};
+
+	add(i*mNumCols+j,     mag);
+	add(i*mNumCols+j+1,   halfMag);
+	add(i*mNumCols+j-1,   halfMag);
+	add((i+1)*mNumCols+j, halfMag);
+	add((i-1)*mNumCols+j, halfMag);
+}
+
+double Waves::MaxHeightError(const Waves& reference)const
+{
+	assert(reference.mNumRows == mNumRows && reference.mNumCols == mNumCols);
+
+	double maxError = 0.0;
+	for(int i = 0; i < mVertexCount; ++i)
+		maxError = std::max(maxError, std::abs(ExactHeight(i) - reference.ExactHeight(i)));
+
+	return maxError;
+}
+
+double Waves::MaxAbsHeight()const
+{
+	double maxHeight = 0.0;
+	for(int i = 0; i < mVertexCount; ++i)
+		maxHeight = std::max(maxHeight, std::abs(ExactHeight(i)));
+
+	return maxHeight;
+}
+
+std::size_t Waves::HeightBytes()const
+{
+	std::size_t elementSize = sizeof(float);
+	if(mPrecision == Precision::Half)
+		elementSize = sizeof(std::uint16_t);
+	else if(mPrecision == Precision::Double)
+		elementSize = sizeof(double);
+
+	// One step reads prev and curr and writes prev.
+	return 3 * (std::size_t)mVertexCount * elementSize;
+}
+
+std::vector<Waves::PrecisionReport> Waves::ComparePrecisions(int m, int n, int numSteps, int disturbInterval)
+{
+	assert(m > 8 && n > 8 && disturbInterval > 0);
+
+	const Precision precisions[3] = { Precision::Double, Precision::Single, Precision::Half };
+
+	// The constants of the demos.
+	std::unique_ptr<Waves> waves[3];
+	for(int k = 0; k < 3; ++k)
+		waves[k] = std::make_unique<Waves>(m, n, 1.0f, 0.03f, 4.0f, 0.2f, precisions[k]);
+
+	struct Disturbance
+	{
+		int Step;
+		int I;
+		int J;
+		float Magnitude;
+	};
+
+	std::minstd_rand rng(1);
+	std::vector<Disturbance> disturbances;
+
+	double stepSeconds[3] = { 0.0, 0.0, 0.0 };
+	double maxError[3] = { 0.0, 0.0, 0.0 };
+
+	// Run the simulations a batch of steps at a time, each on its own so the
+	// timings do not mix, and compare them between batches.
+	const int batchSize = 1000;
+	for(int first = 0; first < numSteps; first += batchSize)
+	{
+		const int last = std::min(first + batchSize, numSteps);
+
+		disturbances.clear();
+		for(int step = first + disturbInterval - first % disturbInterval; step < last; step += disturbInterval)
+		{
+			Disturbance d;
+			d.Step = step;
+			d.I = 4 + (int)(rng() % (m - 8));
+			d.J = 4 + (int)(rng() % (n - 8));
+			d.Magnitude = 0.2f + 0.3f*(float)(rng() % 1000) / 1000.0f;
+			disturbances.push_back(d);
+		}
+
+		for(int k = 0; k < 3; ++k)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			std::size_t next = 0;
+			for(int step = first; step < last; ++step)
+			{
+				for(; next < disturbances.size() && disturbances[next].Step == step; ++next)
+					waves[k]->Disturb(disturbances[next].I, disturbances[next].J, disturbances[next].Magnitude);
+
+				waves[k]->StepHeights();
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+			stepSeconds[k] += std::chrono::duration<double>(end - start).count();
+		}
+
+		for(int k = 1; k < 3; ++k)
+			maxError[k] = std::max(maxError[k], waves[k]->MaxHeightError(*waves[0]));
+	}
+
+	std::vector<PrecisionReport> reports(3);
+	for(int k = 0; k < 3; ++k)
+	{
+		reports[k].HeightPrecision = precisions[k];
+		reports[k].MaxError = maxError[k];
+		reports[k].MaxAbsHeight = waves[k]->MaxAbsHeight();
+		reports[k].StepMs = numSteps > 0 ? 1000.0*stepSeconds[k] / numSteps : 0.0;
+		reports[k].HeightBytes = waves[k]->HeightBytes();
+	}
+
+	return reports;
 }
-	
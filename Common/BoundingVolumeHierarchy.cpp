@@ -0,0 +1,329 @@
+//***************************************************************************************
+// BoundingVolumeHierarchy.cpp
+//***************************************************************************************
+
+#include "BoundingVolumeHierarchy.h"
+#include "MathHelper.h"
+#include <numeric>
+
+using namespace DirectX;
+
+namespace
+{
+	float Component(const XMFLOAT3& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+
+	float SurfaceArea(FXMVECTOR boxMin, FXMVECTOR boxMax)
+	{
+		XMFLOAT3 e;
+		XMStoreFloat3(&e, XMVectorSubtract(boxMax, boxMin));
+
+		return 2.0f*(e.x*e.y + e.y*e.z + e.z*e.x);
+	}
+}
+
+void RayPacket::Set(const XMFLOAT3 origins[4], const XMFLOAT3 dirs[4])
+{
+	OriginX = XMVectorSet(origins[0].x, origins[1].x, origins[2].x, origins[3].x);
+	OriginY = XMVectorSet(origins[0].y, origins[1].y, origins[2].y, origins[3].y);
+	OriginZ = XMVectorSet(origins[0].z, origins[1].z, origins[2].z, origins[3].z);
+
+	DirX = XMVectorSet(dirs[0].x, dirs[1].x, dirs[2].x, dirs[3].x);
+	DirY = XMVectorSet(dirs[0].y, dirs[1].y, dirs[2].y, dirs[3].y);
+	DirZ = XMVectorSet(dirs[0].z, dirs[1].z, dirs[2].z, dirs[3].z);
+
+	// A zero component becomes an infinite inverse, which puts the slab of
+	// that axis at infinity on both sides.
+	InvDirX = XMVectorReciprocal(DirX);
+	InvDirY = XMVectorReciprocal(DirY);
+	InvDirZ = XMVectorReciprocal(DirZ);
+}
+
+XMVECTOR RayPacket::Intersects(const BoundingBox& box, FXMVECTOR maxDist)const
+{
+	XMVECTOR enter = XMVectorZero();
+	XMVECTOR exit = maxDist;
+
+	// Clip the ray against the slab of each axis.
+	auto clip = [&](FXMVECTOR origin, FXMVECTOR invDir, float center, float extent)
+	{
+		XMVECTOR t0 = (XMVectorReplicate(center - extent) - origin)*invDir;
+		XMVECTOR t1 = (XMVectorReplicate(center + extent) - origin)*invDir;
+
+		enter = XMVectorMax(enter, XMVectorMin(t0, t1));
+		exit = XMVectorMin(exit, XMVectorMax(t0, t1));
+	};
+
+	clip(OriginX, InvDirX, box.Center.x, box.Extents.x);
+	clip(OriginY, InvDirY, box.Center.y, box.Extents.y);
+	clip(OriginZ, InvDirZ, box.Center.z, box.Extents.z);
+
+	return XMVectorLessOrEqual(enter, exit);
+}
+
+void BoundingVolumeHierarchy::Build(const std::vector<BoundingBox>& boxes)
+{
+	const UINT numItems = (UINT)boxes.size();
+
+	mItemBounds = boxes;
+
+	mItems.resize(numItems);
+	std::iota(mItems.begin(), mItems.end(), 0u);
+
+	mNodes.clear();
+	if(numItems == 0)
+		return;
+
+	mNodes.reserve(2*numItems);
+	BuildNode(0, numItems, 0, 0);
+}
+
+void BoundingVolumeHierarchy::SetItemBounds(UINT item, const BoundingBox& box)
+{
+	mItemBounds[item] = box;
+}
+
+void BoundingVolumeHierarchy::Refit()
+{
+	// Children always follow their parent, so walking the nodes backwards
+	// refits both children before the parent.
+	for(UINT n = (UINT)mNodes.size(); n-- > 0; )
+	{
+		Node& node = mNodes[n];
+
+		if(node.RightChild == 0)
+		{
+			BoundingBox bounds = mItemBounds[mItems[node.FirstItem]];
+			for(UINT i = node.FirstItem + 1; i < node.FirstItem + node.ItemCount; ++i)
+				BoundingBox::CreateMerged(bounds, bounds, mItemBounds[mItems[i]]);
+
+			node.Bounds = bounds;
+		}
+		else
+		{
+			BoundingBox::CreateMerged(node.Bounds, mNodes[n + 1].Bounds, mNodes[node.RightChild].Bounds);
+		}
+	}
+}
+
+UINT BoundingVolumeHierarchy::ItemCount()const
+{
+	return (UINT)mItems.size();
+}
+
+UINT BoundingVolumeHierarchy::NodeCount()const
+{
+	return (UINT)mNodes.size();
+}
+
+void BoundingVolumeHierarchy::FrustumQuery(const BoundingFrustum& frustum, std::vector<UINT>& items)const
+{
+	XMVECTOR planes[6];
+	frustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	FrustumQuery(planes, items);
+}
+
+void BoundingVolumeHierarchy::FrustumQuery(const XMVECTOR planes[6], std::vector<UINT>& items)const
+{
+	if(mNodes.empty())
+		return;
+
+	UINT stack[MaxDepth + 1];
+	int top = 0;
+	stack[top++] = 0;
+
+	while(top > 0)
+	{
+		const UINT n = stack[--top];
+		const Node& node = mNodes[n];
+
+		ContainmentType c = node.Bounds.ContainedBy(
+			planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]);
+
+		if(c == DirectX::DISJOINT)
+			continue;
+
+		// The whole subtree is inside: take its items without testing them.
+		if(c == DirectX::CONTAINS)
+		{
+			items.insert(items.end(),
+				mItems.begin() + node.FirstItem,
+				mItems.begin() + node.FirstItem + node.ItemCount);
+			continue;
+		}
+
+		if(node.RightChild == 0)
+		{
+			for(UINT i = node.FirstItem; i < node.FirstItem + node.ItemCount; ++i)
+			{
+				const UINT item = mItems[i];
+				if(mItemBounds[item].ContainedBy(
+					planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]) != DirectX::DISJOINT)
+				{
+					items.push_back(item);
+				}
+			}
+		}
+		else
+		{
+			stack[top++] = node.RightChild;
+			stack[top++] = n + 1;
+		}
+	}
+}
+
+UINT BoundingVolumeHierarchy::BuildNode(UINT first, UINT count, UINT depth, UINT parent)
+{
+	const UINT nodeIndex = (UINT)mNodes.size();
+	mNodes.emplace_back();
+
+	XMVECTOR boxMin = g_XMInfinity;
+	XMVECTOR boxMax = -g_XMInfinity;
+	XMVECTOR centerMin = g_XMInfinity;
+	XMVECTOR centerMax = -g_XMInfinity;
+
+	for(UINT i = first; i < first + count; ++i)
+	{
+		const BoundingBox& box = mItemBounds[mItems[i]];
+		XMVECTOR c = XMLoadFloat3(&box.Center);
+		XMVECTOR e = XMLoadFloat3(&box.Extents);
+
+		boxMin = XMVectorMin(boxMin, c - e);
+		boxMax = XMVectorMax(boxMax, c + e);
+		centerMin = XMVectorMin(centerMin, c);
+		centerMax = XMVectorMax(centerMax, c);
+	}
+
+	Node node;
+	BoundingBox::CreateFromPoints(node.Bounds, boxMin, boxMax);
+	node.FirstItem = first;
+	node.ItemCount = count;
+	node.Parent = parent;
+	mNodes[nodeIndex] = node;
+
+	if(count <= MinSplitCount || depth == MaxDepth)
+		return nodeIndex;
+
+	UINT axis = 0;
+	UINT leftCount = PartitionItems(first, count, centerMin, centerMax, SurfaceArea(boxMin, boxMax), axis);
+	if(leftCount == 0)
+		return nodeIndex;
+
+	// The left child is built next, so it lands at nodeIndex+1.
+	BuildNode(first, leftCount, depth + 1, nodeIndex);
+	UINT rightChild = BuildNode(first + leftCount, count - leftCount, depth + 1, nodeIndex);
+
+	mNodes[nodeIndex].RightChild = rightChild;
+	mNodes[nodeIndex].SplitAxis = axis;
+
+	return nodeIndex;
+}
+
+UINT BoundingVolumeHierarchy::PartitionItems(UINT first, UINT count,
+	FXMVECTOR centerMin, FXMVECTOR centerMax, float nodeArea, UINT& splitAxis)
+{
+	XMFLOAT3 lo;
+	XMFLOAT3 spread;
+	XMStoreFloat3(&lo, centerMin);
+	XMStoreFloat3(&spread, centerMax - centerMin);
+
+	// Split along the axis the centers are spread the most over.
+	int axis = 0;
+	if(spread.y > Component(spread, axis))
+		axis = 1;
+	if(spread.z > Component(spread, axis))
+		axis = 2;
+
+	splitAxis = axis;
+
+	// All the centers coincide, so no plane separates them; halve the node
+	// rather than keep a large leaf.
+	if(Component(spread, axis) <= 0.0f)
+		return count > MaxLeafCount ? count / 2 : 0;
+
+	const float axisMin = Component(lo, axis);
+	const float binScale = NumBins / Component(spread, axis);
+
+	auto binOf = [&](UINT item)
+	{
+		int bin = (int)((Component(mItemBounds[item].Center, axis) - axisMin)*binScale);
+		return bin < NumBins ? bin : NumBins - 1;
+	};
+
+	XMVECTOR binMin[NumBins];
+	XMVECTOR binMax[NumBins];
+	UINT binCount[NumBins];
+	for(int b = 0; b < NumBins; ++b)
+	{
+		binMin[b] = g_XMInfinity;
+		binMax[b] = -g_XMInfinity;
+		binCount[b] = 0;
+	}
+
+	for(UINT i = first; i < first + count; ++i)
+	{
+		const BoundingBox& box = mItemBounds[mItems[i]];
+		XMVECTOR c = XMLoadFloat3(&box.Center);
+		XMVECTOR e = XMLoadFloat3(&box.Extents);
+
+		int b = binOf(mItems[i]);
+		binMin[b] = XMVectorMin(binMin[b], c - e);
+		binMax[b] = XMVectorMax(binMax[b], c + e);
+		binCount[b]++;
+	}
+
+	// Sweep from the right to find the area and count right of every bin
+	// boundary, then from the left to evaluate each split.
+	float rightArea[NumBins];
+	UINT rightCount[NumBins];
+
+	XMVECTOR sweepMin = g_XMInfinity;
+	XMVECTOR sweepMax = -g_XMInfinity;
+	UINT sweepCount = 0;
+	for(int b = NumBins - 1; b > 0; --b)
+	{
+		sweepMin = XMVectorMin(sweepMin, binMin[b]);
+		sweepMax = XMVectorMax(sweepMax, binMax[b]);
+		sweepCount += binCount[b];
+
+		rightArea[b] = sweepCount > 0 ? SurfaceArea(sweepMin, sweepMax) : 0.0f;
+		rightCount[b] = sweepCount;
+	}
+
+	float bestCost = MathHelper::Infinity;
+	int bestSplit = 0;
+
+	sweepMin = g_XMInfinity;
+	sweepMax = -g_XMInfinity;
+	sweepCount = 0;
+	for(int b = 1; b < NumBins; ++b)
+	{
+		sweepMin = XMVectorMin(sweepMin, binMin[b - 1]);
+		sweepMax = XMVectorMax(sweepMax, binMax[b - 1]);
+		sweepCount += binCount[b - 1];
+
+		if(sweepCount == 0 || rightCount[b] == 0)
+			continue;
+
+		float cost = SurfaceArea(sweepMin, sweepMax)*sweepCount + rightArea[b]*rightCount[b];
+		if(cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = b;
+		}
+	}
+
+	// Visiting a node costs about as much as testing one item.  Keep the leaf
+	// if the expected cost of the children is no lower than testing all of it.
+	const float splitCost = nodeArea > 0.0f ? 1.0f + bestCost / nodeArea : 1.0f;
+	if(bestSplit == 0 || (splitCost >= (float)count && count <= MaxLeafCount))
+		return 0;
+
+	auto mid = std::partition(mItems.begin() + first, mItems.begin() + first + count,
+		[&](UINT item) { return binOf(item) < bestSplit; });
+
+	return (UINT)(mid - (mItems.begin() + first));
+}
@@ -0,0 +1,269 @@
+//***************************************************************************************
+// BoundingVolumeHierarchy.h
+//
+// A binary tree of axis-aligned boxes over a set of items, each item given by its
+// world space bounds.  Frustum queries accept or reject whole subtrees at once, and
+// ray queries visit the items whose boxes the ray hits from front to back.
+//***************************************************************************************
+
+#pragma once
+
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <algorithm>
+#include <vector>
+
+// Four rays with each component in its own vector: lane i of every vector
+// belongs to ray i.
+struct RayPacket
+{
+	void Set(const DirectX::XMFLOAT3 origins[4], const DirectX::XMFLOAT3 dirs[4]);
+
+	// Selects the lanes whose ray enters box before its lane of maxDist.
+	DirectX::XMVECTOR Intersects(const DirectX::BoundingBox& box, DirectX::FXMVECTOR maxDist)const;
+
+	DirectX::XMVECTOR OriginX;
+	DirectX::XMVECTOR OriginY;
+	DirectX::XMVECTOR OriginZ;
+
+	DirectX::XMVECTOR DirX;
+	DirectX::XMVECTOR DirY;
+	DirectX::XMVECTOR DirZ;
+
+	DirectX::XMVECTOR InvDirX;
+	DirectX::XMVECTOR InvDirY;
+	DirectX::XMVECTOR InvDirZ;
+};
+
+class BoundingVolumeHierarchy
+{
+public:
+	// Builds the tree over boxes, splitting each node where the surface area
+	// heuristic estimates the cheapest traversal.  Item i is boxes[i].
+	void Build(const std::vector<DirectX::BoundingBox>& boxes);
+
+	// Changes the bounds of an item that has moved.  The tree is only updated
+	// by Refit.
+	void SetItemBounds(UINT item, const DirectX::BoundingBox& box);
+
+	// Recomputes the node boxes from the item bounds, keeping the tree shape.
+	// This is much cheaper than Build, but the tree degrades as items move far
+	// from where they were built, so large changes call for a rebuild.
+	void Refit();
+
+	UINT ItemCount()const;
+	UINT NodeCount()const;
+
+	// Appends to items the items whose bounds are not entirely outside frustum,
+	// which is in the same space as the item bounds.
+	void FrustumQuery(const DirectX::BoundingFrustum& frustum, std::vector<UINT>& items)const;
+
+	// The same query against six outward facing planes, which need not be
+	// normalized.
+	void FrustumQuery(const DirectX::XMVECTOR planes[6], std::vector<UINT>& items)const;
+
+	// Calls visit(item, dist) for the items whose bounds the ray hits within
+	// maxDist, with dist the distance at which the ray enters the item's box.
+	// visit returns the new maxDist, typically the distance to the nearest hit
+	// found so far, which prunes the rest of the search.  dir must be unit
+	// length.
+	//
+	// The traversal needs no stack: it climbs back up through the parent links,
+	// and enters the child on the near side of each split first, so the
+	// nearest hits tend to be found early.
+	template<typename Visit>
+	void RayQuery(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR dir, float maxDist, Visit visit)const
+	{
+		if(mNodes.empty())
+			return;
+
+		DirectX::XMFLOAT3 d;
+		DirectX::XMStoreFloat3(&d, dir);
+		const bool leftIsNear[3] = { d.x >= 0.0f, d.y >= 0.0f, d.z >= 0.0f };
+
+		// Tests the ray against node n and visits its items if it is a leaf.
+		// Returns true if the children of n should be entered.
+		Traverse(leftIsNear, [&](UINT n)
+		{
+			const Node& node = mNodes[n];
+
+			float dist = 0.0f;
+			if(!node.Bounds.Intersects(origin, dir, dist) || dist > maxDist)
+				return false;
+
+			if(node.RightChild != 0)
+				return true;
+
+			for(UINT i = node.FirstItem; i < node.FirstItem + node.ItemCount; ++i)
+			{
+				const UINT item = mItems[i];
+				if(mItemBounds[item].Intersects(origin, dir, dist) && dist <= maxDist)
+					maxDist = visit(item, dist);
+			}
+
+			return false;
+		});
+	}
+
+	// The same search for the four rays of packet at once.  visit(item, mask)
+	// is called for the items whose bounds at least one ray hits within its
+	// lane of maxDist, with mask selecting those rays, and returns the new
+	// maxDist.  A lane of maxDist below zero disables its ray.  The traversal
+	// is shared, so it pays off when the rays are close together and point the
+	// same way; children are ordered by the direction of the first ray.
+	template<typename Visit>
+	void PacketRayQuery(const RayPacket& packet, DirectX::FXMVECTOR maxDist, Visit visit)const
+	{
+		if(mNodes.empty())
+			return;
+
+		const bool leftIsNear[3] =
+		{
+			DirectX::XMVectorGetX(packet.DirX) >= 0.0f,
+			DirectX::XMVectorGetX(packet.DirY) >= 0.0f,
+			DirectX::XMVectorGetX(packet.DirZ) >= 0.0f
+		};
+
+		DirectX::XMVECTOR laneMaxDist = maxDist;
+
+		Traverse(leftIsNear, [&](UINT n)
+		{
+			const Node& node = mNodes[n];
+
+			if(DirectX::XMVector4EqualInt(packet.Intersects(node.Bounds, laneMaxDist), DirectX::XMVectorZero()))
+				return false;
+
+			if(node.RightChild != 0)
+				return true;
+
+			for(UINT i = node.FirstItem; i < node.FirstItem + node.ItemCount; ++i)
+			{
+				const UINT item = mItems[i];
+
+				DirectX::XMVECTOR mask = packet.Intersects(mItemBounds[item], laneMaxDist);
+				if(!DirectX::XMVector4EqualInt(mask, DirectX::XMVectorZero()))
+					laneMaxDist = visit(item, mask);
+			}
+
+			return false;
+		});
+	}
+
+private:
+	// Nodes are stored depth first: the left child of node n is node n+1, and
+	// the items of any subtree are one contiguous range of mItems.
+	struct Node
+	{
+		DirectX::BoundingBox Bounds;
+		UINT FirstItem = 0;
+		UINT ItemCount = 0;
+
+		// Zero for leaves.
+		UINT RightChild = 0;
+
+		// Zero for the root.
+		UINT Parent = 0;
+
+		// The axis the children were split along.  The left child holds the
+		// items with the smaller centers.
+		UINT SplitAxis = 0;
+	};
+
+	// Walks the tree without a stack, climbing back up through the parent
+	// links.  enter(n) tests node n, and returns true if its children should
+	// be entered; leftIsNear[axis] says which child to enter first for each
+	// split axis.
+	template<typename Enter>
+	void Traverse(const bool leftIsNear[3], Enter enter)const
+	{
+		auto nearChild = [&](UINT n)
+		{
+			return leftIsNear[mNodes[n].SplitAxis] ? n + 1 : mNodes[n].RightChild;
+		};
+
+		auto farChild = [&](UINT n)
+		{
+			return leftIsNear[mNodes[n].SplitAxis] ? mNodes[n].RightChild : n + 1;
+		};
+
+		if(!enter(0))
+			return;
+
+		// How the traversal arrived at current: down from its parent as the
+		// near child, across from the near child as the far child, or back up
+		// from one of its children once that child is done.
+		enum class Arrival { FromParent, FromSibling, FromChild };
+
+		UINT current = nearChild(0);
+		Arrival arrival = Arrival::FromParent;
+
+		for(;;)
+		{
+			switch(arrival)
+			{
+			case Arrival::FromParent:
+				if(enter(current))
+					current = nearChild(current);
+				else
+				{
+					current = farChild(mNodes[current].Parent);
+					arrival = Arrival::FromSibling;
+				}
+				break;
+
+			case Arrival::FromSibling:
+				if(enter(current))
+				{
+					current = nearChild(current);
+					arrival = Arrival::FromParent;
+				}
+				else
+				{
+					current = mNodes[current].Parent;
+					arrival = Arrival::FromChild;
+				}
+				break;
+
+			case Arrival::FromChild:
+				if(current == 0)
+					return;
+
+				if(current == nearChild(mNodes[current].Parent))
+				{
+					current = farChild(mNodes[current].Parent);
+					arrival = Arrival::FromSibling;
+				}
+				else
+					current = mNodes[current].Parent;
+				break;
+			}
+		}
+	}
+
+	UINT BuildNode(UINT first, UINT count, UINT depth, UINT parent);
+
+	// Partitions the items [first, first+count) along the split with the
+	// lowest surface area cost and returns the number put on the left, or
+	// zero if the node is cheaper kept as a leaf.  axis is set to the axis
+	// the items were split along.
+	UINT PartitionItems(UINT first, UINT count, DirectX::FXMVECTOR centerMin,
+		DirectX::FXMVECTOR centerMax, float nodeArea, UINT& axis);
+
+private:
+	// Nodes with this many items or fewer are always leaves.
+	static const UINT MinSplitCount = 4;
+
+	// Nodes with more items are split even when the cost estimate says not to.
+	static const UINT MaxLeafCount = 16;
+
+	// Candidate split planes per node are the bounds of this many bins.
+	static const int NumBins = 12;
+
+	// Bounds the frustum query stack.
+	static const UINT MaxDepth = 64;
+
+	std::vector<Node> mNodes;
+	std::vector<UINT> mItems;
+	std::vector<DirectX::BoundingBox> mItemBounds;
+};
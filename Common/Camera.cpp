@@ -126,6 +126,49 @@ void Camera::SetLens(float fovY, float aspect, float zn, float zf)
 
 	XMMATRIX P = XMMatrixPerspectiveFovLH(mFovY, mAspect, mNearZ, mFarZ);
 	XMStoreFloat4x4(&mProj, P);
+
+	// Depth is A + B/z.  The standard projection maps [zn, zf] to [0, 1], which
+	// spends most of the depth values close to the eye.  Reversed, the dense
+	// float values near 0 go to the far distances instead, which evens out the
+	// 1/z falloff.  An infinite far plane is the limit as zf goes to infinity.
+	if(mInfiniteFar)
+	{
+		mProj(2, 2) = mReverseZ ? 0.0f : 1.0f;
+		mProj(3, 2) = mReverseZ ? mNearZ : -mNearZ;
+	}
+	else if(mReverseZ)
+	{
+		mProj(2, 2) = mNearZ / (mNearZ - mFarZ);
+		mProj(3, 2) = mNearZ*mFarZ / (mFarZ - mNearZ);
+	}
+
+	// The view space frustum follows from the lens directly.
+	float tanHalfFovY = tanf(0.5f*mFovY);
+	mFrustum = BoundingFrustum(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f),
+		mAspect*tanHalfFovY, -mAspect*tanHalfFovY, tanHalfFovY, -tanHalfFovY, mNearZ, mFarZ);
+
+	// Otherwise UpdateViewMatrix rebuilds them.
+	if(!mViewDirty)
+		UpdateDerivedMatrices();
+}
+
+void Camera::SetDepthMode(bool reverseZ, bool infiniteFar)
+{
+	mReverseZ = reverseZ;
+	mInfiniteFar = infiniteFar;
+
+	// Rebuild the projection with the current lens.
+	SetLens(mFovY, mAspect, mNearZ, mFarZ);
+}
+
+bool Camera::IsReverseZ()const
+{
+	return mReverseZ;
+}
+
+bool Camera::IsInfiniteFar()const
+{
+	return mInfiniteFar;
 }
 
 void Camera::LookAt(FXMVECTOR pos, FXMVECTOR target, FXMVECTOR worldUp)
@@ -176,6 +219,47 @@ XMFLOAT4X4 Camera::GetProj4x4f()const
 	return mProj;
 }
 
+XMMATRIX Camera::GetViewProj()const
+{
+	assert(!mViewDirty);
+	return XMLoadFloat4x4(&mViewProj);
+}
+
+XMMATRIX Camera::GetInvView()const
+{
+	assert(!mViewDirty);
+	return XMLoadFloat4x4(&mInvView);
+}
+
+XMMATRIX Camera::GetInvProj()const
+{
+	return XMLoadFloat4x4(&mInvProj);
+}
+
+XMMATRIX Camera::GetInvViewProj()const
+{
+	assert(!mViewDirty);
+	return XMLoadFloat4x4(&mInvViewProj);
+}
+
+const BoundingFrustum& Camera::GetFrustum()const
+{
+	return mFrustum;
+}
+
+const BoundingFrustum& Camera::GetWorldFrustum()const
+{
+	assert(!mViewDirty);
+	return mWorldFrustum;
+}
+
+void Camera::GetWorldPlanes(XMVECTOR planes[6])const
+{
+	assert(!mViewDirty);
+	for(int i = 0; i < 6; ++i)
+		planes[i] = XMLoadFloat4(&mWorldPlanes[i]);
+}
+
 void Camera::Strafe(float d)
 {
 	// mPosition += d*mRight
@@ -269,7 +353,134 @@ void Camera::UpdateViewMatrix()
 		mView(3, 3) = 1.0f;
 
 		mViewDirty = false;
+
+		UpdateDerivedMatrices();
 	}
 }
 
+void Camera::NextFrame()
+{
+	UpdateViewMatrix();
+
+	mPrevViewProj = mViewProj;
+	mHasPrevFrame = true;
+
+	if(mJitterSampleCount > 0)
+		mJitterIndex = (mJitterIndex + 1) % mJitterSampleCount;
+
+	UpdateDerivedMatrices();
+}
+
+void Camera::SetJitter(UINT sampleCount, UINT width, UINT height)
+{
+	mJitterSampleCount = sampleCount;
+	mJitterIndex = 0;
+	mJitterWidth = width;
+	mJitterHeight = height;
+
+	if(!mViewDirty)
+		UpdateDerivedMatrices();
+}
+
+XMFLOAT2 Camera::GetJitter()const
+{
+	return mJitter;
+}
+
+XMMATRIX Camera::GetJitteredProj()const
+{
+	return XMLoadFloat4x4(&mJitteredProj);
+}
+
+XMMATRIX Camera::GetJitteredViewProj()const
+{
+	assert(!mViewDirty);
+	return XMLoadFloat4x4(&mJitteredViewProj);
+}
+
+XMMATRIX Camera::GetPrevViewProj()const
+{
+	assert(!mViewDirty);
+	return XMLoadFloat4x4(&mPrevViewProj);
+}
+
+XMMATRIX Camera::GetReprojection()const
+{
+	assert(!mViewDirty);
+	return XMLoadFloat4x4(&mReprojection);
+}
+
+void Camera::UpdateDerivedMatrices()
+{
+	// The view matrix is a rigid transform, so its inverse is the camera's
+	// world matrix: the basis vectors as rows and the position.
+	mInvView(0, 0) = mRight.x;
+	mInvView(0, 1) = mRight.y;
+	mInvView(0, 2) = mRight.z;
+	mInvView(0, 3) = 0.0f;
+
+	mInvView(1, 0) = mUp.x;
+	mInvView(1, 1) = mUp.y;
+	mInvView(1, 2) = mUp.z;
+	mInvView(1, 3) = 0.0f;
+
+	mInvView(2, 0) = mLook.x;
+	mInvView(2, 1) = mLook.y;
+	mInvView(2, 2) = mLook.z;
+	mInvView(2, 3) = 0.0f;
+
+	mInvView(3, 0) = mPosition.x;
+	mInvView(3, 1) = mPosition.y;
+	mInvView(3, 2) = mPosition.z;
+	mInvView(3, 3) = 1.0f;
+
+	// The projection only has entries at (0,0), (1,1), (2,2), (3,2) and
+	// (2,3) = 1, so its inverse can be written down directly.  B is never 0
+	// in any depth mode.
+	const float A = mProj(2, 2);
+	const float B = mProj(3, 2);
+
+	mInvProj = XMFLOAT4X4(
+		1.0f / mProj(0, 0), 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f / mProj(1, 1), 0.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f / B,
+		0.0f, 0.0f, 1.0f, -A / B);
+
+	XMMATRIX view = XMLoadFloat4x4(&mView);
+	XMMATRIX invView = XMLoadFloat4x4(&mInvView);
+
+	XMStoreFloat4x4(&mViewProj, XMMatrixMultiply(view, XMLoadFloat4x4(&mProj)));
+	XMStoreFloat4x4(&mInvViewProj, XMMatrixMultiply(XMLoadFloat4x4(&mInvProj), invView));
+
+	mFrustum.Transform(mWorldFrustum, invView);
+
+	XMVECTOR planes[6];
+	mWorldFrustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+	for(int i = 0; i < 6; ++i)
+		XMStoreFloat4(&mWorldPlanes[i], planes[i]);
+
+	// Skip the first Halton point, which is 0 in every base.
+	mJitter = XMFLOAT2(0.0f, 0.0f);
+	if(mJitterSampleCount > 0)
+	{
+		mJitter.x = MathHelper::Halton(mJitterIndex + 1, 2) - 0.5f;
+		mJitter.y = MathHelper::Halton(mJitterIndex + 1, 3) - 0.5f;
+	}
+
+	// Since w = z, moving row 2 shifts every projected point by the same NDC
+	// offset.  Pixel y grows downward, NDC y upward.
+	mJitteredProj = mProj;
+	mJitteredProj(2, 0) += 2.0f*mJitter.x / mJitterWidth;
+	mJitteredProj(2, 1) -= 2.0f*mJitter.y / mJitterHeight;
+
+	XMStoreFloat4x4(&mJitteredViewProj, XMMatrixMultiply(view, XMLoadFloat4x4(&mJitteredProj)));
+
+	// Until there is a previous frame, reproject to this one.
+	if(!mHasPrevFrame)
+		mPrevViewProj = mViewProj;
+
+	XMStoreFloat4x4(&mReprojection,
+		XMMatrixMultiply(XMLoadFloat4x4(&mInvViewProj), XMLoadFloat4x4(&mPrevViewProj)));
+}
+
 
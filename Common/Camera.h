@@ -50,6 +50,15 @@ public:
 	// Set frustum.
 	void SetLens(float fovY, float aspect, float zn, float zf);
 
+	// Choose how the projection maps view depth to the depth buffer.  With
+	// reverseZ the near plane maps to 1 and the far plane to 0, so depth must
+	// be cleared to 0 and tested with GREATER.  With infiniteFar nothing is
+	// clipped by the far plane; zf then only bounds the frustum used for
+	// culling.  Both default to false.
+	void SetDepthMode(bool reverseZ, bool infiniteFar);
+	bool IsReverseZ()const;
+	bool IsInfiniteFar()const;
+
 	// Define camera space via LookAt parameters.
 	void LookAt(DirectX::FXMVECTOR pos, DirectX::FXMVECTOR target, DirectX::FXMVECTOR worldUp);
 	void LookAt(const DirectX::XMFLOAT3& pos, const DirectX::XMFLOAT3& target, const DirectX::XMFLOAT3& up);
@@ -61,6 +70,20 @@ public:
 	DirectX::XMFLOAT4X4 GetView4x4f()const;
 	DirectX::XMFLOAT4X4 GetProj4x4f()const;
 
+	// Get the matrices derived from View/Proj.  They are rebuilt only when
+	// UpdateViewMatrix or SetLens changes the camera, not on every call.
+	DirectX::XMMATRIX GetViewProj()const;
+	DirectX::XMMATRIX GetInvView()const;
+	DirectX::XMMATRIX GetInvProj()const;
+	DirectX::XMMATRIX GetInvViewProj()const;
+
+	// Get the frustum in view space and in world space, and the world space
+	// frustum planes in the order BoundingFrustum::GetPlanes returns them
+	// (near, far, right, left, top, bottom), normals pointing out.
+	const DirectX::BoundingFrustum& GetFrustum()const;
+	const DirectX::BoundingFrustum& GetWorldFrustum()const;
+	void GetWorldPlanes(DirectX::XMVECTOR planes[6])const;
+
 	// Strafe/Walk the camera a distance d.
 	void Strafe(float d);
 	void Walk(float d);
@@ -72,6 +95,38 @@ public:
 	// After modifying camera position/orientation, call to rebuild the view matrix.
 	void UpdateViewMatrix();
 
+	// Call once a frame, after the frame's matrices have been used and before
+	// the camera moves for the next one.  Saves the view-projection the frame
+	// was drawn with as the previous one and steps the jitter.
+	void NextFrame();
+
+	// Jitters the projection by a sub-pixel offset that cycles through the
+	// first sampleCount points of the Halton (2, 3) sequence, for temporal
+	// antialiasing.  width and height are the render target size.  A
+	// sampleCount of 0 turns jitter off.
+	void SetJitter(UINT sampleCount, UINT width, UINT height);
+
+	// The current jitter in pixels, in [-0.5, 0.5).
+	DirectX::XMFLOAT2 GetJitter()const;
+
+	// Proj and View*Proj with the jitter applied, to draw the scene with.
+	// The other matrices are not jittered.
+	DirectX::XMMATRIX GetJitteredProj()const;
+	DirectX::XMMATRIX GetJitteredViewProj()const;
+
+	// The View*Proj of the previous frame.
+	DirectX::XMMATRIX GetPrevViewProj()const;
+
+	// Maps a point (x, y, depth, 1) in this frame's NDC space to where it was
+	// in the previous frame's homogeneous clip space, for reprojecting last
+	// frame's results and finding the motion of a pixel.
+	DirectX::XMMATRIX GetReprojection()const;
+
+private:
+
+	// Rebuilds everything derived from View and Proj.
+	void UpdateDerivedMatrices();
+
 private:
 
 	// Camera coordinate system with coordinates relative to world space.
@@ -88,11 +143,38 @@ private:
 	float mNearWindowHeight = 0.0f;
 	float mFarWindowHeight = 0.0f;
 
+	bool mReverseZ = false;
+	bool mInfiniteFar = false;
+
+	UINT mJitterSampleCount = 0;
+	UINT mJitterIndex = 0;
+	UINT mJitterWidth = 1;
+	UINT mJitterHeight = 1;
+	DirectX::XMFLOAT2 mJitter = { 0.0f, 0.0f };
+
+	// False until the first NextFrame, while there is no previous frame.
+	bool mHasPrevFrame = false;
+
 	bool mViewDirty = true;
 
 	// Cache View/Proj matrices.
 	DirectX::XMFLOAT4X4 mView = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 mProj = MathHelper::Identity4x4();
+
+	// Cache matrices and volumes derived from View/Proj.
+	DirectX::XMFLOAT4X4 mViewProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mInvView = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mInvProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mInvViewProj = MathHelper::Identity4x4();
+
+	DirectX::BoundingFrustum mFrustum;
+	DirectX::BoundingFrustum mWorldFrustum;
+	DirectX::XMFLOAT4 mWorldPlanes[6];
+
+	DirectX::XMFLOAT4X4 mJitteredProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mJitteredViewProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mPrevViewProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mReprojection = MathHelper::Identity4x4();
 };
 
 #endif // CAMERA_H
\ No newline at end of file
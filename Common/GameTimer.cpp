@@ -125,3 +125,17 @@ void GameTimer::Tick()
 	}
 }
 
+__int64 GameTimer::ReadCounter()
+{
+	__int64 count;
+	QueryPerformanceCounter((LARGE_INTEGER*)&count);
+	return count;
+}
+
+double GameTimer::MillisecondsSince(__int64 startCount)
+{
+	__int64 countsPerSec;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+
+	return 1000.0*(double)(ReadCounter() - startCount) / (double)countsPerSec;
+}
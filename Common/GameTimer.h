@@ -18,6 +18,11 @@ public:
 	void Stop();  // Call when paused.
 	void Tick();  // Call every frame.
 
+	// For timing code: a raw performance counter reading, and the
+	// milliseconds that have passed since one.
+	static __int64 ReadCounter();
+	static double MillisecondsSince(__int64 startCount);
+
 private:
 	double mSecondsPerCount;
 	double mDeltaTime;
@@ -0,0 +1,129 @@
+//***************************************************************************************
+// KeyframeAnimation.cpp
+//***************************************************************************************
+
+#include "KeyframeAnimation.h"
+
+using namespace DirectX;
+
+Keyframe::Keyframe()
+	: TimePos(0.0f),
+	Translation(0.0f, 0.0f, 0.0f),
+	Scale(1.0f, 1.0f, 1.0f),
+	RotationQuat(0.0f, 0.0f, 0.0f, 1.0f)
+{
+}
+
+Keyframe::~Keyframe()
+{
+}
+
+// Each evaluator interpolates the key pair [i, i+1] at fraction s.
+
+struct KeyframeAnimation::StepKeys
+{
+	static void Evaluate(const std::vector<Keyframe>& keys, UINT i, float s, Keyframe& key)
+	{
+		key = keys[s < 1.0f ? i : i+1];
+	}
+};
+
+struct KeyframeAnimation::LinearKeys
+{
+	static void Evaluate(const std::vector<Keyframe>& keys, UINT i, float s, Keyframe& key)
+	{
+		const Keyframe& k0 = keys[i];
+		const Keyframe& k1 = keys[i+1];
+
+		XMStoreFloat3(&key.Scale, XMVectorLerp(XMLoadFloat3(&k0.Scale), XMLoadFloat3(&k1.Scale), s));
+		XMStoreFloat3(&key.Translation, XMVectorLerp(XMLoadFloat3(&k0.Translation), XMLoadFloat3(&k1.Translation), s));
+		XMStoreFloat4(&key.RotationQuat, XMQuaternionSlerp(XMLoadFloat4(&k0.RotationQuat), XMLoadFloat4(&k1.RotationQuat), s));
+	}
+};
+
+struct KeyframeAnimation::SplineKeys
+{
+	static void Evaluate(const std::vector<Keyframe>& keys, UINT i, float s, Keyframe& key)
+	{
+		// The first and last pairs repeat their outer key.
+		const Keyframe& k0 = keys[i > 0 ? i-1 : i];
+		const Keyframe& k1 = keys[i];
+		const Keyframe& k2 = keys[i+1];
+		const Keyframe& k3 = keys[i+2 < keys.size() ? i+2 : i+1];
+
+		XMStoreFloat3(&key.Scale, XMVectorCatmullRom(
+			XMLoadFloat3(&k0.Scale), XMLoadFloat3(&k1.Scale),
+			XMLoadFloat3(&k2.Scale), XMLoadFloat3(&k3.Scale), s));
+
+		XMStoreFloat3(&key.Translation, XMVectorCatmullRom(
+			XMLoadFloat3(&k0.Translation), XMLoadFloat3(&k1.Translation),
+			XMLoadFloat3(&k2.Translation), XMLoadFloat3(&k3.Translation), s));
+
+		XMVECTOR q1 = XMLoadFloat4(&k1.RotationQuat);
+		XMVECTOR a, b, c;
+		XMQuaternionSquadSetup(&a, &b, &c,
+			XMLoadFloat4(&k0.RotationQuat), q1,
+			XMLoadFloat4(&k2.RotationQuat), XMLoadFloat4(&k3.RotationQuat));
+
+		XMStoreFloat4(&key.RotationQuat, XMQuaternionNormalize(XMQuaternionSquad(q1, a, b, c, s)));
+	}
+};
+
+template<typename Evaluator>
+void KeyframeAnimation::InterpolateWith(const std::vector<Keyframe>& keys, float t, Keyframe& key, UINT& keyCursor)
+{
+	if( t <= keys.front().TimePos )
+	{
+		key = keys.front();
+		keyCursor = 0;
+	}
+	else if( t >= keys.back().TimePos )
+	{
+		key = keys.back();
+		keyCursor = (UINT)keys.size() - 2;
+	}
+	else
+	{
+		UINT i = FindKeyPair(keys, t, keyCursor);
+		keyCursor = i;
+
+		float s = (t - keys[i].TimePos) / (keys[i+1].TimePos - keys[i].TimePos);
+
+		Evaluator::Evaluate(keys, i, s, key);
+	}
+
+	key.TimePos = t;
+}
+
+void KeyframeAnimation::Interpolate(const std::vector<Keyframe>& keys, KeyInterpolation mode,
+	float t, Keyframe& key, UINT& keyCursor)
+{
+	switch(mode)
+	{
+	case KeyInterpolation::Step:
+		InterpolateWith<StepKeys>(keys, t, key, keyCursor);
+		break;
+	case KeyInterpolation::Spline:
+		InterpolateWith<SplineKeys>(keys, t, key, keyCursor);
+		break;
+	default:
+		InterpolateWith<LinearKeys>(keys, t, key, keyCursor);
+		break;
+	}
+}
+
+void KeyframeAnimation::ToMatrix(const Keyframe& key, XMFLOAT4X4& M)
+{
+	XMVECTOR S = XMLoadFloat3(&key.Scale);
+	XMVECTOR P = XMLoadFloat3(&key.Translation);
+	XMVECTOR Q = XMLoadFloat4(&key.RotationQuat);
+
+	XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+	XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+}
+
+UINT KeyframeAnimation::FindKeyPair(const std::vector<Keyframe>& keys, float t, UINT keyCursor)
+{
+	return FindKeyPair((UINT)keys.size(), t, keyCursor,
+		[&keys](UINT i) { return keys[i].TimePos; });
+}
@@ -0,0 +1,106 @@
+//***************************************************************************************
+// KeyframeAnimation.h
+//
+// Keyframes and keyframe interpolation shared by the quaternion and character
+// animation demos.
+//***************************************************************************************
+
+#pragma once
+
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <vector>
+
+///<summary>
+/// A Keyframe defines the bone transformation at an instant in time.
+///</summary>
+struct Keyframe
+{
+	Keyframe();
+	~Keyframe();
+
+    float TimePos;
+	DirectX::XMFLOAT3 Translation;
+    DirectX::XMFLOAT3 Scale;
+    DirectX::XMFLOAT4 RotationQuat;
+};
+
+///<summary>
+/// How the transform between two keyframes is computed.
+///</summary>
+enum class KeyInterpolation
+{
+	// Holds each key until the next one.
+	Step,
+
+	// Lerps translation and scale, slerps the rotation.
+	Linear,
+
+	// Catmull-Rom splines through translation and scale, squad through the
+	// rotation.  The curve passes through the keys with a continuous tangent,
+	// and uses the keys on either side of the bounding pair.
+	Spline
+};
+
+class KeyframeAnimation
+{
+public:
+	// Interpolates keys at time t into key, with key.TimePos set to t.  keyCursor
+	// remembers the key pair the last call ended at: playing forward then only
+	// steps ahead from the cursor, and seeking falls back to a binary search.
+	// keys must hold at least two keyframes, sorted by time.
+	static void Interpolate(const std::vector<Keyframe>& keys, KeyInterpolation mode,
+		float t, Keyframe& key, UINT& keyCursor);
+
+	// Builds the scale, rotation and translation matrix of key.
+	static void ToMatrix(const Keyframe& key, DirectX::XMFLOAT4X4& M);
+
+	// Returns the index i of the key pair [i, i+1] that bounds t, where
+	// timeAt(i) gives the time of key i.  keyCursor is the pair the previous
+	// search returned.
+	template<typename TimeAt>
+	static UINT FindKeyPair(UINT numKeys, float t, UINT keyCursor, TimeAt timeAt)
+	{
+		// During normal playback t only advances a little each frame, so the
+		// bounding pair is the cursor's pair or one of the next few.
+		const UINT maxForwardSteps = 4;
+
+		const UINT lastPair = numKeys - 2;
+		if( keyCursor <= lastPair && t >= timeAt(keyCursor) )
+		{
+			for(UINT i = keyCursor; i <= lastPair && i < keyCursor + maxForwardSteps; ++i)
+			{
+				if( t <= timeAt(i+1) )
+					return i;
+			}
+		}
+
+		// Seeking: binary search for the first key after t.
+		UINT lo = 0;
+		UINT hi = numKeys;
+		while(lo < hi)
+		{
+			UINT mid = (lo + hi) / 2;
+			if(t < timeAt(mid))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		UINT i = lo > 0 ? lo - 1 : 0;
+
+		return i < lastPair ? i : lastPair;
+	}
+
+	static UINT FindKeyPair(const std::vector<Keyframe>& keys, float t, UINT keyCursor);
+
+private:
+	// The interpolation modes, each a type so that the evaluator is chosen at
+	// compile time and inlined into the search loop.
+	struct StepKeys;
+	struct LinearKeys;
+	struct SplineKeys;
+
+	template<typename Evaluator>
+	static void InterpolateWith(const std::vector<Keyframe>& keys, float t, Keyframe& key, UINT& keyCursor);
+};
@@ -33,6 +33,21 @@ float MathHelper::AngleFromXY(float x, float y)
 	return theta;
 }
 
+float MathHelper::Halton(UINT index, UINT base)
+{
+	// Mirror the digits of index in the given base about the radix point.
+	float result = 0.0f;
+	float f = 1.0f;
+	while(index > 0)
+	{
+		f /= base;
+		result += f*(index % base);
+		index /= base;
+	}
+
+	return result;
+}
+
 XMVECTOR MathHelper::RandUnitVec3()
 {
 	XMVECTOR One  = XMVectorSet(1.0f, 1.0f, 1.0f, 1.0f);
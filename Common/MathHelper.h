@@ -57,6 +57,10 @@ public:
 	// Returns the polar angle of the point (x,y) in [0, 2*PI).
 	static float AngleFromXY(float x, float y);
 
+	// Returns element index of the Halton low discrepancy sequence in the given
+	// base, in [0, 1).  Consecutive elements fill the interval evenly.
+	static float Halton(UINT index, UINT base);
+
 	static DirectX::XMVECTOR SphericalToCartesian(float radius, float theta, float phi)
 	{
 		return DirectX::XMVectorSet(
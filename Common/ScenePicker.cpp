@@ -0,0 +1,241 @@
+//***************************************************************************************
+// ScenePicker.cpp
+//***************************************************************************************
+
+#include "ScenePicker.h"
+
+using namespace DirectX;
+
+UINT ScenePicker::AddItem(MeshGeometry& geo, UINT indexCount, UINT startIndexLocation, INT baseVertexLocation,
+	const BoundingBox& localBounds, const XMFLOAT4X4& world)
+{
+	Item item;
+	item.Triangles = &TriangleHierarchy::ForSubmesh(geo, indexCount, startIndexLocation, baseVertexLocation);
+	item.LocalBounds = localBounds;
+
+	mItems.push_back(item);
+	SetItemWorld((UINT)mItems.size() - 1, world);
+
+	mHierarchyBuilt = false;
+
+	return (UINT)mItems.size() - 1;
+}
+
+void ScenePicker::SetItemWorld(UINT item, const XMFLOAT4X4& world)
+{
+	XMMATRIX W = XMLoadFloat4x4(&world);
+	XMVECTOR det = XMMatrixDeterminant(W);
+
+	mItems[item].World = world;
+	XMStoreFloat4x4(&mItems[item].InvWorld, XMMatrixInverse(&det, W));
+
+	if(mHierarchyBuilt)
+	{
+		BoundingBox worldBounds;
+		mItems[item].LocalBounds.Transform(worldBounds, W);
+		mHierarchy.SetItemBounds(item, worldBounds);
+		mHierarchyDirty = true;
+	}
+}
+
+void ScenePicker::SetItemPickable(UINT item, bool pickable)
+{
+	mItems[item].Pickable = pickable;
+}
+
+void ScenePicker::Clear()
+{
+	mItems.clear();
+	mHierarchyBuilt = false;
+}
+
+UINT ScenePicker::ItemCount()const
+{
+	return (UINT)mItems.size();
+}
+
+ScenePicker::Hit ScenePicker::PickPixel(int sx, int sy, UINT width, UINT height, FXMMATRIX view, CXMMATRIX proj)
+{
+	XMFLOAT4X4 P;
+	XMStoreFloat4x4(&P, proj);
+
+	// Compute picking ray in view space.
+	float vx = (+2.0f*sx / width - 1.0f) / P(0, 0);
+	float vy = (-2.0f*sy / height + 1.0f) / P(1, 1);
+
+	XMVECTOR det = XMMatrixDeterminant(view);
+
+	return PickRay(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(vx, vy, 1.0f, 0.0f),
+		XMMatrixInverse(&det, view));
+}
+
+ScenePicker::Hit ScenePicker::PickPixel(int sx, int sy, UINT width, UINT height, const Camera& camera)
+{
+	XMFLOAT4X4 P = camera.GetProj4x4f();
+
+	float vx = (+2.0f*sx / width - 1.0f) / P(0, 0);
+	float vy = (-2.0f*sy / height + 1.0f) / P(1, 1);
+
+	return PickRay(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(vx, vy, 1.0f, 0.0f),
+		camera.GetInvView());
+}
+
+ScenePicker::Hit ScenePicker::PickRay(FXMVECTOR viewOrigin, FXMVECTOR viewDir, CXMMATRIX invView)
+{
+	UpdateHierarchy();
+
+	// The world space ray, to search the hierarchy over the item bounds.
+	XMVECTOR worldOrigin = XMVector3TransformCoord(viewOrigin, invView);
+	XMVECTOR worldDir = XMVector3Normalize(XMVector3TransformNormal(viewDir, invView));
+
+	Hit nearest;
+	nearest.Dist = MathHelper::Infinity;
+
+	mHierarchy.RayQuery(worldOrigin, worldDir, MathHelper::Infinity, [&](UINT i, float boxDist)
+	{
+		const Item& item = mItems[i];
+		if(!item.Pickable)
+			return nearest.Dist;
+
+		// Carry the ray into the local space of the item.  The direction is
+		// made unit length for the triangle tests, so a local distance t is
+		// t/localScale in world space.
+		XMMATRIX invWorld = XMLoadFloat4x4(&item.InvWorld);
+		XMVECTOR localOrigin = XMVector3TransformCoord(worldOrigin, invWorld);
+		XMVECTOR localDir = XMVector3TransformNormal(worldDir, invWorld);
+
+		float localScale = XMVectorGetX(XMVector3Length(localDir));
+		localDir = localDir / localScale;
+
+		TriangleHierarchy::RayHit hit;
+		if(item.Triangles->Intersects(localOrigin, localDir, nearest.Dist*localScale, hit))
+		{
+			nearest.Item = i;
+			nearest.Triangle = hit.Triangle;
+			nearest.Dist = hit.Dist / localScale;
+			nearest.Barycentrics = hit.Barycentrics;
+		}
+
+		return nearest.Dist;
+	});
+
+	if(nearest.Item != NoItem)
+		XMStoreFloat3(&nearest.Position, worldOrigin + nearest.Dist*worldDir);
+
+	return nearest;
+}
+
+void ScenePicker::PickRect(int x0, int y0, int x1, int y1, UINT width, UINT height,
+	FXMMATRIX view, CXMMATRIX proj, std::vector<UINT>& items)
+{
+	XMVECTOR det = XMMatrixDeterminant(view);
+
+	float nearZ;
+	float farZ;
+	DepthRange(proj, nearZ, farZ);
+
+	PickRectInvView(x0, y0, x1, y1, width, height, proj, XMMatrixInverse(&det, view),
+		nearZ, farZ, items);
+}
+
+void ScenePicker::PickRect(int x0, int y0, int x1, int y1, UINT width, UINT height,
+	const Camera& camera, std::vector<UINT>& items)
+{
+	// The camera's own depth range, which stays finite with an infinite far
+	// plane.
+	PickRectInvView(x0, y0, x1, y1, width, height, camera.GetProj(), camera.GetInvView(),
+		camera.GetNearZ(), camera.GetFarZ(), items);
+}
+
+void ScenePicker::PickRectInvView(int x0, int y0, int x1, int y1, UINT width, UINT height,
+	FXMMATRIX proj, CXMMATRIX invView, float nearZ, float farZ, std::vector<UINT>& items)
+{
+	UpdateHierarchy();
+
+	// Take in whole pixels, so that a rectangle of one pixel is not empty.
+	float left = (float)MathHelper::Min(x0, x1);
+	float right = (float)MathHelper::Max(x0, x1) + 1.0f;
+	float top = (float)MathHelper::Min(y0, y1);
+	float bottom = (float)MathHelper::Max(y0, y1) + 1.0f;
+
+	BoundingFrustum viewFrustum = SubFrustum(proj, nearZ, farZ,
+		+2.0f*left / width - 1.0f, +2.0f*right / width - 1.0f,
+		-2.0f*bottom / height + 1.0f, -2.0f*top / height + 1.0f);
+
+	BoundingFrustum worldFrustum;
+	viewFrustum.Transform(worldFrustum, invView);
+
+	std::vector<UINT> candidates;
+	mHierarchy.FrustumQuery(worldFrustum, candidates);
+
+	XMVECTOR worldPlanes[6];
+	worldFrustum.GetPlanes(&worldPlanes[0], &worldPlanes[1], &worldPlanes[2],
+		&worldPlanes[3], &worldPlanes[4], &worldPlanes[5]);
+
+	for(UINT i : candidates)
+	{
+		const Item& item = mItems[i];
+		if(!item.Pickable)
+			continue;
+
+		// A plane p is carried to local space by the inverse transpose of the
+		// local to world transform of points, which is the transpose of World.
+		XMMATRIX worldT = XMMatrixTranspose(XMLoadFloat4x4(&item.World));
+
+		XMVECTOR localPlanes[6];
+		for(int p = 0; p < 6; ++p)
+			localPlanes[p] = XMPlaneTransform(worldPlanes[p], worldT);
+
+		if(item.Triangles->Intersects(localPlanes))
+			items.push_back(i);
+	}
+}
+
+BoundingFrustum ScenePicker::SubFrustum(FXMMATRIX proj, float nearZ, float farZ,
+	float left, float right, float bottom, float top)
+{
+	XMFLOAT4X4 P;
+	XMStoreFloat4x4(&P, proj);
+
+	// A view space point projects to x = P(0,0)*x/z and y = P(1,1)*y/z, so the
+	// slopes of the sides follow from the rectangle directly.
+	return BoundingFrustum(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f),
+		right / P(0, 0), left / P(0, 0), top / P(1, 1), bottom / P(1, 1), nearZ, farZ);
+}
+
+void ScenePicker::DepthRange(FXMMATRIX proj, float& nearZ, float& farZ)
+{
+	XMFLOAT4X4 P;
+	XMStoreFloat4x4(&P, proj);
+
+	// Depth is A + B/z, so depth 0 is at z = -B/A and depth 1 at z = B/(1-A).
+	// One of them is at infinity when A is 0 or 1.  Which is nearer depends on
+	// whether depth is reversed.
+	const float A = P(2, 2);
+	const float B = P(3, 2);
+
+	float z0 = A != 0.0f ? -B / A : MathHelper::Infinity;
+	float z1 = A != 1.0f ? B / (1.0f - A) : MathHelper::Infinity;
+
+	nearZ = MathHelper::Min(z0, z1);
+	farZ = MathHelper::Max(z0, z1);
+}
+
+void ScenePicker::UpdateHierarchy()
+{
+	if(!mHierarchyBuilt)
+	{
+		std::vector<BoundingBox> worldBounds(mItems.size());
+		for(size_t i = 0; i < mItems.size(); ++i)
+			mItems[i].LocalBounds.Transform(worldBounds[i], XMLoadFloat4x4(&mItems[i].World));
+
+		mHierarchy.Build(worldBounds);
+		mHierarchyBuilt = true;
+		mHierarchyDirty = false;
+	}
+	else if(mHierarchyDirty)
+	{
+		mHierarchy.Refit();
+		mHierarchyDirty = false;
+	}
+}
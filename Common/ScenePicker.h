@@ -0,0 +1,109 @@
+//***************************************************************************************
+// ScenePicker.h
+//
+// Picks the triangles of a set of placed submeshes with a ray through a pixel, and
+// selects the submeshes inside a rectangle of pixels.  The ray stays in view space
+// and is carried into the local space of each item as it is tested, so the hit
+// found is the nearest across all the items.
+//***************************************************************************************
+
+#pragma once
+
+#include "BoundingVolumeHierarchy.h"
+#include "Camera.h"
+#include "TriangleHierarchy.h"
+
+class ScenePicker
+{
+public:
+	static const UINT NoItem = 0xffffffff;
+
+	struct Hit
+	{
+		// NoItem if nothing was hit.
+		UINT Item = NoItem;
+
+		// The triangle's index within the item's submesh.
+		UINT Triangle = 0;
+
+		// Distance from the eye in world units, and the world space point.
+		float Dist = 0.0f;
+		DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+
+		// The weights of the triangle's second and third vertices at the hit
+		// point; the first vertex has weight 1-x-y.
+		DirectX::XMFLOAT2 Barycentrics = { 0.0f, 0.0f };
+	};
+
+	// Adds the submesh of geo drawn with the given DrawIndexedInstanced
+	// parameters, placed by world, and returns its index.  localBounds bounds
+	// the submesh.  The CPU buffers of geo must stay alive.
+	UINT AddItem(MeshGeometry& geo, UINT indexCount, UINT startIndexLocation, INT baseVertexLocation,
+		const DirectX::BoundingBox& localBounds, const DirectX::XMFLOAT4X4& world);
+
+	void SetItemWorld(UINT item, const DirectX::XMFLOAT4X4& world);
+
+	// Items that are not pickable are skipped by every query.
+	void SetItemPickable(UINT item, bool pickable);
+
+	void Clear();
+	UINT ItemCount()const;
+
+	// Finds the nearest triangle under pixel (sx, sy) of a width by height
+	// viewport, seen through view and the perspective projection proj.
+	Hit PickPixel(int sx, int sy, UINT width, UINT height,
+		DirectX::FXMMATRIX view, DirectX::CXMMATRIX proj);
+
+	// The same through camera, using the matrices it has cached.
+	Hit PickPixel(int sx, int sy, UINT width, UINT height, const Camera& camera);
+
+	// The same for a view space ray.  viewDir need not be unit length.
+	Hit PickRay(DirectX::FXMVECTOR viewOrigin, DirectX::FXMVECTOR viewDir, DirectX::CXMMATRIX invView);
+
+	// Appends to items the items with at least one triangle inside the
+	// rectangle of pixels with corners (x0, y0) and (x1, y1), which may be in
+	// any order.
+	void PickRect(int x0, int y0, int x1, int y1, UINT width, UINT height,
+		DirectX::FXMMATRIX view, DirectX::CXMMATRIX proj, std::vector<UINT>& items);
+	void PickRect(int x0, int y0, int x1, int y1, UINT width, UINT height,
+		const Camera& camera, std::vector<UINT>& items);
+
+	// The part of the view frustum of proj between depths nearZ and farZ that
+	// projects inside the rectangle [left, right] x [bottom, top] of
+	// normalized device coordinates.
+	static DirectX::BoundingFrustum SubFrustum(DirectX::FXMMATRIX proj, float nearZ, float farZ,
+		float left, float right, float bottom, float top);
+
+	// The view depths proj maps to the near and far ends of the depth range,
+	// for any of the Camera depth modes.  farZ is MathHelper::Infinity for an
+	// infinite far plane.
+	static void DepthRange(DirectX::FXMMATRIX proj, float& nearZ, float& farZ);
+
+private:
+	struct Item
+	{
+		const TriangleHierarchy* Triangles = nullptr;
+		DirectX::BoundingBox LocalBounds;
+		DirectX::XMFLOAT4X4 World;
+		DirectX::XMFLOAT4X4 InvWorld;
+		bool Pickable = true;
+	};
+
+	// Brings the hierarchy over the world bounds of the items up to date.
+	void UpdateHierarchy();
+
+	// PickRect given the inverse of the view matrix and the depth range.
+	void PickRectInvView(int x0, int y0, int x1, int y1, UINT width, UINT height,
+		DirectX::FXMMATRIX proj, DirectX::CXMMATRIX invView, float nearZ, float farZ,
+		std::vector<UINT>& items);
+
+private:
+	std::vector<Item> mItems;
+
+	BoundingVolumeHierarchy mHierarchy;
+
+	// Items have been added since the hierarchy was built, or moved since it
+	// was refit.
+	bool mHierarchyBuilt = false;
+	bool mHierarchyDirty = false;
+};
@@ -0,0 +1,280 @@
+//***************************************************************************************
+// TriangleHierarchy.cpp
+//***************************************************************************************
+
+#include "TriangleHierarchy.h"
+#include <numeric>
+#include <ppl.h>
+
+using namespace DirectX;
+
+namespace
+{
+	// Rays this close to parallel to a triangle's plane miss it.
+	const float ParallelEpsilon = 1e-12f;
+
+	// Which of the eight octants dir points into.
+	UINT Octant(const XMFLOAT3& dir)
+	{
+		return (dir.x < 0.0f ? 1u : 0u) | (dir.y < 0.0f ? 2u : 0u) | (dir.z < 0.0f ? 4u : 0u);
+	}
+}
+
+void TriangleHierarchy::Build(const MeshGeometry& geo, UINT indexCount,
+	UINT startIndexLocation, INT baseVertexLocation)
+{
+	const UINT numTriangles = indexCount / 3;
+
+	auto vertexData = (const BYTE*)geo.VertexBufferCPU->GetBufferPointer();
+	auto indexData = geo.IndexBufferCPU->GetBufferPointer();
+
+	auto indexAt = [&](UINT i)
+	{
+		UINT index = geo.IndexFormat == DXGI_FORMAT_R16_UINT ?
+			((const std::uint16_t*)indexData)[startIndexLocation + i] :
+			((const std::uint32_t*)indexData)[startIndexLocation + i];
+
+		return (UINT)(index + baseVertexLocation);
+	};
+
+	mVertices.resize(3*numTriangles);
+
+	std::vector<BoundingBox> boxes(numTriangles);
+	for(UINT t = 0; t < numTriangles; ++t)
+	{
+		for(UINT k = 0; k < 3; ++k)
+			mVertices[3*t + k] = *(const XMFLOAT3*)(vertexData + indexAt(3*t + k)*geo.VertexByteStride);
+
+		XMVECTOR v0 = XMLoadFloat3(&mVertices[3*t + 0]);
+		XMVECTOR v1 = XMLoadFloat3(&mVertices[3*t + 1]);
+		XMVECTOR v2 = XMLoadFloat3(&mVertices[3*t + 2]);
+
+		BoundingBox::CreateFromPoints(boxes[t],
+			XMVectorMin(v0, XMVectorMin(v1, v2)),
+			XMVectorMax(v0, XMVectorMax(v1, v2)));
+	}
+
+	mHierarchy.Build(boxes);
+}
+
+const TriangleHierarchy& TriangleHierarchy::ForSubmesh(MeshGeometry& geo,
+	UINT indexCount, UINT startIndexLocation, INT baseVertexLocation)
+{
+	SubmeshKey key;
+	key.IndexCount = indexCount;
+	key.StartIndexLocation = startIndexLocation;
+	key.BaseVertexLocation = baseVertexLocation;
+
+	auto& cached = geo.TriangleHierarchies[key];
+	if(cached == nullptr)
+	{
+		cached = std::make_shared<TriangleHierarchy>();
+		cached->Build(geo, indexCount, startIndexLocation, baseVertexLocation);
+	}
+
+	return *cached;
+}
+
+UINT TriangleHierarchy::TriangleCount()const
+{
+	return (UINT)mVertices.size() / 3;
+}
+
+void TriangleHierarchy::GetTriangle(UINT i, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2)const
+{
+	v0 = XMLoadFloat3(&mVertices[3*i + 0]);
+	v1 = XMLoadFloat3(&mVertices[3*i + 1]);
+	v2 = XMLoadFloat3(&mVertices[3*i + 2]);
+}
+
+bool TriangleHierarchy::Intersects(FXMVECTOR origin, FXMVECTOR dir, float maxDist, RayHit& hit)const
+{
+	UINT nearestTriangle = NoHit;
+
+	mHierarchy.RayQuery(origin, dir, maxDist, [&](UINT t, float boxDist)
+	{
+		XMVECTOR v0, v1, v2;
+		GetTriangle(t, v0, v1, v2);
+
+		float d = 0.0f;
+		if(TriangleTests::Intersects(origin, dir, v0, v1, v2, d) && d < maxDist)
+		{
+			maxDist = d;
+			nearestTriangle = t;
+		}
+
+		return maxDist;
+	});
+
+	if(nearestTriangle == NoHit)
+		return false;
+
+	// Solve for the barycentrics of the one triangle that was hit, the same
+	// way the Moller-Trumbore test does.
+	XMVECTOR v0, v1, v2;
+	GetTriangle(nearestTriangle, v0, v1, v2);
+
+	XMVECTOR e1 = v1 - v0;
+	XMVECTOR e2 = v2 - v0;
+	XMVECTOR p = XMVector3Cross(dir, e2);
+	XMVECTOR s = origin - v0;
+	XMVECTOR q = XMVector3Cross(s, e1);
+	float invDet = 1.0f / XMVectorGetX(XMVector3Dot(e1, p));
+
+	hit.Dist = maxDist;
+	hit.Triangle = nearestTriangle;
+	hit.Barycentrics.x = XMVectorGetX(XMVector3Dot(s, p))*invDet;
+	hit.Barycentrics.y = XMVectorGetX(XMVector3Dot(dir, q))*invDet;
+
+	return true;
+}
+
+bool TriangleHierarchy::Intersects(const XMVECTOR planes[6])const
+{
+	std::vector<UINT> candidates;
+	mHierarchy.FrustumQuery(planes, candidates);
+
+	for(UINT t : candidates)
+	{
+		XMVECTOR v0, v1, v2;
+		GetTriangle(t, v0, v1, v2);
+
+		if(TriangleTests::ContainedBy(v0, v1, v2,
+			planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]) != DirectX::DISJOINT)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TriangleHierarchy::IntersectPacket(const RayPacket& packet, FXMVECTOR maxDist, RayHit hits[4])const
+{
+	XMVECTOR nearest = maxDist;
+	XMVECTOR nearestTriangle = XMVectorReplicateInt(NoHit);
+	XMVECTOR nearestU = XMVectorZero();
+	XMVECTOR nearestV = XMVectorZero();
+
+	mHierarchy.PacketRayQuery(packet, maxDist, [&](UINT t, FXMVECTOR active)
+	{
+		// Moller-Trumbore, with the triangle in scalars and the rays in lanes.
+		const XMFLOAT3& p0 = mVertices[3*t + 0];
+		const XMFLOAT3& p1 = mVertices[3*t + 1];
+		const XMFLOAT3& p2 = mVertices[3*t + 2];
+
+		const XMFLOAT3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+		const XMFLOAT3 e2(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+
+		// p = dir x e2
+		XMVECTOR px = packet.DirY*e2.z - packet.DirZ*e2.y;
+		XMVECTOR py = packet.DirZ*e2.x - packet.DirX*e2.z;
+		XMVECTOR pz = packet.DirX*e2.y - packet.DirY*e2.x;
+
+		XMVECTOR det = px*e1.x + py*e1.y + pz*e1.z;
+		XMVECTOR invDet = XMVectorReciprocal(det);
+
+		// s = origin - p0
+		XMVECTOR sx = packet.OriginX - XMVectorReplicate(p0.x);
+		XMVECTOR sy = packet.OriginY - XMVectorReplicate(p0.y);
+		XMVECTOR sz = packet.OriginZ - XMVectorReplicate(p0.z);
+
+		XMVECTOR u = (sx*px + sy*py + sz*pz)*invDet;
+
+		// q = s x e1
+		XMVECTOR qx = sy*e1.z - sz*e1.y;
+		XMVECTOR qy = sz*e1.x - sx*e1.z;
+		XMVECTOR qz = sx*e1.y - sy*e1.x;
+
+		XMVECTOR v = (packet.DirX*qx + packet.DirY*qy + packet.DirZ*qz)*invDet;
+		XMVECTOR dist = (qx*e2.x + qy*e2.y + qz*e2.z)*invDet;
+
+		XMVECTOR zero = XMVectorZero();
+		XMVECTOR hit = XMVectorAndInt(active, XMVectorGreater(XMVectorAbs(det), XMVectorReplicate(ParallelEpsilon)));
+		hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(u, zero));
+		hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(v, zero));
+		hit = XMVectorAndInt(hit, XMVectorLessOrEqual(u + v, XMVectorSplatOne()));
+		hit = XMVectorAndInt(hit, XMVectorGreater(dist, zero));
+		hit = XMVectorAndInt(hit, XMVectorLess(dist, nearest));
+
+		nearest = XMVectorSelect(nearest, dist, hit);
+		nearestTriangle = XMVectorSelect(nearestTriangle, XMVectorReplicateInt(t), hit);
+		nearestU = XMVectorSelect(nearestU, u, hit);
+		nearestV = XMVectorSelect(nearestV, v, hit);
+
+		return nearest;
+	});
+
+	XMFLOAT4 dists;
+	XMUINT4 triangles;
+	XMFLOAT4 us;
+	XMFLOAT4 vs;
+	XMStoreFloat4(&dists, nearest);
+	XMStoreUInt4(&triangles, nearestTriangle);
+	XMStoreFloat4(&us, nearestU);
+	XMStoreFloat4(&vs, nearestV);
+
+	hits[0] = { dists.x, triangles.x, XMFLOAT2(us.x, vs.x) };
+	hits[1] = { dists.y, triangles.y, XMFLOAT2(us.y, vs.y) };
+	hits[2] = { dists.z, triangles.z, XMFLOAT2(us.z, vs.z) };
+	hits[3] = { dists.w, triangles.w, XMFLOAT2(us.w, vs.w) };
+}
+
+void TriangleHierarchy::IntersectStream(const std::vector<Ray>& rays, std::vector<RayHit>& hits, RayOrder order)const
+{
+	const UINT numRays = (UINT)rays.size();
+	const UINT numPackets = (numRays + 3) / 4;
+
+	hits.resize(numRays);
+
+	// The order in which the rays are packed, four to a packet.
+	std::vector<UINT> sequence(numRays);
+	if(order == RayOrder::Coherent)
+	{
+		std::iota(sequence.begin(), sequence.end(), 0u);
+	}
+	else
+	{
+		UINT offsets[9] = { 0 };
+		for(const Ray& ray : rays)
+			offsets[Octant(ray.Direction) + 1]++;
+
+		for(UINT o = 1; o < 9; ++o)
+			offsets[o] += offsets[o - 1];
+
+		for(UINT i = 0; i < numRays; ++i)
+			sequence[offsets[Octant(rays[i].Direction)]++] = i;
+	}
+
+	concurrency::parallel_for(0u, numPackets, PacketsPerTask, [&](UINT firstPacket)
+	{
+		UINT lastPacket = MathHelper::Min(firstPacket + PacketsPerTask, numPackets);
+
+		for(UINT p = firstPacket; p < lastPacket; ++p)
+		{
+			XMFLOAT3 origins[4];
+			XMFLOAT3 dirs[4];
+			float maxDists[4];
+
+			// The last packet is padded with disabled copies of its first ray.
+			for(UINT lane = 0; lane < 4; ++lane)
+			{
+				const bool valid = 4*p + lane < numRays;
+				const Ray& ray = rays[sequence[valid ? 4*p + lane : 4*p]];
+
+				origins[lane] = ray.Origin;
+				dirs[lane] = ray.Direction;
+				maxDists[lane] = valid ? ray.MaxDist : -1.0f;
+			}
+
+			RayPacket packet;
+			packet.Set(origins, dirs);
+
+			RayHit packetHits[4];
+			IntersectPacket(packet, XMVectorSet(maxDists[0], maxDists[1], maxDists[2], maxDists[3]), packetHits);
+
+			for(UINT lane = 0; lane < 4 && 4*p + lane < numRays; ++lane)
+				hits[sequence[4*p + lane]] = packetHits[lane];
+		}
+	});
+}
@@ -0,0 +1,93 @@
+//***************************************************************************************
+// TriangleHierarchy.h
+//
+// A bounding volume hierarchy over the triangles of one submesh, built from the
+// CPU copies of a MeshGeometry's vertex and index buffers, so that a ray only tests
+// the triangles near its path rather than every triangle of the mesh.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "BoundingVolumeHierarchy.h"
+
+class TriangleHierarchy
+{
+public:
+	// A ray in the local space of the submesh.  Direction should be unit length
+	// for distances to be in local units.
+	struct Ray
+	{
+		DirectX::XMFLOAT3 Origin;
+		DirectX::XMFLOAT3 Direction;
+		float MaxDist = MathHelper::Infinity;
+	};
+
+	struct RayHit
+	{
+		float Dist = 0.0f;
+
+		// NoHit if the ray missed the submesh.
+		UINT Triangle = NoHit;
+
+		// The weights of the triangle's second and third vertices at the hit
+		// point; the first vertex has weight 1-x-y.
+		DirectX::XMFLOAT2 Barycentrics = { 0.0f, 0.0f };
+	};
+
+	static const UINT NoHit = 0xffffffff;
+
+	// Whether the rays given to IntersectStream are already grouped so that
+	// every four consecutive rays are close together and point the same way,
+	// as when they come from neighboring pixels.
+	enum class RayOrder
+	{
+		Coherent,
+		Incoherent
+	};
+
+	// Builds the hierarchy over the triangles drawn by DrawIndexedInstanced with
+	// these parameters.  The position of a vertex must be the XMFLOAT3 at the
+	// start of it, as in every vertex format of the demos, and geo must use a
+	// triangle list.
+	void Build(const MeshGeometry& geo, UINT indexCount, UINT startIndexLocation, INT baseVertexLocation);
+
+	// Returns the hierarchy of the submesh, building it and caching it in geo
+	// on first use.  The cache is not updated if the CPU buffers change.
+	static const TriangleHierarchy& ForSubmesh(MeshGeometry& geo,
+		UINT indexCount, UINT startIndexLocation, INT baseVertexLocation);
+
+	UINT TriangleCount()const;
+
+	// The vertices of triangle i, the i-th triangle of the submesh.
+	void GetTriangle(UINT i, DirectX::XMVECTOR& v0, DirectX::XMVECTOR& v1, DirectX::XMVECTOR& v2)const;
+
+	// Finds the nearest triangle the ray hits within maxDist, searching the
+	// hierarchy front to back.  dir must be unit length.  Returns false if
+	// there is none, and leaves hit unchanged.
+	bool Intersects(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR dir, float maxDist, RayHit& hit)const;
+
+	// True if any triangle is at least partly inside the six planes, which
+	// face outward and are in the local space of the submesh.
+	bool Intersects(const DirectX::XMVECTOR planes[6])const;
+
+	// Finds the nearest hits of the four rays of packet, testing each triangle
+	// against all four rays at once.  A lane of maxDist below zero disables its
+	// ray.
+	void IntersectPacket(const RayPacket& packet, DirectX::FXMVECTOR maxDist, RayHit hits[4])const;
+
+	// Finds the nearest hit of every ray on the worker threads, four rays at a
+	// time; hits[i] is the hit of rays[i].  Incoherent rays are first grouped
+	// by the signs of their directions, so that at least the rays of a packet
+	// agree on which child of a node is nearer.
+	void IntersectStream(const std::vector<Ray>& rays, std::vector<RayHit>& hits, RayOrder order)const;
+
+private:
+	// Packets per parallel task in IntersectStream.
+	static const UINT PacketsPerTask = 64;
+
+	BoundingVolumeHierarchy mHierarchy;
+
+	// Three positions per triangle, in submesh order.
+	std::vector<DirectX::XMFLOAT3> mVertices;
+};
@@ -142,6 +142,8 @@ public:
     int LineNumber = -1;
 };
 
+class TriangleHierarchy;
+
 // Defines a subrange of geometry in a MeshGeometry.  This is for when multiple
 // geometries are stored in one vertex and index buffer.  It provides the offsets
 // and data needed to draw a subset of geometry stores in the vertex and index 
@@ -157,6 +159,32 @@ struct SubmeshGeometry
 	DirectX::BoundingBox Bounds;
 };
 
+// The draw arguments of a submesh, for caching data per submesh.  Submeshes can
+// share a StartIndexLocation, e.g. with different base vertices or index counts,
+// so all three are compared.
+struct SubmeshKey
+{
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+	INT BaseVertexLocation = 0;
+
+	bool operator==(const SubmeshKey& rhs)const
+	{
+		return IndexCount == rhs.IndexCount &&
+			StartIndexLocation == rhs.StartIndexLocation &&
+			BaseVertexLocation == rhs.BaseVertexLocation;
+	}
+};
+
+struct SubmeshKeyHash
+{
+	std::size_t operator()(const SubmeshKey& key)const
+	{
+		UINT64 location = ((UINT64)key.StartIndexLocation << 32) | (UINT)key.BaseVertexLocation;
+		return std::hash<UINT64>()(location) ^ (std::hash<UINT>()(key.IndexCount)*31);
+	}
+};
+
 struct MeshGeometry
 {
 	// Give it a name so we can look it up by name.
@@ -201,6 +229,10 @@ struct MeshGeometry
 	// the Submeshes individually.
 	std::unordered_map<std::string, SubmeshGeometry> DrawArgs;
 
+	// Triangle hierarchies over the CPU copies of the submeshes that have been
+	// ray cast.  See TriangleHierarchy::ForSubmesh.
+	std::unordered_map<SubmeshKey, std::shared_ptr<TriangleHierarchy>, SubmeshKeyHash> TriangleHierarchies;
+
 	D3D12_VERTEX_BUFFER_VIEW VertexBufferView()const
 	{
 		D3D12_VERTEX_BUFFER_VIEW vbv;